@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bgzf.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+const unsigned char BGZF_EOF_BLOCK[BGZF_EOF_SIZE] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+    0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+static void put_le16(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)((v >> 8) & 0xff);
+}
+
+static unsigned int get_le16(const unsigned char *p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+static unsigned long get_le32(const unsigned char *p) {
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, unsigned long v) {
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)((v >> 8) & 0xff);
+    p[2] = (unsigned char)((v >> 16) & 0xff);
+    p[3] = (unsigned char)((v >> 24) & 0xff);
+}
+
+int bgzf_deflate_init(z_stream *strm, int level) {
+    memset(strm, 0, sizeof(*strm));
+    /* Raw deflate: the gzip header and trailer are written by hand */
+    return deflateInit2(strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+size_t bgzf_compress_block(z_stream *strm, unsigned char *out,
+                           const unsigned char *data, size_t len) {
+    if (strm == NULL || out == NULL || len > BGZF_BLOCK_DATA_SIZE) {
+        return 0;
+    }
+    
+    if (deflateReset(strm) != Z_OK) {
+        return 0;
+    }
+    strm->next_in = (Bytef *)data;
+    strm->avail_in = (uInt)len;
+    strm->next_out = out + BGZF_HEADER_SIZE;
+    strm->avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+    
+    if (deflate(strm, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    
+    size_t block_size = BGZF_HEADER_SIZE + strm->total_out + BGZF_FOOTER_SIZE;
+    
+    /* gzip header with the BC extra subfield holding BSIZE (block size - 1) */
+    memcpy(out, BGZF_EOF_BLOCK, 16);
+    put_le16(out + 16, (unsigned int)(block_size - 1));
+    
+    unsigned char *footer = out + BGZF_HEADER_SIZE + strm->total_out;
+    put_le32(footer, crc32(crc32(0L, Z_NULL, 0), data, (uInt)len));
+    put_le32(footer + 4, (unsigned long)len);
+    
+    return block_size;
+}
+
+size_t bgzf_store_block(unsigned char *out, const unsigned char *data, size_t len) {
+    if (out == NULL || len > BGZF_BLOCK_DATA_SIZE) {
+        return 0;
+    }
+    
+    /* One final stored deflate block: BFINAL/BTYPE byte, LEN, NLEN, data */
+    unsigned char *p = out + BGZF_HEADER_SIZE;
+    p[0] = 0x01;
+    put_le16(p + 1, (unsigned int)len);
+    put_le16(p + 3, (unsigned int)(~len & 0xffff));
+    memcpy(p + 5, data, len);
+    
+    size_t block_size = BGZF_HEADER_SIZE + 5 + len + BGZF_FOOTER_SIZE;
+    memcpy(out, BGZF_EOF_BLOCK, 16);
+    put_le16(out + 16, (unsigned int)(block_size - 1));
+    
+    unsigned char *footer = p + 5 + len;
+    put_le32(footer, crc32(crc32(0L, Z_NULL, 0), data, (uInt)len));
+    put_le32(footer + 4, (unsigned long)len);
+    
+    return block_size;
+}
+
+size_t bgzf_extra_length(const unsigned char *header) {
+    if (header == NULL || header[0] != 0x1f || header[1] != 0x8b ||
+        header[2] != 0x08 || (header[3] & 0x04) == 0) {
+        return 0;
+    }
+    return get_le16(header + 10);
+}
+
+size_t bgzf_block_size(const unsigned char *header, size_t header_len) {
+    size_t xlen = bgzf_extra_length(header);
+    if (xlen == 0 || header_len < BGZF_FIXED_HEADER_SIZE + xlen) {
+        return 0;
+    }
+    
+    /* Walk the extra subfields looking for BC with a 2-byte payload */
+    const unsigned char *p = header + BGZF_FIXED_HEADER_SIZE;
+    const unsigned char *end = p + xlen;
+    while (p + 4 <= end) {
+        size_t sub_len = get_le16(p + 2);
+        if (p[0] == 'B' && p[1] == 'C' && sub_len == 2 && p + 6 <= end) {
+            size_t block_size = get_le16(p + 4) + 1;
+            if (block_size < BGZF_FIXED_HEADER_SIZE + xlen + BGZF_FOOTER_SIZE) {
+                return 0;
+            }
+            return block_size;
+        }
+        p += 4 + sub_len;
+    }
+    return 0;
+}
+
+/* pread() until len bytes or end of file; returns bytes read or -1 */
+static ssize_t pread_full(int fd, unsigned char *buf, size_t len, off_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = pread(fd, buf + total, len - total, offset + (off_t)total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t bgzf_read_block(int fd, off_t offset, unsigned char *block) {
+    ssize_t n = pread_full(fd, block, BGZF_FIXED_HEADER_SIZE, offset);
+    if (n <= 0) {
+        return n;
+    }
+    
+    errno = 0;
+    size_t xlen = (n == BGZF_FIXED_HEADER_SIZE) ? bgzf_extra_length(block) : 0;
+    if (xlen == 0 || BGZF_FIXED_HEADER_SIZE + xlen > BGZF_MAX_BLOCK_SIZE) {
+        return -1;
+    }
+    n = pread_full(fd, block + BGZF_FIXED_HEADER_SIZE, xlen, offset + BGZF_FIXED_HEADER_SIZE);
+    if (n != (ssize_t)xlen) {
+        return -1;
+    }
+    
+    size_t block_size = bgzf_block_size(block, BGZF_FIXED_HEADER_SIZE + xlen);
+    size_t header_len = BGZF_FIXED_HEADER_SIZE + xlen;
+    if (block_size == 0 ||
+        pread_full(fd, block + header_len, block_size - header_len,
+                   offset + (off_t)header_len) != (ssize_t)(block_size - header_len)) {
+        return -1;
+    }
+    return (ssize_t)block_size;
+}
+
+int bgzf_inflater_init(BgzfInflater *inflater) {
+    memset(inflater, 0, sizeof(*inflater));
+#ifdef HAVE_LIBDEFLATE
+    inflater->decompressor = libdeflate_alloc_decompressor();
+    inflater->ready = (inflater->decompressor != NULL);
+#else
+    inflater->ready = (inflateInit2(&inflater->strm, -15) == Z_OK);
+#endif
+    return inflater->ready;
+}
+
+void bgzf_inflater_free(BgzfInflater *inflater) {
+    if (inflater == NULL || !inflater->ready) {
+        return;
+    }
+#ifdef HAVE_LIBDEFLATE
+    libdeflate_free_decompressor(inflater->decompressor);
+#else
+    inflateEnd(&inflater->strm);
+#endif
+    inflater->ready = 0;
+}
+
+int bgzf_inflate_block(BgzfInflater *inflater, const unsigned char *block, size_t block_len,
+                       unsigned char *out, size_t out_size, size_t *out_len) {
+    if (inflater == NULL || !inflater->ready || block_len < BGZF_FIXED_HEADER_SIZE) {
+        return 0;
+    }
+    
+    size_t header_len = BGZF_FIXED_HEADER_SIZE + bgzf_extra_length(block);
+    if (header_len + BGZF_FOOTER_SIZE > block_len) {
+        return 0;
+    }
+    
+    const unsigned char *cdata = block + header_len;
+    size_t cdata_len = block_len - header_len - BGZF_FOOTER_SIZE;
+    const unsigned char *footer = block + block_len - BGZF_FOOTER_SIZE;
+    size_t expected_len = get_le32(footer + 4);
+    size_t produced = 0;
+    
+    if (expected_len > out_size) {
+        return 0;
+    }
+
+#ifdef HAVE_LIBDEFLATE
+    if (libdeflate_deflate_decompress(inflater->decompressor, cdata, cdata_len,
+                                      out, out_size, &produced) != LIBDEFLATE_SUCCESS) {
+        return 0;
+    }
+    unsigned long crc = libdeflate_crc32(0, out, produced);
+#else
+    if (inflateReset(&inflater->strm) != Z_OK) {
+        return 0;
+    }
+    inflater->strm.next_in = (Bytef *)cdata;
+    inflater->strm.avail_in = (uInt)cdata_len;
+    inflater->strm.next_out = out;
+    inflater->strm.avail_out = (uInt)out_size;
+    if (inflate(&inflater->strm, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    produced = inflater->strm.total_out;
+    unsigned long crc = crc32(crc32(0L, Z_NULL, 0), out, (uInt)produced);
+#endif
+    
+    if (produced != expected_len || crc != get_le32(footer)) {
+        return 0;
+    }
+    
+    *out_len = produced;
+    return 1;
+}
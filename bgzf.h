@@ -0,0 +1,75 @@
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <stdlib.h>
+#include <sys/types.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+/* BGZF (blocked gzip) block format helpers.
+ *
+ * Every BGZF block is a complete gzip member carrying its compressed size
+ * in a "BC" extra field, so blocks can be compressed independently and the
+ * concatenation is still a valid gzip file for standard tools.
+ */
+
+#define BGZF_BLOCK_DATA_SIZE 65280   /* Uncompressed bytes per block */
+#define BGZF_MAX_BLOCK_SIZE 65536    /* Upper bound of one compressed block */
+#define BGZF_HEADER_SIZE 18
+#define BGZF_FIXED_HEADER_SIZE 12    /* gzip header up to and including XLEN */
+#define BGZF_FOOTER_SIZE 8
+#define BGZF_EOF_SIZE 28
+
+/* Empty block marking the end of a BGZF file */
+extern const unsigned char BGZF_EOF_BLOCK[BGZF_EOF_SIZE];
+
+/* Reusable decompression state for bgzf_inflate_block */
+typedef struct {
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_decompressor *decompressor;
+#else
+    z_stream strm;
+#endif
+    int ready;
+} BgzfInflater;
+
+/* Prepare a reusable deflate stream for bgzf_compress_block */
+int bgzf_deflate_init(z_stream *strm, int level);
+
+/* Compress len (<= BGZF_BLOCK_DATA_SIZE) bytes into a block at out, which
+ * must hold BGZF_MAX_BLOCK_SIZE bytes; returns the block size, 0 on error */
+size_t bgzf_compress_block(z_stream *strm, unsigned char *out,
+                           const unsigned char *data, size_t len);
+
+/* Write len (<= BGZF_BLOCK_DATA_SIZE) bytes as a stored (uncompressed)
+ * block at out; the block size depends only on len, so a block holding
+ * other bytes of the same length can later replace it in place.
+ * Returns the block size. */
+size_t bgzf_store_block(unsigned char *out, const unsigned char *data, size_t len);
+
+/* Length of the gzip extra field announced by the first
+ * BGZF_FIXED_HEADER_SIZE bytes, or 0 if they do not start a member with one */
+size_t bgzf_extra_length(const unsigned char *header);
+
+/* Size of the BGZF block starting with header (BGZF_FIXED_HEADER_SIZE bytes
+ * plus the extra field), or 0 if it is not a BGZF block */
+size_t bgzf_block_size(const unsigned char *header, size_t header_len);
+
+/* Read the complete block starting at file offset into block, which must
+ * hold BGZF_MAX_BLOCK_SIZE bytes. Returns the block size, 0 at end of
+ * file, or -1 on a read error (errno set) or if no whole BGZF block
+ * starts there (errno 0). */
+ssize_t bgzf_read_block(int fd, off_t offset, unsigned char *block);
+
+/* Prepare / release an inflater */
+int bgzf_inflater_init(BgzfInflater *inflater);
+void bgzf_inflater_free(BgzfInflater *inflater);
+
+/* Decompress one complete block into out (out_size >= BGZF_MAX_BLOCK_SIZE)
+ * and check its CRC and length; returns 1 on success, 0 on corrupt data */
+int bgzf_inflate_block(BgzfInflater *inflater, const unsigned char *block, size_t block_len,
+                       unsigned char *out, size_t out_size, size_t *out_len);
+
+#endif /* BGZF_H */
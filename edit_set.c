@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+#include "edit_set.h"
+#include "input_stream.h"
+#include "utils.h"
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#define EDIT_TEXT_BLOCK (64 * 1024)
+
+/* Group of edits for one read ID in the hash index */
+typedef struct {
+    size_t start;   /* First edit in by_id */
+    size_t count;
+} IdGroup;
+
+struct EditSet {
+    Edit *by_index;         /* Sorted by read number, then line */
+    size_t num_by_index;
+    size_t cursor;          /* First edit not yet passed by edit_set_by_index */
+    
+    Edit *by_id;            /* Sorted by read ID, then line */
+    size_t num_by_id;
+    IdGroup *groups;        /* Open-addressing table, count == 0 marks empty */
+    size_t table_size;      /* Power of two */
+    
+    Arena text;             /* Read IDs and sequences */
+};
+
+/* FNV-1a */
+static size_t hash_id(const char *id, size_t len) {
+    size_t h = (size_t)14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)id[i];
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+/* Length of the first word of a header */
+static size_t id_word_len(const char *id, size_t len) {
+    size_t i = 0;
+    while (i < len && id[i] != ' ' && id[i] != '\t' && id[i] != '\0') {
+        i++;
+    }
+    return i;
+}
+
+static int compare_by_index(const void *a, const void *b) {
+    const Edit *x = a;
+    const Edit *y = b;
+    if (x->read_index != y->read_index) {
+        return (x->read_index > y->read_index) ? 1 : -1;
+    }
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+static int compare_by_id(const void *a, const void *b) {
+    const Edit *x = a;
+    const Edit *y = b;
+    int c = strcmp(x->read_id, y->read_id);
+    if (c != 0) {
+        return c;
+    }
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+/* Split off the next whitespace-separated field of *p, or NULL */
+static char* next_field(char **p) {
+    char *s = *p;
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    if (*s == '\0') {
+        *p = s;
+        return NULL;
+    }
+    char *start = s;
+    while (*s != '\0' && *s != ' ' && *s != '\t') {
+        s++;
+    }
+    if (*s != '\0') {
+        *s++ = '\0';
+    }
+    *p = s;
+    return start;
+}
+
+/* Parse a non-negative decimal number; returns 0 if field is not one */
+static int parse_size(const char *field, size_t *value) {
+    size_t v = 0;
+    if (*field == '\0') {
+        return 0;
+    }
+    for (const char *c = field; *c != '\0'; c++) {
+        if (!isdigit((unsigned char)*c)) {
+            return 0;
+        }
+        v = v * 10 + (size_t)(*c - '0');
+    }
+    *value = v;
+    return 1;
+}
+
+static void build_id_index(EditSet *set) {
+    size_t groups = 0;
+    for (size_t i = 0; i < set->num_by_id; i++) {
+        if (i == 0 || strcmp(set->by_id[i].read_id, set->by_id[i - 1].read_id) != 0) {
+            groups++;
+        }
+    }
+    
+    set->table_size = 16;
+    while (set->table_size < groups * 2) {
+        set->table_size *= 2;
+    }
+    set->groups = safe_malloc(sizeof(IdGroup) * set->table_size);
+    memset(set->groups, 0, sizeof(IdGroup) * set->table_size);
+    
+    size_t i = 0;
+    while (i < set->num_by_id) {
+        size_t j = i + 1;
+        while (j < set->num_by_id && strcmp(set->by_id[j].read_id, set->by_id[i].read_id) == 0) {
+            j++;
+        }
+        const char *id = set->by_id[i].read_id;
+        size_t slot = hash_id(id, strlen(id)) & (set->table_size - 1);
+        while (set->groups[slot].count != 0) {
+            slot = (slot + 1) & (set->table_size - 1);
+        }
+        set->groups[slot].start = i;
+        set->groups[slot].count = j - i;
+        i = j;
+    }
+}
+
+EditSet* edit_set_load(const char *filename) {
+    InputStream *in = input_stream_open(filename);
+    if (in == NULL) {
+        return NULL;
+    }
+    
+    size_t capacity = 1024;
+    size_t count = 0;
+    Edit *edits = safe_malloc(sizeof(Edit) * capacity);
+    /* Strings never move once allocated, so edits can point at them */
+    Arena text;
+    arena_init(&text, EDIT_TEXT_BLOCK);
+    
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t read;
+    size_t line_number = 0;
+    int status = SUCCESS;
+    
+    while ((read = input_stream_getline(in, &line, &line_size)) != -1) {
+        line_number++;
+        trim_newline_len(line, (size_t)read);
+        
+        char *p = line;
+        char *read_field = next_field(&p);
+        if (read_field == NULL || read_field[0] == '#') {
+            continue;
+        }
+        char *pos_field = next_field(&p);
+        char *seq_field = next_field(&p);
+        
+        Edit edit;
+        memset(&edit, 0, sizeof(edit));
+        edit.line = line_number;
+        if (pos_field == NULL || seq_field == NULL || next_field(&p) != NULL ||
+            !parse_size(pos_field, &edit.position)) {
+            fprintf(stderr, "Error: Invalid edit at %s:%zu (expected <read> <position> <sequence>)\n",
+                    filename, line_number);
+            status = ERR_INVALID_FORMAT;
+            break;
+        }
+        
+        if (!parse_size(read_field, &edit.read_index)) {
+            if (read_field[0] == '@' || read_field[0] == '>') {
+                read_field++;
+            }
+            if (read_field[0] == '\0') {
+                fprintf(stderr, "Error: Empty read ID at %s:%zu\n", filename, line_number);
+                status = ERR_INVALID_FORMAT;
+                break;
+            }
+            edit.read_index = 0;
+        } else if (edit.read_index == 0) {
+            fprintf(stderr, "Error: Read number must be >= 1 at %s:%zu\n", filename, line_number);
+            status = ERR_INVALID_FORMAT;
+            break;
+        }
+        edit.sequence_len = strlen(seq_field);
+        
+        if (count == capacity) {
+            capacity *= 2;
+            edits = safe_realloc(edits, sizeof(Edit) * capacity);
+        }
+        if (edit.read_index == 0) {
+            edit.read_id = arena_strndup(&text, read_field, strlen(read_field));
+        }
+        edit.sequence = arena_strndup(&text, seq_field, edit.sequence_len);
+        edits[count++] = edit;
+    }
+    
+    free(line);
+    input_stream_close(in);
+    
+    if (status != SUCCESS) {
+        free(edits);
+        arena_free(&text);
+        return NULL;
+    }
+    
+    EditSet *set = safe_malloc(sizeof(EditSet));
+    memset(set, 0, sizeof(EditSet));
+    set->text = text;
+    set->by_index = safe_malloc(sizeof(Edit) * (count + 1));
+    set->by_id = safe_malloc(sizeof(Edit) * (count + 1));
+    
+    for (size_t i = 0; i < count; i++) {
+        Edit *edit = &edits[i];
+        if (edit->read_index == 0) {
+            set->by_id[set->num_by_id++] = *edit;
+        } else {
+            set->by_index[set->num_by_index++] = *edit;
+        }
+    }
+    free(edits);
+    
+    qsort(set->by_index, set->num_by_index, sizeof(Edit), compare_by_index);
+    qsort(set->by_id, set->num_by_id, sizeof(Edit), compare_by_id);
+    build_id_index(set);
+    
+    return set;
+}
+
+size_t edit_set_size(const EditSet *set) {
+    return set->num_by_index + set->num_by_id;
+}
+
+size_t edit_set_last_index(const EditSet *set) {
+    if (set->num_by_id > 0) {
+        return SIZE_MAX;
+    }
+    return (set->num_by_index > 0) ? set->by_index[set->num_by_index - 1].read_index : 0;
+}
+
+size_t edit_set_by_index(EditSet *set, size_t read_index, const Edit **edits) {
+    while (set->cursor < set->num_by_index &&
+           set->by_index[set->cursor].read_index < read_index) {
+        set->cursor++;
+    }
+    
+    size_t end = set->cursor;
+    while (end < set->num_by_index && set->by_index[end].read_index == read_index) {
+        end++;
+    }
+    
+    *edits = set->by_index + set->cursor;
+    size_t n = end - set->cursor;
+    set->cursor = end;
+    return n;
+}
+
+size_t edit_set_next_index(const EditSet *set) {
+    return (set->cursor < set->num_by_index) ? set->by_index[set->cursor].read_index : 0;
+}
+
+size_t edit_set_by_id(const EditSet *set, const char *id, size_t id_len, const Edit **edits) {
+    if (set->num_by_id == 0) {
+        return 0;
+    }
+    
+    size_t len = id_word_len(id, id_len);
+    size_t slot = hash_id(id, len) & (set->table_size - 1);
+    
+    while (set->groups[slot].count != 0) {
+        const IdGroup *group = &set->groups[slot];
+        const char *key = set->by_id[group->start].read_id;
+        if (strncmp(key, id, len) == 0 && key[len] == '\0') {
+            *edits = set->by_id + group->start;
+            return group->count;
+        }
+        slot = (slot + 1) & (set->table_size - 1);
+    }
+    return 0;
+}
+
+void edit_set_free(EditSet *set) {
+    if (set == NULL) {
+        return;
+    }
+    free(set->by_index);
+    free(set->by_id);
+    free(set->groups);
+    arena_free(&set->text);
+    free(set);
+}
@@ -0,0 +1,57 @@
+#ifndef EDIT_SET_H
+#define EDIT_SET_H
+
+#include <stdlib.h>
+
+/* A set of (read, position, sequence) edits loaded from an edits file.
+ *
+ * Each non-empty line not starting with '#' holds three whitespace
+ * separated fields:
+ *
+ *     <read> <position> <sequence>
+ *
+ * <read> is a 1-based read number when it is all digits, otherwise a read
+ * ID (a leading '@' or '>' is ignored) matched against the first word of
+ * the record header. <position> is 0-based. The file may be gzipped.
+ *
+ * Edits by number are kept sorted and consumed with a cursor as records
+ * arrive in order; edits by ID are found through a hash index. Edits for
+ * the same read are applied in file order.
+ */
+typedef struct {
+    const char *read_id;     /* NULL for edits by read number */
+    size_t read_index;       /* 1-based read number, 0 for edits by ID */
+    size_t position;
+    const char *sequence;
+    size_t sequence_len;
+    size_t line;             /* Line in the edits file */
+} Edit;
+
+typedef struct EditSet EditSet;
+
+/* Load an edits file; returns NULL (after printing an error) on failure */
+EditSet* edit_set_load(const char *filename);
+
+/* Total number of edits in the set */
+size_t edit_set_size(const EditSet *set);
+
+/* Highest read number any edit can apply to, or SIZE_MAX if the set has
+ * edits by read ID (they may match any read) */
+size_t edit_set_last_index(const EditSet *set);
+
+/* Edits for read number read_index. Read numbers must be queried in
+ * increasing order. Returns the number of edits and points *edits at them. */
+size_t edit_set_by_index(EditSet *set, size_t read_index, const Edit **edits);
+
+/* Read number of the first edit by number that edit_set_by_index() has
+ * not returned or passed yet, or 0 if there is none */
+size_t edit_set_next_index(const EditSet *set);
+
+/* Edits for the read whose header starts with id (up to the first
+ * whitespace or id_len); returns the number of edits */
+size_t edit_set_by_id(const EditSet *set, const char *id, size_t id_len, const Edit **edits);
+
+/* Free the set */
+void edit_set_free(EditSet *set);
+
+#endif /* EDIT_SET_H */
@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+#include "fasta_index.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define INDEX_READ_SIZE (1024 * 1024)
+#define NAME_BLOCK_SIZE (64 * 1024)
+
+char* fasta_index_path(const char *filename) {
+    size_t len = strlen(filename);
+    char *path = safe_malloc(len + 5);
+    memcpy(path, filename, len);
+    memcpy(path + len, ".fai", 5);
+    return path;
+}
+
+/* Index under construction, with the state of the line being scanned */
+typedef struct {
+    FastaIndex *index;
+    size_t capacity;
+    FastaIndexEntry *entry;   /* Record being scanned, NULL before the first header */
+    char *name;               /* Its name so far */
+    size_t name_len;
+    size_t name_capacity;
+    int naming;               /* The header is still in its first word */
+    int in_header;
+    int line_start;
+    uint64_t line_len;        /* Bytes of the line so far, '\n' excluded */
+    char last;                /* Last of those bytes */
+    uint64_t lines;           /* Sequence lines of the record so far */
+    int ended;                /* A short line was seen: no more bases may follow */
+    uint64_t offset;          /* File offset of the next byte */
+} IndexBuilder;
+
+static void add_entry(IndexBuilder *builder) {
+    FastaIndex *index = builder->index;
+    if (index->num_entries == builder->capacity) {
+        builder->capacity = builder->capacity ? builder->capacity * 2 : 64;
+        index->entries = safe_realloc(index->entries, sizeof(FastaIndexEntry) * builder->capacity);
+    }
+    builder->entry = &index->entries[index->num_entries++];
+    memset(builder->entry, 0, sizeof(FastaIndexEntry));
+    builder->name_len = 0;
+    builder->naming = 1;
+    builder->in_header = 1;
+    builder->lines = 0;
+    builder->ended = 0;
+}
+
+static void append_name(IndexBuilder *builder, const char *data, size_t len) {
+    if (builder->name_len + len + 1 > builder->name_capacity) {
+        builder->name_capacity = (builder->name_len + len + 1) * 2;
+        builder->name = safe_realloc(builder->name, builder->name_capacity);
+    }
+    memcpy(builder->name + builder->name_len, data, len);
+    builder->name_len += len;
+}
+
+/* Account for the line that just ended (terminated by '\n' or not) */
+static int end_line(IndexBuilder *builder, int terminated, const char *filename) {
+    FastaIndexEntry *entry = builder->entry;
+    
+    if (builder->in_header) {
+        entry->name = arena_strndup(&builder->index->names, builder->name, builder->name_len);
+        entry->offset = builder->offset;
+        builder->in_header = 0;
+        return SUCCESS;
+    }
+    
+    uint64_t bases = builder->line_len;
+    if (bases > 0 && builder->last == '\r') {
+        bases--;
+    }
+    uint64_t width = builder->line_len + (terminated ? 1 : 0);
+    
+    if (entry == NULL) {
+        if (bases == 0) {
+            return SUCCESS;
+        }
+        fprintf(stderr, "Error: Cannot index '%s': it has text before the first header\n",
+                filename);
+        return ERR_INVALID_FORMAT;
+    }
+    if (bases == 0) {
+        builder->ended = 1;  /* Blank lines may only end a record */
+        return SUCCESS;
+    }
+    if (builder->ended || (builder->lines > 0 && bases > entry->line_bases)) {
+        fprintf(stderr, "Error: Cannot index '%s': record '%s' has lines of different lengths\n",
+                filename, entry->name);
+        return ERR_INVALID_FORMAT;
+    }
+    
+    if (builder->lines == 0) {
+        entry->line_bases = bases;
+        entry->line_width = width;
+    } else if (bases < entry->line_bases || width != entry->line_width) {
+        builder->ended = 1;  /* Only the last line may be shorter */
+    }
+    builder->lines++;
+    entry->length += bases;
+    return SUCCESS;
+}
+
+static int scan_data(IndexBuilder *builder, const char *data, size_t len, const char *filename) {
+    const char *p = data;
+    const char *end = data + len;
+    
+    while (p < end) {
+        if (builder->line_start) {
+            builder->line_start = 0;
+            builder->line_len = 0;
+            builder->last = '\0';
+            if (*p == '>') {
+                add_entry(builder);
+                p++;
+                builder->offset++;
+                continue;
+            }
+        }
+        
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *stop = (nl != NULL) ? nl : end;
+        if (builder->in_header) {
+            const char *q = p;
+            while (builder->naming && q < stop) {
+                if (*q == ' ' || *q == '\t' || *q == '\r') {
+                    builder->naming = 0;
+                } else {
+                    q++;
+                }
+            }
+            append_name(builder, p, (size_t)(q - p));
+        } else if (stop > p) {
+            builder->line_len += (uint64_t)(stop - p);
+            builder->last = stop[-1];
+        }
+        builder->offset += (uint64_t)(stop - p);
+        p = stop;
+        
+        if (nl != NULL) {
+            p++;
+            builder->offset++;
+            builder->line_start = 1;
+            int status = end_line(builder, 1, filename);
+            if (status != SUCCESS) {
+                return status;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+FastaIndex* fasta_index_build(const char *filename) {
+    if (filename == NULL) {
+        return NULL;
+    }
+    
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open input file '%s': %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    
+    FastaIndex *index = safe_malloc(sizeof(FastaIndex));
+    memset(index, 0, sizeof(FastaIndex));
+    arena_init(&index->names, NAME_BLOCK_SIZE);
+    IndexBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.index = index;
+    builder.line_start = 1;
+    
+    char *buffer = safe_malloc(INDEX_READ_SIZE);
+    int status = SUCCESS;
+    uint64_t total = 0;
+    ssize_t n;
+    
+    while (status == SUCCESS && (n = read(fd, buffer, INDEX_READ_SIZE)) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "Error: Failed to read '%s': %s\n", filename, strerror(errno));
+            status = ERR_FILE_READ;
+            break;
+        }
+        if (total == 0 && n >= 2 && (unsigned char)buffer[0] == 0x1f &&
+            (unsigned char)buffer[1] == 0x8b) {
+            fprintf(stderr, "Error: '%s' is compressed; only uncompressed FASTA can be "
+                    "indexed\n", filename);
+            status = ERR_INVALID_FORMAT;
+            break;
+        }
+        total += (uint64_t)n;
+        status = scan_data(&builder, buffer, (size_t)n, filename);
+    }
+    
+    /* An unterminated last line */
+    if (status == SUCCESS && !builder.line_start) {
+        status = end_line(&builder, 0, filename);
+    }
+    
+    close(fd);
+    free(buffer);
+    free(builder.name);
+    if (status != SUCCESS) {
+        fasta_index_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+int fasta_index_save(const FastaIndex *index, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return ERR_FILE_WRITE;
+    }
+    
+    for (size_t i = 0; i < index->num_entries; i++) {
+        const FastaIndexEntry *entry = &index->entries[i];
+        fprintf(fp, "%s\t%llu\t%llu\t%llu\t%llu\n", entry->name,
+                (unsigned long long)entry->length, (unsigned long long)entry->offset,
+                (unsigned long long)entry->line_bases, (unsigned long long)entry->line_width);
+    }
+    
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        remove(path);
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
+
+/* Parse one .fai line (without its '\n') into an entry of index; returns 0
+ * if it is malformed */
+static int parse_entry(char *line, FastaIndex *index, FastaIndexEntry *entry, uint64_t file_size) {
+    char *tab = strchr(line, '\t');
+    if (tab == NULL) {
+        return 0;
+    }
+    *tab = '\0';
+    
+    uint64_t fields[4];
+    char *p = tab + 1;
+    for (int i = 0; i < 4; i++) {
+        char *end;
+        errno = 0;
+        fields[i] = strtoull(p, &end, 10);
+        if (end == p || errno != 0 || (*end != '\t' && *end != '\0' && *end != '\r') ||
+            (i < 3 && *end != '\t')) {
+            return 0;
+        }
+        p = end + 1;
+    }
+    
+    entry->length = fields[0];
+    entry->offset = fields[1];
+    entry->line_bases = fields[2];
+    entry->line_width = fields[3];
+    if (entry->offset > file_size ||
+        (entry->length > 0 && (entry->line_bases == 0 || entry->line_width < entry->line_bases))) {
+        return 0;
+    }
+    entry->name = arena_strndup(&index->names, line, (size_t)(tab - line));
+    return 1;
+}
+
+FastaIndex* fasta_index_load(const char *path, const char *filename) {
+    struct stat st;
+    struct stat index_st;
+    if (stat(filename, &st) != 0 || stat(path, &index_st) != 0 ||
+        index_st.st_mtime < st.st_mtime) {
+        return NULL;
+    }
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    
+    FastaIndex *index = safe_malloc(sizeof(FastaIndex));
+    memset(index, 0, sizeof(FastaIndex));
+    arena_init(&index->names, NAME_BLOCK_SIZE);
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    
+    while ((len = getline(&line, &line_size, fp)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (index->num_entries == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            index->entries = safe_realloc(index->entries, sizeof(FastaIndexEntry) * capacity);
+        }
+        if (!parse_entry(line, index, &index->entries[index->num_entries], (uint64_t)st.st_size)) {
+            fasta_index_free(index);
+            index = NULL;
+            break;
+        }
+        index->num_entries++;
+    }
+    
+    free(line);
+    fclose(fp);
+    return index;
+}
+
+uint64_t fasta_index_offset(const FastaIndexEntry *entry, uint64_t position) {
+    return entry->offset + position / entry->line_bases * entry->line_width +
+           position % entry->line_bases;
+}
+
+void fasta_index_free(FastaIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    arena_free(&index->names);
+    free(index->entries);
+    free(index);
+}
@@ -0,0 +1,52 @@
+#ifndef FASTA_INDEX_H
+#define FASTA_INDEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "utils.h"
+
+/* samtools-style FASTA index, kept next to the FASTA as "<file>.fai".
+ *
+ * One tab-separated line per record: name (first word of the header),
+ * sequence length, file offset of the first base, bases per line and bytes
+ * per line (bases plus the line end). Every sequence line of a record but
+ * the last has the same length, so the file offset of any base follows
+ * from these numbers. Only uncompressed FASTA is indexed.
+ *
+ * An index older than its FASTA is treated as out of date.
+ */
+typedef struct {
+    char *name;
+    uint64_t length;          /* Bases in the record */
+    uint64_t offset;          /* File offset of the first base */
+    uint64_t line_bases;      /* Bases per full line */
+    uint64_t line_width;      /* Bytes per full line, line end included */
+} FastaIndexEntry;
+
+typedef struct {
+    FastaIndexEntry *entries;
+    size_t num_entries;
+    Arena names;              /* Storage for the entry names */
+} FastaIndex;
+
+/* Index file name for a FASTA file (caller frees) */
+char* fasta_index_path(const char *filename);
+
+/* Scan an uncompressed FASTA file; returns NULL (after printing an error)
+ * on failure or if the line lengths of a record differ */
+FastaIndex* fasta_index_build(const char *filename);
+
+/* Save to path; returns SUCCESS or ERR_FILE_WRITE (errno is set) */
+int fasta_index_save(const FastaIndex *index, const char *path);
+
+/* Load the index at path made for filename; returns NULL if it is
+ * missing, unreadable or older than the file */
+FastaIndex* fasta_index_load(const char *path, const char *filename);
+
+/* File offset of base position (0-based, < length) of a record */
+uint64_t fasta_index_offset(const FastaIndexEntry *entry, uint64_t position);
+
+/* Free the index */
+void fasta_index_free(FastaIndex *index);
+
+#endif /* FASTA_INDEX_H */
@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200809L
+#include "fasta_parser.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+#define READ_BUFFER_SIZE (1 << 20)
+
+/* Move unread bytes to the front of the buffer and read more input.
+ * Only called while the buffer has room. Returns bytes read, 0 at end of
+ * input, -1 on read error. */
+static ssize_t fill_buffer(FastaReader *reader) {
+    size_t pending = reader->buffer_end - reader->buffer_pos;
+    
+    if (reader->buffer_pos > 0) {
+        memmove(reader->buffer, reader->buffer + reader->buffer_pos, pending);
+        reader->buffer_pos = 0;
+        reader->buffer_end = pending;
+    }
+    
+    ssize_t n = input_stream_read(reader->input, reader->buffer + reader->buffer_end,
+                                  reader->buffer_size - reader->buffer_end);
+    
+    if (n > 0) {
+        reader->buffer_end += (size_t)n;
+    } else if (n == 0) {
+        reader->at_eof = 1;
+    }
+    return n;
+}
+
+/* Make sure at least one unread byte is buffered; returns 1, 0 at end of
+ * input, -1 on read error */
+static int peek_byte(FastaReader *reader) {
+    while (reader->buffer_pos == reader->buffer_end) {
+        if (reader->at_eof) {
+            return 0;
+        }
+        if (fill_buffer(reader) < 0) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/* Next piece of the current line: the rest of it, or as much as the
+ * buffer holds. Returns 1, 0 at end of input, -1 on read error. */
+static int next_piece(FastaReader *reader, char **data, size_t *len, int *line_end) {
+    for (;;) {
+        char *p = reader->buffer + reader->buffer_pos;
+        size_t avail = reader->buffer_end - reader->buffer_pos;
+        char *nl = (avail > 0) ? memchr(p, '\n', avail) : NULL;
+        
+        if (nl != NULL) {
+            *data = p;
+            *len = (size_t)(nl - p);
+            *line_end = 1;
+            reader->buffer_pos += *len + 1;
+        } else if (reader->at_eof || (reader->buffer_pos == 0 && avail == reader->buffer_size)) {
+            /* Unterminated last line, or a line longer than the buffer */
+            if (avail == 0) {
+                return 0;
+            }
+            *data = p;
+            *len = avail;
+            *line_end = reader->at_eof;
+            if (!reader->at_eof && p[avail - 1] == '\r') {
+                (*len)--;  /* May be the start of "\r\n"; keep it for later */
+            }
+            reader->buffer_pos += *len;
+        } else {
+            if (fill_buffer(reader) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        
+        if (*line_end) {
+            while (*len > 0 && (*data)[*len - 1] == '\r') {
+                (*len)--;
+            }
+        }
+        return 1;
+    }
+}
+
+FastaReader* fasta_reader_open(const char *filename, int threads) {
+    if (filename == NULL) {
+        return NULL;
+    }
+    
+    InputStream *input = input_stream_open_threaded(filename, threads);
+    if (input == NULL) {
+        return NULL;
+    }
+    
+    FastaReader *reader = safe_malloc(sizeof(FastaReader));
+    memset(reader, 0, sizeof(FastaReader));
+    reader->input = input;
+    reader->filename = safe_strdup(filename);
+    reader->buffer_size = READ_BUFFER_SIZE;
+    reader->buffer = safe_malloc(reader->buffer_size);
+    reader->line_start = 1;
+    reader->header_capacity = 256;
+    reader->header = safe_malloc(reader->header_capacity);
+    reader->header[0] = '\0';
+    
+    return reader;
+}
+
+int fasta_reader_next_record(FastaReader *reader) {
+    char *data;
+    size_t len;
+    int line_end;
+    int result;
+    
+    /* Skip to the next line starting with '>' */
+    for (;;) {
+        if (reader->line_start) {
+            result = peek_byte(reader);
+            if (result <= 0) {
+                reader->in_sequence = 0;
+                return result;
+            }
+            if (reader->buffer[reader->buffer_pos] == '>') {
+                break;
+            }
+        }
+        result = next_piece(reader, &data, &len, &line_end);
+        if (result <= 0) {
+            reader->in_sequence = 0;
+            return result;
+        }
+        reader->line_start = line_end;
+    }
+    
+    /* Collect the header, which may span several pieces */
+    reader->buffer_pos++;
+    reader->header_len = 0;
+    do {
+        result = next_piece(reader, &data, &len, &line_end);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        if (reader->header_len + len + 1 > reader->header_capacity) {
+            reader->header_capacity = (reader->header_len + len + 1) * 2;
+            reader->header = safe_realloc(reader->header, reader->header_capacity);
+        }
+        memcpy(reader->header + reader->header_len, data, len);
+        reader->header_len += len;
+    } while (!line_end);
+    reader->header[reader->header_len] = '\0';
+    
+    reader->line_start = 1;
+    reader->in_sequence = 1;
+    return 1;
+}
+
+int fasta_reader_next_chunk(FastaReader *reader, FastaChunk *chunk) {
+    while (reader->in_sequence) {
+        int at_line_start = reader->line_start;
+        if (at_line_start) {
+            /* A '>' at the start of a line begins the next record */
+            int result = peek_byte(reader);
+            if (result < 0) {
+                return -1;
+            }
+            if (result == 0 || reader->buffer[reader->buffer_pos] == '>') {
+                break;
+            }
+        }
+        
+        int result = next_piece(reader, &chunk->data, &chunk->len, &chunk->line_end);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        reader->line_start = chunk->line_end;
+        
+        /* Blank lines are dropped; the empty end of a long line is not */
+        if (chunk->len == 0 && (at_line_start || !chunk->line_end)) {
+            continue;
+        }
+        return 1;
+    }
+    
+    reader->in_sequence = 0;
+    return 0;
+}
+
+void fasta_reader_close(FastaReader *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    
+    input_stream_close(reader->input);
+    free(reader->filename);
+    free(reader->buffer);
+    free(reader->header);
+    free(reader);
+}
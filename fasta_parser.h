@@ -0,0 +1,54 @@
+#ifndef FASTA_PARSER_H
+#define FASTA_PARSER_H
+
+#include <stdlib.h>
+#include "input_stream.h"
+
+/* Streaming FASTA reader.
+ *
+ * A record is its header followed by its sequence as a series of chunks.
+ * A chunk is one sequence line, or a piece of a line that does not fit in
+ * the read buffer, so memory use does not depend on the record length and
+ * the original line wrapping can be written back. Chunks are views into
+ * the reader's buffer that may be edited in place; they stay valid until
+ * the next call on the reader. Blank lines, '\r' line ends and anything
+ * before the first header are dropped.
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    int line_end;           /* The chunk ends its line */
+} FastaChunk;
+
+typedef struct {
+    InputStream *input;
+    char *filename;
+    char *buffer;
+    size_t buffer_size;
+    size_t buffer_pos;      /* Start of unread data */
+    size_t buffer_end;      /* End of valid data */
+    int at_eof;
+    int line_start;         /* buffer_pos is at the start of a line */
+    int in_sequence;        /* Chunks of the current record remain */
+    char *header;           /* Header of the current record, without '>' */
+    size_t header_len;
+    size_t header_capacity;
+} FastaReader;
+
+/* Open a FASTA file, decompressing BGZF input on the given number of
+ * threads; returns NULL (after printing an error) on failure */
+FastaReader* fasta_reader_open(const char *filename, int threads);
+
+/* Move to the next record, skipping what is left of the current one.
+ * Returns 1 with the header in reader->header, 0 at end of input, -1 on
+ * error. */
+int fasta_reader_next_record(FastaReader *reader);
+
+/* Next sequence chunk of the current record; returns 1, 0 at the end of
+ * the record, -1 on error */
+int fasta_reader_next_chunk(FastaReader *reader, FastaChunk *chunk);
+
+/* Close the reader */
+void fasta_reader_close(FastaReader *reader);
+
+#endif /* FASTA_PARSER_H */
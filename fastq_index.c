@@ -0,0 +1,303 @@
+#define _POSIX_C_SOURCE 200809L
+#include "fastq_index.h"
+#include "bgzf.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define INDEX_READ_SIZE (1024 * 1024)
+
+static const char INDEX_MAGIC[4] = { 'F', 'Q', 'I', 2 };
+
+#define FLAG_BGZF 1
+#define FLAG_MISSING_NEWLINE 2
+#define FLAG_CRLF 4
+
+char* fastq_index_path(const char *filename) {
+    size_t len = strlen(filename);
+    char *path = safe_malloc(len + 5);
+    memcpy(path, filename, len);
+    memcpy(path + len, ".fqi", 5);
+    return path;
+}
+
+/* Index under construction: line count and checkpoints found so far */
+typedef struct {
+    FastqIndex *index;
+    size_t lines;
+    size_t capacity;
+    int pending;              /* BGZF: a checkpoint starts at the next block */
+    char last;                /* Last byte scanned so far */
+    size_t line_len;          /* Bytes of the current line scanned so far */
+} IndexBuilder;
+
+static void add_checkpoint(IndexBuilder *builder, uint64_t offset) {
+    FastqIndex *index = builder->index;
+    if (index->num_offsets == builder->capacity) {
+        builder->capacity = builder->capacity ? builder->capacity * 2 : 1024;
+        index->offsets = safe_realloc(index->offsets, sizeof(uint64_t) * builder->capacity);
+    }
+    index->offsets[index->num_offsets++] = offset;
+}
+
+/* Count the lines of data, skipping blank lines between records as
+ * fastq_reader_next() does; base is the offset of data[0] for plain
+ * input, or the virtual offset of the block for BGZF input */
+static void scan_data(IndexBuilder *builder, const char *data, size_t len, uint64_t base) {
+    const size_t interval = builder->index->interval;
+    const char *p = data;
+    const char *line = data;
+    const char *end = data + len;
+    
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        size_t line_len = builder->line_len + (size_t)(p - line);
+        char before = (p > data) ? p[-1] : builder->last;
+        builder->line_len = 0;
+        line = ++p;
+        if (builder->lines % 4 == 0 && (line_len == 0 || (line_len == 1 && before == '\r'))) {
+            continue;
+        }
+        if (builder->lines == 0) {
+            builder->index->crlf = (before == '\r');
+        }
+        if (++builder->lines % 4 != 0 || (builder->lines / 4) % interval != 0) {
+            continue;
+        }
+        if (p == end && builder->index->is_bgzf) {
+            /* Virtual offsets point at the start of the next block instead */
+            builder->pending = 1;
+        } else {
+            add_checkpoint(builder, base + (uint64_t)(p - data));
+        }
+    }
+    builder->line_len += (size_t)(end - line);
+    if (len > 0) {
+        builder->last = data[len - 1];
+    }
+}
+
+static int scan_plain(IndexBuilder *builder, int fd, const char *filename) {
+    char *buffer = safe_malloc(INDEX_READ_SIZE);
+    uint64_t offset = 0;
+    ssize_t n;
+    
+    while ((n = read(fd, buffer, INDEX_READ_SIZE)) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "Error: Failed to read '%s': %s\n", filename, strerror(errno));
+            free(buffer);
+            return ERR_FILE_READ;
+        }
+        scan_data(builder, buffer, (size_t)n, offset);
+        offset += (uint64_t)n;
+    }
+    
+    free(buffer);
+    return SUCCESS;
+}
+
+static int scan_bgzf(IndexBuilder *builder, int fd, const char *filename) {
+    unsigned char *block = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+    unsigned char *data = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+    BgzfInflater inflater;
+    int status = SUCCESS;
+    off_t offset = 0;
+    ssize_t block_len;
+    
+    if (!bgzf_inflater_init(&inflater)) {
+        fprintf(stderr, "Error: Cannot initialize decompression for '%s'\n", filename);
+        free(block);
+        free(data);
+        return ERR_MEMORY_ALLOC;
+    }
+    
+    while ((block_len = bgzf_read_block(fd, offset, block)) != 0) {
+        size_t len = 0;
+        if (block_len < 0 && errno != 0) {
+            fprintf(stderr, "Error: Failed to read '%s': %s\n", filename, strerror(errno));
+            status = ERR_FILE_READ;
+            break;
+        }
+        if (block_len < 0) {
+            fprintf(stderr, "Error: '%s' is gzip-compressed but not BGZF, so it cannot be "
+                    "indexed; recompress it with bgzip first\n", filename);
+            status = ERR_INVALID_FORMAT;
+            break;
+        }
+        if (!bgzf_inflate_block(&inflater, block, (size_t)block_len,
+                                data, BGZF_MAX_BLOCK_SIZE, &len)) {
+            fprintf(stderr, "Error: Corrupt compressed data in '%s'\n", filename);
+            status = ERR_INVALID_FORMAT;
+            break;
+        }
+        
+        if (len > 0) {
+            uint64_t base = (uint64_t)offset << 16;
+            if (builder->pending) {
+                add_checkpoint(builder, base);
+                builder->pending = 0;
+            }
+            scan_data(builder, (const char *)data, len, base);
+        }
+        offset += block_len;
+    }
+    
+    bgzf_inflater_free(&inflater);
+    free(block);
+    free(data);
+    return status;
+}
+
+FastqIndex* fastq_index_build(const char *filename, size_t interval) {
+    if (filename == NULL || interval == 0) {
+        return NULL;
+    }
+    
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open input file '%s': %s\n", filename, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    
+    unsigned char magic[2] = { 0, 0 };
+    if (pread(fd, magic, 2, 0) < 0) {
+        magic[0] = 0;
+    }
+    
+    FastqIndex *index = safe_malloc(sizeof(FastqIndex));
+    memset(index, 0, sizeof(FastqIndex));
+    index->interval = interval;
+    index->is_bgzf = (magic[0] == 0x1f && magic[1] == 0x8b);
+    index->file_size = (uint64_t)st.st_size;
+    index->file_mtime = (int64_t)st.st_mtime;
+    
+    IndexBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.index = index;
+    builder.last = '\n';
+    add_checkpoint(&builder, 0);
+    
+    int status = index->is_bgzf ? scan_bgzf(&builder, fd, filename)
+                                : scan_plain(&builder, fd, filename);
+    close(fd);
+    if (status != SUCCESS) {
+        fastq_index_free(index);
+        return NULL;
+    }
+    
+    /* An unterminated last line still counts, as in fastq_reader_next() */
+    if (builder.last != '\n') {
+        builder.lines++;
+        index->missing_newline = 1;
+    }
+    if (builder.lines % 4 != 0) {
+        fprintf(stderr, "Error: '%s' ends with an incomplete FASTQ record (%zu lines)\n",
+                filename, builder.lines);
+        fastq_index_free(index);
+        return NULL;
+    }
+    
+    /* Drop the checkpoint after the last record */
+    index->num_records = builder.lines / 4;
+    index->num_offsets = (index->num_records + interval - 1) / interval;
+    return index;
+}
+
+int fastq_index_save(const FastqIndex *index, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return ERR_FILE_WRITE;
+    }
+    
+    uint32_t flags = (index->is_bgzf ? FLAG_BGZF : 0) |
+                     (index->missing_newline ? FLAG_MISSING_NEWLINE : 0) |
+                     (index->crlf ? FLAG_CRLF : 0);
+    uint64_t header[5] = {
+        index->interval, index->num_records, index->file_size,
+        (uint64_t)index->file_mtime, index->num_offsets
+    };
+    
+    fwrite(INDEX_MAGIC, 1, sizeof(INDEX_MAGIC), fp);
+    fwrite(&flags, sizeof(flags), 1, fp);
+    fwrite(header, sizeof(uint64_t), 5, fp);
+    fwrite(index->offsets, sizeof(uint64_t), index->num_offsets, fp);
+    
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        remove(path);
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
+
+FastqIndex* fastq_index_load(const char *path, const char *filename) {
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return NULL;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    
+    char magic[4];
+    uint32_t flags;
+    uint64_t header[5];
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+        memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 ||
+        fread(&flags, sizeof(flags), 1, fp) != 1 ||
+        fread(header, sizeof(uint64_t), 5, fp) != 5) {
+        fclose(fp);
+        return NULL;
+    }
+    
+    /* Built for another version of the file, or damaged */
+    if (header[2] != (uint64_t)st.st_size || (int64_t)header[3] != (int64_t)st.st_mtime ||
+        header[0] == 0 || header[4] != (header[1] + header[0] - 1) / header[0]) {
+        fclose(fp);
+        return NULL;
+    }
+    
+    FastqIndex *index = safe_malloc(sizeof(FastqIndex));
+    memset(index, 0, sizeof(FastqIndex));
+    index->interval = (size_t)header[0];
+    index->num_records = (size_t)header[1];
+    index->is_bgzf = (flags & FLAG_BGZF) != 0;
+    index->missing_newline = (flags & FLAG_MISSING_NEWLINE) != 0;
+    index->crlf = (flags & FLAG_CRLF) != 0;
+    index->file_size = header[2];
+    index->file_mtime = (int64_t)header[3];
+    index->num_offsets = (size_t)header[4];
+    index->offsets = safe_malloc(sizeof(uint64_t) * (index->num_offsets + 1));
+    
+    if (fread(index->offsets, sizeof(uint64_t), index->num_offsets, fp) != index->num_offsets) {
+        fastq_index_free(index);
+        index = NULL;
+    }
+    fclose(fp);
+    return index;
+}
+
+size_t fastq_index_locate(const FastqIndex *index, size_t record, uint64_t *offset) {
+    size_t checkpoint = record / index->interval;
+    *offset = index->offsets[checkpoint];
+    return checkpoint * index->interval;
+}
+
+void fastq_index_free(FastqIndex *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->offsets);
+    free(index);
+}
@@ -0,0 +1,55 @@
+#ifndef FASTQ_INDEX_H
+#define FASTQ_INDEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Random-access index of a FASTQ file, saved next to it as "<file>.fqi".
+ *
+ * Every interval-th record (0, K, 2K, ...) has a checkpoint holding where
+ * it starts: the byte offset for plain input, or for BGZF input the
+ * virtual offset as in htslib (file offset of the block << 16 | offset in
+ * its decompressed data). Records are four lines, as for
+ * fastq_count_records(), and blank lines between them are skipped. Plain
+ * gzip input cannot be indexed. Whether the lines end in "\r\n" is taken
+ * from the first one.
+ *
+ * The index also keeps the size and modification time of the FASTQ, so
+ * an index left over from an older version of the file is not used.
+ */
+typedef struct {
+    size_t interval;          /* Records between checkpoints */
+    size_t num_records;       /* Complete records in the file */
+    int is_bgzf;              /* Offsets are virtual offsets */
+    int missing_newline;      /* Last line has no '\n' */
+    int crlf;                 /* Lines end in "\r\n" */
+    uint64_t *offsets;        /* Checkpoint i is record i * interval */
+    size_t num_offsets;
+    uint64_t file_size;
+    int64_t file_mtime;
+} FastqIndex;
+
+#define FASTQ_INDEX_INTERVAL 1024   /* Default records between checkpoints */
+
+/* Index file name for a FASTQ file (caller frees) */
+char* fastq_index_path(const char *filename);
+
+/* Scan a plain or BGZF FASTQ file; returns NULL (after printing an error)
+ * on failure */
+FastqIndex* fastq_index_build(const char *filename, size_t interval);
+
+/* Save to path; returns SUCCESS or ERR_FILE_WRITE (errno is set) */
+int fastq_index_save(const FastqIndex *index, const char *path);
+
+/* Load the index at path saved for filename; returns NULL if it is
+ * missing, unreadable or out of date */
+FastqIndex* fastq_index_load(const char *path, const char *filename);
+
+/* Nearest checkpoint at or before record (0-based, < num_records): stores
+ * its offset and returns its record number */
+size_t fastq_index_locate(const FastqIndex *index, size_t record, uint64_t *offset);
+
+/* Free the index */
+void fastq_index_free(FastqIndex *index);
+
+#endif /* FASTQ_INDEX_H */
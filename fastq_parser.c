@@ -1,91 +1,77 @@
 #define _POSIX_C_SOURCE 200809L
 #include "fastq_parser.h"
 #include "utils.h"
+#include "simd_scan.h"
 #include <string.h>
 #include <errno.h>
 
-#define INITIAL_BUFFER_SIZE 256
+#define READ_BUFFER_SIZE (1 << 20)
 
-/* Helper function to read a line with dynamic buffer */
-static char* read_line_dynamic(FILE *fp, size_t *line_len) {
-    size_t buffer_size = INITIAL_BUFFER_SIZE;
-    char *buffer = safe_malloc(buffer_size);
-    size_t pos = 0;
-    int c;
+/* Move unparsed bytes to the front of the buffer and read more input.
+ * The buffer doubles when a single record does not fit.
+ * Returns bytes read, 0 at end of input, -1 on read error. */
+static ssize_t fill_buffer(FastqReader *reader) {
+    size_t pending = reader->buffer_end - reader->buffer_pos;
     
-    while ((c = fgetc(fp)) != EOF) {
-        if (pos >= buffer_size - 1) {
-            buffer_size *= 2;
-            buffer = safe_realloc(buffer, buffer_size);
-        }
-        
-        buffer[pos++] = (char)c;
-        
-        if (c == '\n') {
-            break;
-        }
+    if (reader->buffer_pos > 0) {
+        memmove(reader->buffer, reader->buffer + reader->buffer_pos, pending);
+        reader->buffer_pos = 0;
+        reader->buffer_end = pending;
     }
     
-    if (pos == 0 && c == EOF) {
-        free(buffer);
-        return NULL;
+    /* Keep one spare byte so an unterminated last line can get a '\n' */
+    if (reader->buffer_end + 1 >= reader->buffer_size) {
+        reader->buffer_size *= 2;
+        reader->buffer = safe_realloc(reader->buffer, reader->buffer_size);
     }
     
-    buffer[pos] = '\0';
-    trim_newline(buffer);
+    ssize_t n = input_stream_read(reader->input, reader->buffer + reader->buffer_end,
+                                  reader->buffer_size - reader->buffer_end - 1);
     
-    if (line_len != NULL) {
-        *line_len = pos;
+    if (n > 0) {
+        reader->buffer_end += (size_t)n;
+    } else if (n == 0) {
+        reader->at_eof = 1;
     }
-    
-    return buffer;
+    return n;
 }
 
-/* Helper function to check if file is gzipped */
-static int is_gzipped(const char *filename) {
-    size_t len = strlen(filename);
-    return (len > 3 && strcmp(filename + len - 3, ".gz") == 0);
+/* Terminate a line view in place, stripping '\r' before the '\n' */
+static size_t terminate_line(char *line, size_t len) {
+    while (len > 0 && line[len - 1] == '\r') {
+        len--;
+    }
+    line[len] = '\0';
+    return len;
 }
 
 FastqReader* fastq_reader_open(const char *filename) {
+    return fastq_reader_open_threaded(filename, 1);
+}
+
+FastqReader* fastq_reader_open_threaded(const char *filename, int threads) {
     if (filename == NULL) {
         return NULL;
     }
     
-    FILE *fp = NULL;
-    int is_pipe = 0;
-    
-    /* Check if file is gzipped */
-    if (is_gzipped(filename)) {
-        /* Use gzip to decompress on the fly */
-        char command[2048];
-        snprintf(command, sizeof(command), "gzip -dc '%s'", filename);
-        fp = popen(command, "r");
-        is_pipe = 1;
-        
-        if (fp == NULL) {
-            fprintf(stderr, "Error: Cannot open gzipped file '%s': %s\n", 
-                    filename, strerror(errno));
-            return NULL;
-        }
-    } else {
-        /* Regular file */
-        fp = fopen(filename, "r");
-        is_pipe = 0;
-        
-        if (fp == NULL) {
-            fprintf(stderr, "Error: Cannot open file '%s': %s\n", 
-                    filename, strerror(errno));
-            return NULL;
-        }
+    /* Plain and gzipped files are both handled by the input stream */
+    InputStream *input = input_stream_open_threaded(filename, threads);
+    if (input == NULL) {
+        return NULL;
     }
     
     FastqReader *reader = safe_malloc(sizeof(FastqReader));
-    reader->fp = fp;
+    reader->input = input;
     reader->filename = safe_strdup(filename);
     reader->line_number = 0;
     reader->is_valid = 1;
-    reader->is_pipe = is_pipe;
+    reader->buffer_size = READ_BUFFER_SIZE;
+    reader->buffer = safe_malloc(reader->buffer_size);
+    reader->buffer_pos = 0;
+    reader->buffer_end = 0;
+    reader->at_eof = 0;
+    reader->unterminated = 0;
+    reader->crlf = 0;
     
     return reader;
 }
@@ -96,80 +82,189 @@ int fastq_reader_next(FastqReader *reader, FastqRecord *record) {
     }
     
     /* Initialize record fields */
-    record->seq_id = NULL;
-    record->sequence = NULL;
-    record->plus_line = NULL;
-    record->quality = NULL;
-    
-    /* Read line 1: sequence ID (starts with @) */
-    record->seq_id = read_line_dynamic(reader->fp, NULL);
-    if (record->seq_id == NULL) {
-        return 0; /* End of file */
+    memset(record, 0, sizeof(*record));
+    
+    /* Locate the four line ends of the record inside the buffer */
+    size_t line_end[4];
+    int lines_found;
+    
+    for (;;) {
+        const char *data = reader->buffer + reader->buffer_pos;
+        size_t avail = reader->buffer_end - reader->buffer_pos;
+        
+        lines_found = simd_scan_lines(data, avail, line_end, 4);
+        
+        /* Blank lines between records are skipped */
+        if (lines_found > 0 && (line_end[0] == 0 || (line_end[0] == 1 && data[0] == '\r'))) {
+            reader->buffer_pos += line_end[0] + 1;
+            reader->line_number++;
+            continue;
+        }
+        
+        if (lines_found == 4) {
+            break;
+        }
+        
+        if (reader->at_eof) {
+            size_t offset = (lines_found > 0) ? line_end[lines_found - 1] + 1 : 0;
+            if (offset == avail) {
+                break;
+            }
+            /* Last line has no terminator: supply one in the spare byte */
+            reader->buffer[reader->buffer_end++] = '\n';
+            reader->unterminated = 1;
+            continue;
+        }
+        
+        if (fill_buffer(reader) < 0) {
+            /* The input stream has already reported the error */
+            reader->is_valid = 0;
+            return -1;
+        }
     }
-    reader->line_number++;
     
-    /* Remove @ prefix if present */
-    if (record->seq_id[0] == '@') {
-        char *temp = safe_strdup(record->seq_id + 1);
-        free(record->seq_id);
-        record->seq_id = temp;
+    if (lines_found == 0) {
+        return 0; /* End of file */
     }
     
-    /* Read line 2: sequence */
-    record->sequence = read_line_dynamic(reader->fp, NULL);
-    if (record->sequence == NULL) {
-        fastq_record_free(record);
+    reader->line_number += (size_t)lines_found;
+    
+    if (lines_found < 4) {
         fprintf(stderr, "Error: Incomplete FASTQ record at line %zu in '%s'\n", 
                 reader->line_number, reader->filename);
         reader->is_valid = 0;
         return -1;
     }
-    reader->line_number++;
     
-    /* Read line 3: plus line (separator) */
-    record->plus_line = read_line_dynamic(reader->fp, NULL);
-    if (record->plus_line == NULL) {
-        fastq_record_free(record);
-        fprintf(stderr, "Error: Incomplete FASTQ record at line %zu in '%s'\n", 
-                reader->line_number, reader->filename);
-        reader->is_valid = 0;
-        return -1;
+    char *start = reader->buffer + reader->buffer_pos;
+    
+    /* Line 1: sequence ID, with @ prefix removed if present */
+    record->seq_id = start;
+    record->seq_id_len = terminate_line(start, line_end[0]);
+    if (record->seq_id[0] == '@') {
+        record->seq_id++;
+        record->seq_id_len--;
     }
-    reader->line_number++;
     
-    /* Read line 4: quality scores */
-    record->quality = read_line_dynamic(reader->fp, NULL);
-    if (record->quality == NULL) {
-        fastq_record_free(record);
-        fprintf(stderr, "Error: Incomplete FASTQ record at line %zu in '%s'\n", 
-                reader->line_number, reader->filename);
-        reader->is_valid = 0;
-        return -1;
+    /* Line 2: sequence */
+    record->sequence = start + line_end[0] + 1;
+    record->sequence_len = terminate_line(record->sequence, line_end[1] - line_end[0] - 1);
+    
+    /* Line 3: plus line (separator) */
+    record->plus_line = start + line_end[1] + 1;
+    record->plus_line_len = terminate_line(record->plus_line, line_end[2] - line_end[1] - 1);
+    
+    /* Line 4: quality scores */
+    record->quality = start + line_end[2] + 1;
+    record->quality_len = terminate_line(record->quality, line_end[3] - line_end[2] - 1);
+    if (record->quality_len < line_end[3] - line_end[2] - 1) {
+        reader->crlf = 1;
     }
-    reader->line_number++;
+    
+    reader->buffer_pos += line_end[3] + 1;
     
     return 1; /* Successfully read a record */
 }
 
-int fastq_record_validate(const FastqRecord *record, char *error_msg, size_t error_msg_size) {
-    if (record == NULL) {
-        if (error_msg != NULL && error_msg_size > 0) {
-            snprintf(error_msg, error_msg_size, "Record is NULL");
-        }
-        return 0;
+/* Append len bytes to a growable batch buffer; returns their offset */
+static size_t batch_append(char **buffer, size_t *len, size_t *size, const char *data, size_t n) {
+    if (*len + n > *size) {
+        *size = (*len + n) * 2;
+        *buffer = safe_realloc(*buffer, *size);
+    }
+    memcpy(*buffer + *len, data, n);
+    size_t offset = *len;
+    *len += n;
+    return offset;
+}
+
+void fastq_batch_init(FastqBatch *batch) {
+    memset(batch, 0, sizeof(FastqBatch));
+    /* One huge-page block holds the IDs and separator lines of a batch */
+    arena_init(&batch->text, ARENA_HUGE_BLOCK);
+}
+
+int fastq_reader_next_batch(FastqReader *reader, FastqBatch *batch, size_t max_records) {
+    if (reader == NULL || batch == NULL || max_records == 0) {
+        return -1;
     }
     
-    /* Check that all fields are present */
-    if (record->seq_id == NULL || record->sequence == NULL || 
-        record->plus_line == NULL || record->quality == NULL) {
-        if (error_msg != NULL && error_msg_size > 0) {
-            snprintf(error_msg, error_msg_size, "Record has NULL fields");
+    batch->count = 0;
+    batch->sequences_len = 0;
+    batch->qualities_len = 0;
+    arena_reset(&batch->text);
+    
+    /* A reader stops being valid only on an error */
+    if (!reader->is_valid) {
+        return -1;
+    }
+    
+    if (batch->capacity < max_records) {
+        batch->capacity = max_records;
+        batch->seq_offsets = safe_realloc(batch->seq_offsets, sizeof(size_t) * max_records);
+        batch->seq_lens = safe_realloc(batch->seq_lens, sizeof(size_t) * max_records);
+        batch->qual_offsets = safe_realloc(batch->qual_offsets, sizeof(size_t) * max_records);
+        batch->qual_lens = safe_realloc(batch->qual_lens, sizeof(size_t) * max_records);
+        batch->ids = safe_realloc(batch->ids, sizeof(char *) * max_records);
+        batch->id_lens = safe_realloc(batch->id_lens, sizeof(size_t) * max_records);
+        batch->plus_lines = safe_realloc(batch->plus_lines, sizeof(char *) * max_records);
+        batch->plus_lens = safe_realloc(batch->plus_lens, sizeof(size_t) * max_records);
+        batch->lines = safe_realloc(batch->lines, sizeof(size_t) * max_records);
+    }
+    
+    FastqRecord record;
+    while (batch->count < max_records &&
+           batch->sequences_len + batch->qualities_len < FASTQ_BATCH_BYTES) {
+        int result = fastq_reader_next(reader, &record);
+        if (result < 0 && batch->count == 0) {
+            return -1;
         }
-        return 0;
+        if (result <= 0) {
+            break;
+        }
+        
+        /* Copy out of the reader buffer, which the next fill moves */
+        size_t i = batch->count++;
+        batch->lines[i] = reader->line_number;
+        batch->ids[i] = arena_strndup(&batch->text, record.seq_id, record.seq_id_len);
+        batch->id_lens[i] = record.seq_id_len;
+        batch->plus_lines[i] = arena_strndup(&batch->text, record.plus_line, record.plus_line_len);
+        batch->plus_lens[i] = record.plus_line_len;
+        batch->seq_offsets[i] = batch_append(&batch->sequences, &batch->sequences_len,
+                                             &batch->sequences_size, record.sequence,
+                                             record.sequence_len);
+        batch->seq_lens[i] = record.sequence_len;
+        batch->qual_offsets[i] = batch_append(&batch->qualities, &batch->qualities_len,
+                                              &batch->qualities_size, record.quality,
+                                              record.quality_len);
+        batch->qual_lens[i] = record.quality_len;
     }
     
+    return (int)batch->count;
+}
+
+void fastq_batch_record(FastqBatch *batch, size_t i, FastqRecord *record) {
+    record->seq_id = batch->ids[i];
+    record->seq_id_len = batch->id_lens[i];
+    record->sequence = batch->sequences + batch->seq_offsets[i];
+    record->sequence_len = batch->seq_lens[i];
+    record->plus_line = batch->plus_lines[i];
+    record->plus_line_len = batch->plus_lens[i];
+    record->quality = batch->qualities + batch->qual_offsets[i];
+    record->quality_len = batch->qual_lens[i];
+}
+
+size_t fastq_batch_line(const FastqBatch *batch, size_t i, int line) {
+    return batch->lines[i] - 4 + (size_t)line;
+}
+
+/* Separator and length checks of VALIDATE_FAST; *bad_line gets the
+ * line of the record at fault */
+static int check_structure(const char *plus_line, size_t seq_len, size_t qual_len,
+                           int *bad_line, char *error_msg, size_t error_msg_size) {
     /* Check that plus line starts with + */
-    if (record->plus_line[0] != '+') {
+    if (plus_line[0] != '+') {
+        *bad_line = 3;
         if (error_msg != NULL && error_msg_size > 0) {
             snprintf(error_msg, error_msg_size, "Separator line must start with '+'");
         }
@@ -177,10 +272,8 @@ int fastq_record_validate(const FastqRecord *record, char *error_msg, size_t err
     }
     
     /* Check that sequence and quality have the same length */
-    size_t seq_len = strlen(record->sequence);
-    size_t qual_len = strlen(record->quality);
-    
     if (seq_len != qual_len) {
+        *bad_line = 4;
         if (error_msg != NULL && error_msg_size > 0) {
             snprintf(error_msg, error_msg_size, 
                     "Sequence length (%zu) does not match quality length (%zu)", 
@@ -188,31 +281,169 @@ int fastq_record_validate(const FastqRecord *record, char *error_msg, size_t err
         }
         return 0;
     }
+    return 1;
+}
+
+/* Describe a byte rejected by the alphabet or quality check */
+static void report_byte(char *error_msg, size_t error_msg_size, const char *what,
+                        unsigned char c, size_t position) {
+    if (error_msg == NULL || error_msg_size == 0) {
+        return;
+    }
+    if (c >= '!' && c <= '~') {
+        snprintf(error_msg, error_msg_size, "Invalid %s character '%c' at position %zu",
+                 what, c, position);
+    } else {
+        snprintf(error_msg, error_msg_size, "Invalid %s byte 0x%02x at position %zu",
+                 what, c, position);
+    }
+}
+
+/* Record of a batch whose field (by offsets) holds byte offset; the
+ * latest record starting at or before it, as empty fields share offsets */
+static size_t record_at(const size_t *offsets, size_t count, size_t offset) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (offsets[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int fastq_batch_validate(FastqBatch *batch, ValidateLevel level, size_t *bad, int *bad_line,
+                         char *error_msg, size_t error_msg_size) {
+    if (level == VALIDATE_NONE) {
+        return 1;
+    }
     
-    return 1; /* Valid record */
+    /* First record failing the structure checks, or count */
+    size_t limit = batch->count;
+    for (size_t i = 0; i < batch->count; i++) {
+        if (!check_structure(batch->plus_lines[i], batch->seq_lens[i], batch->qual_lens[i],
+                             bad_line, error_msg, error_msg_size)) {
+            limit = i;
+            break;
+        }
+    }
+    
+    /* Strict: one pass over all sequences and one over all quality strings
+     * of the records before limit, which moves down to the first bad one */
+    if (level == VALIDATE_STRICT && limit > 0) {
+        size_t end = (limit < batch->count) ? batch->seq_offsets[limit] : batch->sequences_len;
+        size_t pos = simd_find_invalid_base(batch->sequences, end);
+        if (pos < end) {
+            limit = record_at(batch->seq_offsets, limit, pos);
+            *bad_line = 2;
+            report_byte(error_msg, error_msg_size, "base", (unsigned char)batch->sequences[pos],
+                        pos - batch->seq_offsets[limit]);
+        }
+        
+        end = (limit < batch->count) ? batch->qual_offsets[limit] : batch->qualities_len;
+        pos = simd_find_invalid_quality(batch->qualities, end);
+        if (pos < end) {
+            limit = record_at(batch->qual_offsets, limit, pos);
+            *bad_line = 4;
+            report_byte(error_msg, error_msg_size, "quality", (unsigned char)batch->qualities[pos],
+                        pos - batch->qual_offsets[limit]);
+        }
+    }
+    
+    if (limit < batch->count) {
+        *bad = limit;
+        return 0;
+    }
+    return 1;
 }
 
-void fastq_record_free(FastqRecord *record) {
-    if (record == NULL) {
+void fastq_batch_free(FastqBatch *batch) {
+    if (batch == NULL) {
         return;
     }
     
-    if (record->seq_id != NULL) {
-        free(record->seq_id);
-        record->seq_id = NULL;
+    free(batch->sequences);
+    free(batch->qualities);
+    free(batch->seq_offsets);
+    free(batch->seq_lens);
+    free(batch->qual_offsets);
+    free(batch->qual_lens);
+    free(batch->ids);
+    free(batch->id_lens);
+    free(batch->plus_lines);
+    free(batch->plus_lens);
+    free(batch->lines);
+    arena_free(&batch->text);
+    memset(batch, 0, sizeof(FastqBatch));
+}
+
+size_t fastq_reader_take_buffered(FastqReader *reader, const char **data) {
+    size_t len = reader->buffer_end - reader->buffer_pos;
+    *data = reader->buffer + reader->buffer_pos;
+    reader->buffer_pos = reader->buffer_end;
+    return len;
+}
+
+int fastq_record_validate(const FastqRecord *record, ValidateLevel level, int *bad_line,
+                          char *error_msg, size_t error_msg_size) {
+    int line;
+    if (bad_line == NULL) {
+        bad_line = &line;
+    }
+    *bad_line = 4;  /* Problems with the record as a whole */
+    if (level == VALIDATE_NONE) {
+        return 1;
+    }
+    if (record == NULL) {
+        if (error_msg != NULL && error_msg_size > 0) {
+            snprintf(error_msg, error_msg_size, "Record is NULL");
+        }
+        return 0;
+    }
+    
+    /* Check that all fields are present */
+    if (record->seq_id == NULL || record->sequence == NULL || 
+        record->plus_line == NULL || record->quality == NULL) {
+        if (error_msg != NULL && error_msg_size > 0) {
+            snprintf(error_msg, error_msg_size, "Record has NULL fields");
+        }
+        return 0;
     }
-    if (record->sequence != NULL) {
-        free(record->sequence);
-        record->sequence = NULL;
+    
+    if (!check_structure(record->plus_line, record->sequence_len, record->quality_len,
+                         bad_line, error_msg, error_msg_size)) {
+        return 0;
     }
-    if (record->plus_line != NULL) {
-        free(record->plus_line);
-        record->plus_line = NULL;
+    
+    if (level == VALIDATE_STRICT) {
+        size_t pos = simd_find_invalid_base(record->sequence, record->sequence_len);
+        if (pos < record->sequence_len) {
+            *bad_line = 2;
+            report_byte(error_msg, error_msg_size, "base", (unsigned char)record->sequence[pos], pos);
+            return 0;
+        }
+        pos = simd_find_invalid_quality(record->quality, record->quality_len);
+        if (pos < record->quality_len) {
+            *bad_line = 4;
+            report_byte(error_msg, error_msg_size, "quality", (unsigned char)record->quality[pos],
+                        pos);
+            return 0;
+        }
     }
-    if (record->quality != NULL) {
-        free(record->quality);
-        record->quality = NULL;
+    
+    return 1; /* Valid record */
+}
+
+void fastq_record_free(FastqRecord *record) {
+    if (record == NULL) {
+        return;
     }
+    
+    /* Fields point into the reader buffer; only drop the views */
+    memset(record, 0, sizeof(*record));
 }
 
 void fastq_reader_close(FastqReader *reader) {
@@ -220,18 +451,68 @@ void fastq_reader_close(FastqReader *reader) {
         return;
     }
     
-    if (reader->fp != NULL) {
-        if (reader->is_pipe) {
-            pclose(reader->fp);  /* Close pipe for gzipped files */
-        } else {
-            fclose(reader->fp);  /* Close regular file */
-        }
-        reader->fp = NULL;
+    if (reader->input != NULL) {
+        input_stream_close(reader->input);
+        reader->input = NULL;
     }
     if (reader->filename != NULL) {
         free(reader->filename);
         reader->filename = NULL;
     }
+    if (reader->buffer != NULL) {
+        free(reader->buffer);
+        reader->buffer = NULL;
+    }
     
     free(reader);
 }
+
+int fastq_count_records(const char *filename, size_t *count) {
+    if (filename == NULL || count == NULL) {
+        return ERR_INVALID_PARAM;
+    }
+    
+    InputStream *input = input_stream_open(filename);
+    if (input == NULL) {
+        return ERR_FILE_OPEN;
+    }
+    
+    char *buffer = safe_malloc(READ_BUFFER_SIZE);
+    size_t lines = 0;
+    size_t line_len = 0;      /* Bytes of the current line read so far */
+    char last = '\n';
+    ssize_t n;
+    
+    while ((n = input_stream_read(input, buffer, READ_BUFFER_SIZE)) > 0) {
+        const char *p = buffer;
+        const char *line = buffer;
+        const char *end = buffer + n;
+        while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+            line_len += (size_t)(p - line);
+            int blank = (line_len == 0 ||
+                         (line_len == 1 && (p > buffer ? p[-1] : last) == '\r'));
+            /* Blank lines between records do not count, as in fastq_reader_next() */
+            if (!blank || lines % 4 != 0) {
+                lines++;
+            }
+            line_len = 0;
+            line = ++p;
+        }
+        line_len += (size_t)(end - line);
+        last = buffer[n - 1];
+    }
+    
+    free(buffer);
+    input_stream_close(input);
+    
+    if (n < 0) {
+        return ERR_FILE_READ;
+    }
+    
+    /* An unterminated last line still counts, as in fastq_reader_next() */
+    if (last != '\n') {
+        lines++;
+    }
+    *count = lines / 4;
+    return (lines % 4 == 0) ? SUCCESS : ERR_INVALID_FORMAT;
+}
@@ -3,36 +3,138 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "input_stream.h"
+#include "utils.h"
 
-/* FASTQ record structure */
+/* FASTQ record structure
+ *
+ * Fields are views into the reader's buffer: each one is NUL-terminated in
+ * place (line terminator removed) and stays valid until the next call to
+ * fastq_reader_next() or fastq_reader_close() on the same reader.
+ */
 typedef struct {
-    char *seq_id;        /* Sequence ID (without @ symbol) */
-    char *sequence;      /* Base sequence */
-    char *plus_line;     /* Separator line (usually +) */
-    char *quality;       /* Quality scores */
+    char *seq_id;           /* Sequence ID (without @ symbol) */
+    size_t seq_id_len;      /* Length of seq_id */
+    char *sequence;         /* Base sequence */
+    size_t sequence_len;    /* Length of sequence */
+    char *plus_line;        /* Separator line (usually +) */
+    size_t plus_line_len;   /* Length of plus_line */
+    char *quality;          /* Quality scores */
+    size_t quality_len;     /* Length of quality */
 } FastqRecord;
 
+/* How thoroughly records are checked */
+typedef enum {
+    VALIDATE_NONE,            /* No checks */
+    VALIDATE_FAST,            /* Separator line starts with '+', lengths match */
+    VALIDATE_STRICT           /* Also IUPAC bases and Phred+33 quality characters */
+} ValidateLevel;
+
 /* FASTQ reader structure */
 typedef struct {
-    FILE *fp;
+    InputStream *input;  /* Plain or gzip byte source */
     char *filename;
     size_t line_number;
     int is_valid;
-    int is_pipe;  /* Flag to indicate if fp is from popen (for gzip) */
+    char *buffer;        /* Block buffer holding raw input */
+    size_t buffer_size;  /* Allocated size of buffer */
+    size_t buffer_pos;   /* Start of unparsed data */
+    size_t buffer_end;   /* End of valid data */
+    int at_eof;          /* Set once read() has returned 0 */
+    int unterminated;    /* The last line of the input had no '\n' */
+    int crlf;            /* A record read so far had "\r\n" line ends */
 } FastqReader;
 
+/* A batch of FASTQ records in structure-of-arrays layout.
+ *
+ * The sequences of all records are stored back to back in one buffer and
+ * the quality strings in another, so a batch can be processed with single
+ * passes over contiguous memory. Record i's sequence is seq_lens[i] bytes
+ * at sequences + seq_offsets[i] (not NUL-terminated), and likewise for its
+ * quality string. IDs (without '@') and separator lines are NUL-terminated
+ * strings in the text arena. A batch owns its memory and keeps it from one
+ * fill to the next.
+ */
+#define FASTQ_BATCH_RECORDS 4096
+#define FASTQ_BATCH_BYTES (256 * 1024)
+
+typedef struct {
+    size_t count;
+    size_t capacity;          /* Records the arrays have room for */
+    size_t *lines;            /* Input line number of each record's last line */
+    char *sequences;
+    size_t sequences_len;
+    size_t sequences_size;
+    char *qualities;
+    size_t qualities_len;
+    size_t qualities_size;
+    size_t *seq_offsets;
+    size_t *seq_lens;
+    size_t *qual_offsets;
+    size_t *qual_lens;
+    Arena text;               /* IDs and separator lines */
+    char **ids;
+    size_t *id_lens;
+    char **plus_lines;
+    size_t *plus_lens;
+} FastqBatch;
+
 /* Open FASTQ file for reading */
 FastqReader* fastq_reader_open(const char *filename);
 
+/* Open FASTQ file, decompressing BGZF input on the given number of threads */
+FastqReader* fastq_reader_open_threaded(const char *filename, int threads);
+
 /* Read next FASTQ record */
 int fastq_reader_next(FastqReader *reader, FastqRecord *record);
 
-/* Validate FASTQ record format */
-int fastq_record_validate(const FastqRecord *record, char *error_msg, size_t error_msg_size);
+/* Take the input that has been read ahead but not parsed yet: points *data
+ * at it and returns its length. The bytes count as consumed; the rest of
+ * the file can then be read from reader->input directly. Views from the
+ * last record stay valid. */
+size_t fastq_reader_take_buffered(FastqReader *reader, const char **data);
+
+/* Read up to max_records records into batch, replacing its contents. A
+ * batch also ends once it holds FASTQ_BATCH_BYTES of sequence and quality.
+ * Returns the number of records, 0 at end of input, -1 on error; records
+ * read before an error are returned first and the next call returns -1. */
+int fastq_reader_next_batch(FastqReader *reader, FastqBatch *batch, size_t max_records);
+
+/* Start an empty batch */
+void fastq_batch_init(FastqBatch *batch);
 
-/* Free FASTQ record memory */
+/* View record i of a batch as a FastqRecord; its sequence and quality are
+ * not NUL-terminated */
+void fastq_batch_record(FastqBatch *batch, size_t i, FastqRecord *record);
+
+/* Input line number of line (1-4) of record i */
+size_t fastq_batch_line(const FastqBatch *batch, size_t i, int line);
+
+/* Validate every record of a batch at the given level; returns 1, or 0
+ * with the index of the first invalid record in *bad, the line (1-4) of
+ * that record the problem is on in *bad_line and the reason in error_msg.
+ * Strict checks run over the contiguous sequence and quality buffers in
+ * one SIMD pass each. */
+int fastq_batch_validate(FastqBatch *batch, ValidateLevel level, size_t *bad, int *bad_line,
+                         char *error_msg, size_t error_msg_size);
+
+/* Release the memory of a batch */
+void fastq_batch_free(FastqBatch *batch);
+
+/* Validate FASTQ record format at the given level; on failure the line
+ * (1-4) of the record the problem is on goes to *bad_line unless NULL */
+int fastq_record_validate(const FastqRecord *record, ValidateLevel level, int *bad_line,
+                          char *error_msg, size_t error_msg_size);
+
+/* Release FASTQ record (clears the views, the reader owns the memory) */
 void fastq_record_free(FastqRecord *record);
 
+/* Count the records in a FASTQ file from its line count, without parsing
+ * (blank lines between records are skipped, as by fastq_reader_next()).
+ * Returns ERR_INVALID_FORMAT (with the complete records counted) if the
+ * file does not hold a whole number of records. */
+int fastq_count_records(const char *filename, size_t *count);
+
 /* Close FASTQ reader */
 void fastq_reader_close(FastqReader *reader);
 
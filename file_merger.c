@@ -1,91 +1,343 @@
 #define _POSIX_C_SOURCE 200809L
 #include "file_merger.h"
+#include "fastq_index.h"
+#include "spsc_queue.h"
+#include "bgzf.h"
 #include "utils.h"
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#define WRITE_BUFFER_SIZE 8192
+/* Parsed and validated records handed from the parser thread to the writer */
+typedef struct {
+    int file_index;           /* Input file the records came from */
+    int end_of_file;          /* Last batch of file_index */
+    int end_of_input;         /* Last batch the parser will send */
+    int status;               /* SUCCESS, or the error that stopped the parser */
+    char error[512];          /* Message for status, printed in output order */
+    FastqBatch records;
+} RecordBatch;
 
-/* Helper function to check if output file should be gzipped */
-static int is_gzipped_output(const char *filename) {
-    size_t len = strlen(filename);
-    return (len > 3 && strcmp(filename + len - 3, ".gz") == 0);
-}
+/* State shared by the parser thread and the writer (calling) thread */
+typedef struct {
+    const MergerConfig *config;
+    SpscQueue *filled;        /* Parser -> writer */
+    SpscQueue *free_batches;  /* Writer -> parser */
+    int cancel;               /* Set by the writer to stop the parser early */
+} MergePipeline;
 
-int write_fastq_record(FILE *out_fp, const char *new_id, const FastqRecord *record) {
-    if (out_fp == NULL || new_id == NULL || record == NULL) {
+int write_fastq_record(OutputStream *out, const char *new_id, size_t id_len,
+                       const FastqRecord *record) {
+    if (out == NULL || new_id == NULL || record == NULL) {
         return ERR_INVALID_PARAM;
     }
     
-    /* Write sequence ID line with @ prefix */
-    if (fprintf(out_fp, "@%s\n", new_id) < 0) {
-        fprintf(stderr, "Error: Failed to write sequence ID: %s\n", strerror(errno));
+    /* "@ID\nSEQUENCE\nPLUS\nQUALITY\n", copied into the output buffer in one call */
+    struct iovec parts[9] = {
+        { (void *)"@", 1 },
+        { (void *)new_id, id_len },
+        { (void *)"\n", 1 },
+        { record->sequence, record->sequence_len },
+        { (void *)"\n", 1 },
+        { record->plus_line, record->plus_line_len },
+        { (void *)"\n", 1 },
+        { record->quality, record->quality_len },
+        { (void *)"\n", 1 }
+    };
+    
+    if (output_stream_writev(out, parts, 9) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
         return ERR_FILE_WRITE;
     }
     
-    /* Write sequence line */
-    if (fprintf(out_fp, "%s\n", record->sequence) < 0) {
-        fprintf(stderr, "Error: Failed to write sequence: %s\n", strerror(errno));
-        return ERR_FILE_WRITE;
+    return SUCCESS;
+}
+
+/* Take an empty batch from the writer for the given file */
+static RecordBatch* pipeline_get_batch(MergePipeline *pipeline, int file_index) {
+    RecordBatch *batch = spsc_queue_pop(pipeline->free_batches);
+    batch->file_index = file_index;
+    batch->end_of_file = 0;
+    batch->end_of_input = 0;
+    batch->status = SUCCESS;
+    batch->error[0] = '\0';
+    batch->records.count = 0;
+    return batch;
+}
+
+/* Parser thread: read and validate every input file, in order, into batches */
+static void* parse_thread(void *arg) {
+    MergePipeline *pipeline = arg;
+    const MergerConfig *config = pipeline->config;
+    RecordBatch *batch = NULL;
+    
+    for (int i = 0; i < config->num_input_files; i++) {
+        const char *input_file = config->input_files[i];
+        
+        batch = pipeline_get_batch(pipeline, i);
+        if (__atomic_load_n(&pipeline->cancel, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        
+        FastqReader *reader = fastq_reader_open_threaded(input_file, config->threads);
+        if (reader == NULL) {
+            snprintf(batch->error, sizeof(batch->error),
+                     "Error: Failed to open input file '%s'\n", input_file);
+            batch->status = ERR_FILE_OPEN;
+            break;
+        }
+        
+        int read_result;
+        
+        /* Each filled batch is sent on; the file's last batch ends up empty */
+        while ((read_result = fastq_reader_next_batch(reader, &batch->records,
+                                                      FASTQ_BATCH_RECORDS)) > 0) {
+            char error_msg[256];
+            size_t bad;
+            int bad_line;
+            if (!fastq_batch_validate(&batch->records, config->validate, &bad, &bad_line,
+                                      error_msg, sizeof(error_msg))) {
+                snprintf(batch->error, sizeof(batch->error),
+                         "Error: Invalid FASTQ record in '%s' at line %zu: %s\n",
+                         input_file, fastq_batch_line(&batch->records, bad, bad_line), error_msg);
+                batch->records.count = bad;
+                batch->status = ERR_INVALID_FORMAT;
+                break;
+            }
+            
+            spsc_queue_push(pipeline->filled, batch);
+            batch = pipeline_get_batch(pipeline, i);
+            if (__atomic_load_n(&pipeline->cancel, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+        }
+        
+        if (read_result < 0 && batch->status == SUCCESS) {
+            snprintf(batch->error, sizeof(batch->error),
+                     "Error: Failed to read from '%s'\n", input_file);
+            batch->status = ERR_FILE_READ;
+        }
+        
+        fastq_reader_close(reader);
+        
+        if (batch->status != SUCCESS || __atomic_load_n(&pipeline->cancel, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        
+        batch->end_of_file = 1;
+        spsc_queue_push(pipeline->filled, batch);
+        batch = NULL;
     }
     
-    /* Write separator line */
-    if (fprintf(out_fp, "%s\n", record->plus_line) < 0) {
-        fprintf(stderr, "Error: Failed to write separator: %s\n", strerror(errno));
-        return ERR_FILE_WRITE;
+    if (batch == NULL) {
+        batch = pipeline_get_batch(pipeline, -1);
     }
+    batch->end_of_input = 1;
+    spsc_queue_push(pipeline->filled, batch);
     
-    /* Write quality line */
-    if (fprintf(out_fp, "%s\n", record->quality) < 0) {
-        fprintf(stderr, "Error: Failed to write quality: %s\n", strerror(errno));
-        return ERR_FILE_WRITE;
+    return NULL;
+}
+
+/* Stamp IDs on a batch and write it; returns SUCCESS or an error code */
+static int write_batch(const MergerConfig *config, OutputStream *out, RecordBatch *batch,
+                       MergerStats *stats, size_t *file_sequences) {
+    size_t id_size = id_generator_max_length(config->id_gen) + 1;
+    char *new_id = safe_malloc(id_size);
+    
+    for (size_t r = 0; r < batch->records.count; r++) {
+        size_t id_len = id_generator_next_into(config->id_gen, new_id, id_size);
+        if (id_len == 0) {
+            fprintf(stderr, "Error: Failed to generate sequence ID\n");
+            free(new_id);
+            return ERR_MEMORY_ALLOC;
+        }
+        
+        FastqRecord record;
+        fastq_batch_record(&batch->records, r, &record);
+        int status = write_fastq_record(out, new_id, id_len, &record);
+        if (status != SUCCESS) {
+            free(new_id);
+            return status;
+        }
+        
+        (*file_sequences)++;
+        stats->total_sequences++;
+        
+        if (config->verbose && *file_sequences % 10000 == 0) {
+            printf("  Processed %zu sequences...\n", *file_sequences);
+        }
     }
     
+    free(new_id);
     return SUCCESS;
 }
 
-int merge_fastq_files(const MergerConfig *config, MergerStats *stats) {
-    if (config == NULL || stats == NULL) {
-        return ERR_INVALID_PARAM;
+/* Merge with parsing and validation on a separate thread.
+ *
+ * The parser thread fills record batches and passes them through a bounded
+ * queue; this thread assigns IDs in input order and writes them, and the
+ * output stream compresses on its own workers. Returns -1 if the parser
+ * thread could not be started. */
+static int merge_pipelined(const MergerConfig *config, MergerStats *stats, OutputStream *out) {
+    int depth = (config->queue_depth > 0) ? config->queue_depth : DEFAULT_QUEUE_DEPTH;
+    
+    MergePipeline pipeline;
+    pipeline.config = config;
+    pipeline.filled = spsc_queue_create((size_t)depth);
+    pipeline.free_batches = spsc_queue_create((size_t)depth);
+    pipeline.cancel = 0;
+    
+    RecordBatch *batches = safe_malloc(sizeof(RecordBatch) * (size_t)depth);
+    for (int i = 0; i < depth; i++) {
+        memset(&batches[i], 0, sizeof(RecordBatch));
+        fastq_batch_init(&batches[i].records);
+        spsc_queue_push(pipeline.free_batches, &batches[i]);
     }
     
-    /* Initialize stats */
-    stats->total_sequences = 0;
-    stats->total_files = 0;
-    stats->success = 0;
+    int status = SUCCESS;
+    pthread_t parser;
+    if (pthread_create(&parser, NULL, parse_thread, &pipeline) != 0) {
+        status = -1;
+    } else {
+        int current_file = -1;
+        size_t file_sequences = 0;
+        
+        for (;;) {
+            RecordBatch *batch = spsc_queue_pop(pipeline.filled);
+            
+            /* After an error, keep recycling batches until the parser stops */
+            if (status == SUCCESS && batch->file_index >= 0) {
+                if (batch->file_index != current_file) {
+                    current_file = batch->file_index;
+                    file_sequences = 0;
+                    id_generator_set_file(config->id_gen, current_file);
+                    if (config->verbose) {
+                        printf("Processing file %d/%d: %s\n", current_file + 1,
+                               config->num_input_files, config->input_files[current_file]);
+                    }
+                }
+                
+                status = write_batch(config, out, batch, stats, &file_sequences);
+                if (status == SUCCESS && batch->status != SUCCESS) {
+                    fputs(batch->error, stderr);
+                    status = batch->status;
+                }
+                if (status != SUCCESS) {
+                    __atomic_store_n(&pipeline.cancel, 1, __ATOMIC_RELEASE);
+                } else if (batch->end_of_file) {
+                    if (config->verbose) {
+                        printf("  Completed: %zu sequences from '%s'\n",
+                               file_sequences, config->input_files[current_file]);
+                    }
+                    stats->total_files++;
+                }
+            }
+            
+            int done = batch->end_of_input;
+            spsc_queue_push(pipeline.free_batches, batch);
+            if (done) {
+                break;
+            }
+        }
+        
+        pthread_join(parser, NULL);
+    }
+    
+    for (int i = 0; i < depth; i++) {
+        fastq_batch_free(&batches[i].records);
+    }
+    free(batches);
+    spsc_queue_destroy(pipeline.filled);
+    spsc_queue_destroy(pipeline.free_batches);
+    
+    return status;
+}
+
+/* Read, validate and write every record of one input file, numbering them
+ * with gen; *file_sequences counts the records written */
+static int merge_file(const MergerConfig *config, int file_index, IdGenerator *gen,
+                      OutputStream *out, int reader_threads, int verbose,
+                      size_t *file_sequences) {
+    const char *input_file = config->input_files[file_index];
     
-    /* Open output file */
-    FILE *out_fp = NULL;
-    int is_output_pipe = 0;
+    /* Open input file (BGZF input is inflated on the worker threads) */
+    FastqReader *reader = fastq_reader_open_threaded(input_file, reader_threads);
+    if (reader == NULL) {
+        fprintf(stderr, "Error: Failed to open input file '%s'\n", input_file);
+        return ERR_FILE_OPEN;
+    }
+    
+    /* One ID buffer reused for every record */
+    id_generator_set_file(gen, file_index);
+    size_t id_size = id_generator_max_length(gen) + 1;
+    char *new_id = safe_malloc(id_size);
+    
+    /* Process the file a batch of records at a time */
+    FastqBatch batch;
+    fastq_batch_init(&batch);
+    int status = SUCCESS;
+    int read_result;
     
-    if (is_gzipped_output(config->output_file)) {
-        /* Use gzip to compress output */
-        char command[2048];
-        snprintf(command, sizeof(command), "gzip -c > '%s'", config->output_file);
-        out_fp = popen(command, "w");
-        is_output_pipe = 1;
+    while (status == SUCCESS &&
+           (read_result = fastq_reader_next_batch(reader, &batch, FASTQ_BATCH_RECORDS)) > 0) {
+        /* Validate the batch; records before an invalid one are still written */
+        char error_msg[256];
+        size_t count = batch.count;
+        int bad_line = 4;
+        if (!fastq_batch_validate(&batch, config->validate, &count, &bad_line,
+                                  error_msg, sizeof(error_msg))) {
+            status = ERR_INVALID_FORMAT;
+        }
         
-        if (out_fp == NULL) {
-            fprintf(stderr, "Error: Cannot open gzipped output file '%s': %s\n", 
-                    config->output_file, strerror(errno));
-            return ERR_FILE_OPEN;
+        for (size_t r = 0; r < count; r++) {
+            /* Generate new ID */
+            size_t id_len = id_generator_next_into(gen, new_id, id_size);
+            if (id_len == 0) {
+                fprintf(stderr, "Error: Failed to generate sequence ID\n");
+                status = ERR_MEMORY_ALLOC;
+                break;
+            }
+            
+            /* Write record with new ID */
+            FastqRecord record;
+            fastq_batch_record(&batch, r, &record);
+            int write_result = write_fastq_record(out, new_id, id_len, &record);
+            if (write_result != SUCCESS) {
+                status = write_result;
+                break;
+            }
+            
+            (*file_sequences)++;
+            
+            /* Print progress in verbose mode */
+            if (verbose && *file_sequences % 10000 == 0) {
+                printf("  Processed %zu sequences...\n", *file_sequences);
+            }
         }
-    } else {
-        /* Regular file */
-        out_fp = fopen(config->output_file, "w");
-        is_output_pipe = 0;
         
-        if (out_fp == NULL) {
-            fprintf(stderr, "Error: Cannot open output file '%s': %s\n", 
-                    config->output_file, strerror(errno));
-            return ERR_FILE_OPEN;
+        if (status == ERR_INVALID_FORMAT) {
+            fprintf(stderr, "Error: Invalid FASTQ record in '%s' at line %zu: %s\n",
+                    input_file, fastq_batch_line(&batch, count, bad_line), error_msg);
         }
     }
     
-    /* Set write buffer for better performance */
-    char *write_buffer = safe_malloc(WRITE_BUFFER_SIZE);
-    setvbuf(out_fp, write_buffer, _IOFBF, WRITE_BUFFER_SIZE);
+    /* Check for read errors */
+    if (status == SUCCESS && read_result < 0) {
+        fprintf(stderr, "Error: Failed to read from '%s'\n", input_file);
+        status = ERR_FILE_READ;
+    }
     
+    free(new_id);
+    fastq_batch_free(&batch);
+    fastq_reader_close(reader);
+    return status;
+}
+
+/* Merge on the calling thread, one record at a time */
+static int merge_sequential(const MergerConfig *config, MergerStats *stats, OutputStream *out) {
     /* Process each input file */
     for (int i = 0; i < config->num_input_files; i++) {
         const char *input_file = config->input_files[i];
@@ -95,118 +347,741 @@ int merge_fastq_files(const MergerConfig *config, MergerStats *stats) {
                    i + 1, config->num_input_files, input_file);
         }
         
-        /* Open input file */
-        FastqReader *reader = fastq_reader_open(input_file);
+        size_t file_sequences = 0;
+        int result = merge_file(config, i, config->id_gen, out, config->threads,
+                                config->verbose, &file_sequences);
+        stats->total_sequences += file_sequences;
+        if (result != SUCCESS) {
+            return result;
+        }
+        
+        if (config->verbose) {
+            printf("  Completed: %zu sequences from '%s'\n", file_sequences, input_file);
+        }
+        
+        stats->total_files++;
+    }
+    
+    return SUCCESS;
+}
+
+/* Concurrent merge (-j): one input file per work item */
+typedef struct {
+    char *part_file;          /* Where the file's records go (the output for file 0) */
+    size_t records;           /* Record count from the counting pass */
+    size_t first_id;          /* sequence_counter before the file's first record */
+    size_t written;           /* Records written */
+    int status;               /* Result of the counting pass, then of the merge */
+    int compressed;           /* part_file is BGZF */
+} FileJob;
+
+typedef struct {
+    const MergerConfig *config;
+    FileJob *jobs;
+    int counting;             /* Running the counting pass */
+    int next;                 /* Next file to claim */
+    int failed;               /* Lowest index of a failed file (num_input_files if none) */
+} FileJobQueue;
+
+static void file_job_failed(FileJobQueue *queue, int index) {
+    int current = __atomic_load_n(&queue->failed, __ATOMIC_ACQUIRE);
+    while (index < current &&
+           !__atomic_compare_exchange_n(&queue->failed, &current, index, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+/* Merge one file into its part with a generator starting at its ID offset */
+static void run_file_job(FileJobQueue *queue, int index) {
+    const MergerConfig *config = queue->config;
+    FileJob *job = &queue->jobs[index];
+    
+    OutputStream *out = output_stream_open(job->part_file, 1);
+    if (out == NULL) {
+        job->status = ERR_FILE_OPEN;
+        file_job_failed(queue, index);
+        return;
+    }
+    job->compressed = output_stream_is_compressed(out);
+    
+    IdGenerator *gen = id_generator_clone_at(config->id_gen, job->first_id);
+    
+    job->status = merge_file(config, index, gen, out, 1, 0, &job->written);
+    id_generator_free(gen);
+    
+    if (job->status == SUCCESS && job->written != job->records) {
+        fprintf(stderr, "Error: '%s' changed while it was being merged\n",
+                config->input_files[index]);
+        job->status = ERR_FILE_READ;
+    }
+    if (output_stream_close(out) != SUCCESS && job->status == SUCCESS) {
+        fprintf(stderr, "Error: Failed to finish output file '%s': %s\n",
+                job->part_file, strerror(errno));
+        job->status = ERR_FILE_WRITE;
+    }
+    if (job->status != SUCCESS) {
+        file_job_failed(queue, index);
+    }
+}
+
+/* Records in an input file: taken from its .fqi index when one is up to
+ * date, otherwise counted from the line count */
+static int count_file_records(const char *input_file, size_t *count) {
+    char *path = fastq_index_path(input_file);
+    FastqIndex *index = fastq_index_load(path, input_file);
+    free(path);
+    if (index == NULL) {
+        return fastq_count_records(input_file, count);
+    }
+    *count = index->num_records;
+    fastq_index_free(index);
+    return SUCCESS;
+}
+
+static void* file_job_worker(void *arg) {
+    FileJobQueue *queue = arg;
+    
+    for (;;) {
+        int index = __atomic_fetch_add(&queue->next, 1, __ATOMIC_ACQ_REL);
+        if (index >= queue->config->num_input_files) {
+            break;
+        }
+        
+        if (queue->counting) {
+            FileJob *job = &queue->jobs[index];
+            job->status = count_file_records(queue->config->input_files[index], &job->records);
+        } else if (index <= __atomic_load_n(&queue->failed, __ATOMIC_ACQUIRE)) {
+            /* Files after a failed one would never reach the output */
+            run_file_job(queue, index);
+        }
+    }
+    
+    return NULL;
+}
+
+/* Run one pass over all files on up to config->jobs threads */
+static void run_file_jobs(FileJobQueue *queue, int counting) {
+    int workers = queue->config->jobs;
+    if (workers > queue->config->num_input_files) {
+        workers = queue->config->num_input_files;
+    }
+    
+    queue->counting = counting;
+    queue->next = 0;
+    
+    pthread_t *threads = safe_malloc(sizeof(pthread_t) * (size_t)workers);
+    int started = 0;
+    while (started < workers &&
+           pthread_create(&threads[started], NULL, file_job_worker, queue) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        file_job_worker(queue);  /* No threads available: do the work here */
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+/* Append the parts of files 1..last to the output written by file 0 */
+static int join_parts(const MergerConfig *config, FileJob *jobs, int last) {
+    int out_fd = open(config->output_file, O_WRONLY);
+    if (out_fd < 0) {
+        fprintf(stderr, "Error: Cannot open output file '%s': %s\n",
+                config->output_file, strerror(errno));
+        return ERR_FILE_OPEN;
+    }
+    
+    off_t offset = lseek(out_fd, 0, SEEK_END);
+    int result = SUCCESS;
+    
+    for (int i = 1; i <= last && result == SUCCESS; i++) {
+        int in_fd = open(jobs[i].part_file, O_RDONLY);
+        struct stat st;
+        if (in_fd < 0 || fstat(in_fd, &st) != 0) {
+            fprintf(stderr, "Error: Cannot open temporary file '%s': %s\n",
+                    jobs[i].part_file, strerror(errno));
+            result = ERR_FILE_OPEN;
+        } else {
+            /* BGZF parts each end with an EOF block; keep only the last one */
+            if (jobs[i].compressed && offset >= BGZF_EOF_SIZE) {
+                offset -= BGZF_EOF_SIZE;
+            }
+            if (lseek(out_fd, offset, SEEK_SET) < 0 ||
+                copy_fd_range(in_fd, out_fd, (size_t)st.st_size) != SUCCESS) {
+                fprintf(stderr, "Error: Failed to append '%s' to output: %s\n",
+                        jobs[i].part_file, strerror(errno));
+                result = ERR_FILE_WRITE;
+            }
+            offset += st.st_size;
+        }
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+    }
+    
+    if (close(out_fd) != 0 && result == SUCCESS) {
+        fprintf(stderr, "Error: Failed to finish output file '%s': %s\n",
+                config->output_file, strerror(errno));
+        result = ERR_FILE_WRITE;
+    }
+    return result;
+}
+
+/* Merge several input files at once.
+ *
+ * A counting pass gives each file's record count, so every file knows the
+ * sequence_counter its IDs start from. Files are then merged concurrently
+ * into part files (file 0 straight into the output) and the parts are
+ * appended in input order, giving the same output as the serial run. */
+static int merge_concurrent(const MergerConfig *config, MergerStats *stats) {
+    int n = config->num_input_files;
+    
+    /* Parts go in a new directory next to the output, so no existing file
+     * is overwritten or removed */
+    size_t name_len = strlen(config->output_file);
+    char *part_dir = safe_malloc(name_len + 16);
+    snprintf(part_dir, name_len + 16, "%s.partsXXXXXX", config->output_file);
+    if (mkdtemp(part_dir) == NULL) {
+        fprintf(stderr, "Error: Cannot create the part directory for '%s': %s\n",
+                config->output_file, strerror(errno));
+        free(part_dir);
+        return ERR_FILE_OPEN;
+    }
+    
+    FileJob *jobs = safe_malloc(sizeof(FileJob) * (size_t)n);
+    memset(jobs, 0, sizeof(FileJob) * (size_t)n);
+    
+    FileJobQueue queue;
+    queue.config = config;
+    queue.jobs = jobs;
+    queue.failed = n;
+    
+    run_file_jobs(&queue, 1);
+    
+    /* IDs continue from file to file; a file that cannot be counted will
+     * fail when merged, so nothing after it is needed */
+    const char *part_suffix = (name_len > 3 && strcmp(config->output_file + name_len - 3, ".gz") == 0) ?
+        ".gz" : "";
+    size_t counter = config->id_gen->sequence_counter;
+    for (int i = 0; i < n; i++) {
+        jobs[i].first_id = counter;
+        counter += jobs[i].records;
+        if (jobs[i].status != SUCCESS && queue.failed == n) {
+            queue.failed = i;
+        }
+        jobs[i].status = SUCCESS;
+        
+        if (i == 0) {
+            jobs[i].part_file = safe_strdup(config->output_file);
+        } else {
+            /* Keep the .gz suffix so the part is compressed like the output */
+            size_t len = strlen(part_dir) + 32;
+            jobs[i].part_file = safe_malloc(len);
+            snprintf(jobs[i].part_file, len, "%s/part%d%s", part_dir, i, part_suffix);
+        }
+    }
+    
+    run_file_jobs(&queue, 0);
+    
+    /* The output ends at the first failed file, as in a serial run */
+    int last = (queue.failed < n) ? queue.failed : n - 1;
+    int result = (last > 0) ? join_parts(config, jobs, last) : SUCCESS;
+    
+    for (int i = 0; i <= last; i++) {
+        if (config->verbose) {
+            printf("Processing file %d/%d: %s\n", i + 1, n, config->input_files[i]);
+        }
+        stats->total_sequences += jobs[i].written;
+        if (config->verbose) {
+            /* Same progress lines as the serial run */
+            for (size_t done = 10000; done <= jobs[i].written; done += 10000) {
+                printf("  Processed %zu sequences...\n", done);
+            }
+        }
+        if (jobs[i].status != SUCCESS) {
+            if (result == SUCCESS) {
+                result = jobs[i].status;
+            }
+            break;
+        }
+        if (config->verbose) {
+            printf("  Completed: %zu sequences from '%s'\n",
+                   jobs[i].written, config->input_files[i]);
+        }
+        stats->total_files++;
+    }
+    
+    if (result == SUCCESS) {
+        id_generator_seek(config->id_gen, counter);
+    }
+    
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            unlink(jobs[i].part_file);
+        }
+        free(jobs[i].part_file);
+    }
+    free(jobs);
+    rmdir(part_dir);
+    free(part_dir);
+    
+    return result;
+}
+
+/* Merge all files, in order, through a single output stream */
+static int merge_in_order(const MergerConfig *config, MergerStats *stats) {
+    /* Open output file (.gz output is BGZF-compressed on worker threads) */
+    OutputStream *out = output_stream_open(config->output_file, config->threads);
+    if (out == NULL) {
+        return ERR_FILE_OPEN;
+    }
+    
+    /* With spare threads, parse on a separate thread from ID assignment and output */
+    int result = -1;
+    if (config->threads > 1) {
+        result = merge_pipelined(config, stats, out);
+    }
+    if (result < 0) {
+        result = merge_sequential(config, stats, out);
+    }
+    if (result != SUCCESS) {
+        output_stream_close(out);
+        return result;
+    }
+    
+    /* Close output file (flushes buffered and in-flight compressed blocks) */
+    if (output_stream_close(out) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to finish output file '%s': %s\n",
+                config->output_file, strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    
+    return SUCCESS;
+}
+
+/* Keep-IDs mode: inputs are appended as raw bytes, not re-parsed */
+typedef struct {
+    const MergerConfig *config;
+    size_t *records;          /* Records validated per input file */
+    unsigned char *unterminated;  /* Per input: its last line had no '\n' */
+    int status;               /* SUCCESS or the first validation error */
+    int cancel;               /* Set by the copying thread to stop early */
+} VerifyPass;
+
+/* Verifier thread: parse and validate every input file while it is copied */
+static void* verify_thread(void *arg) {
+    VerifyPass *pass = arg;
+    const MergerConfig *config = pass->config;
+    
+    for (int i = 0; i < config->num_input_files && pass->status == SUCCESS; i++) {
+        const char *input_file = config->input_files[i];
+        FastqReader *reader = fastq_reader_open_threaded(input_file, config->threads);
         if (reader == NULL) {
             fprintf(stderr, "Error: Failed to open input file '%s'\n", input_file);
-            if (is_output_pipe) {
-                pclose(out_fp);
-            } else {
-                fclose(out_fp);
-            }
-            free(write_buffer);
-            return ERR_FILE_OPEN;
+            pass->status = ERR_FILE_OPEN;
+            break;
         }
         
-        /* Process each record in the file */
         FastqRecord record;
         int read_result;
-        size_t file_sequences = 0;
-        
         while ((read_result = fastq_reader_next(reader, &record)) > 0) {
-            /* Validate record */
             char error_msg[256];
-            if (!fastq_record_validate(&record, error_msg, sizeof(error_msg))) {
+            int bad_line;
+            if (!fastq_record_validate(&record, config->validate, &bad_line,
+                                       error_msg, sizeof(error_msg))) {
+                /* line_number is at the record's last line */
                 fprintf(stderr, "Error: Invalid FASTQ record in '%s' at line %zu: %s\n",
-                        input_file, reader->line_number, error_msg);
-                fastq_record_free(&record);
-                fastq_reader_close(reader);
-                if (is_output_pipe) {
-                    pclose(out_fp);
-                } else {
-                    fclose(out_fp);
-                }
-                free(write_buffer);
-                return ERR_INVALID_FORMAT;
-            }
-            
-            /* Generate new ID */
-            char *new_id = id_generator_next(config->id_gen);
-            if (new_id == NULL) {
-                fprintf(stderr, "Error: Failed to generate sequence ID\n");
-                fastq_record_free(&record);
-                fastq_reader_close(reader);
-                if (is_output_pipe) {
-                    pclose(out_fp);
-                } else {
-                    fclose(out_fp);
-                }
-                free(write_buffer);
-                return ERR_MEMORY_ALLOC;
+                        input_file, reader->line_number - 4 + (size_t)bad_line, error_msg);
+                pass->status = ERR_INVALID_FORMAT;
+                break;
             }
-            
-            /* Write record with new ID */
-            int write_result = write_fastq_record(out_fp, new_id, &record);
-            free(new_id);
-            
-            if (write_result != SUCCESS) {
-                fastq_record_free(&record);
-                fastq_reader_close(reader);
-                if (is_output_pipe) {
-                    pclose(out_fp);
-                } else {
-                    fclose(out_fp);
-                }
-                free(write_buffer);
-                return write_result;
-            }
-            
-            /* Clean up record */
+            pass->records[i]++;
             fastq_record_free(&record);
             
-            file_sequences++;
-            stats->total_sequences++;
-            
-            /* Print progress in verbose mode */
-            if (config->verbose && file_sequences % 10000 == 0) {
-                printf("  Processed %zu sequences...\n", file_sequences);
+            if ((pass->records[i] & 0xffff) == 0 &&
+                __atomic_load_n(&pass->cancel, __ATOMIC_ACQUIRE)) {
+                break;
             }
         }
+        if (read_result < 0 && pass->status == SUCCESS) {
+            fprintf(stderr, "Error: Failed to read from '%s'\n", input_file);
+            pass->status = ERR_FILE_READ;
+        }
+        pass->unterminated[i] = (unsigned char)reader->unterminated;
+        fastq_reader_close(reader);
         
-        /* Check for read errors */
-        if (read_result < 0) {
+        if (__atomic_load_n(&pass->cancel, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+    
+    return NULL;
+}
+
+/* 0 for plain data, 1 for gzip, 2 for BGZF (gzip made of BGZF blocks) */
+static int fd_gzip_kind(int fd) {
+    unsigned char header[BGZF_HEADER_SIZE];
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    if (n < 2 || header[0] != 0x1f || header[1] != 0x8b) {
+        return 0;
+    }
+    return (bgzf_block_size(header, (size_t)n) > 0) ? 2 : 1;
+}
+
+/* Last decompressed byte of a BGZF file, found from the block headers
+ * and their ISIZE trailers without inflating anything but the last block
+ * that holds data. Returns 1 with *last set ('\n' if the file holds no
+ * data), 0 if the file is not BGZF throughout, -1 on a read error. */
+static int bgzf_last_byte(int fd, off_t size, int *last) {
+    unsigned char header[BGZF_HEADER_SIZE];
+    unsigned char trailer[4];
+    off_t offset = 0;
+    off_t data_block = -1;
+    
+    while (offset < size) {
+        if (pread(fd, header, sizeof(header), offset) != (ssize_t)sizeof(header)) {
+            return 0;
+        }
+        size_t block_size = bgzf_block_size(header, sizeof(header));
+        if (block_size == 0 || offset + (off_t)block_size > size) {
+            return 0;
+        }
+        if (pread(fd, trailer, 4, offset + (off_t)block_size - 4) != 4) {
+            return -1;
+        }
+        if (trailer[0] | trailer[1] | trailer[2] | trailer[3]) {
+            data_block = offset;
+        }
+        offset += (off_t)block_size;
+    }
+    
+    *last = '\n';
+    if (data_block < 0) {
+        return 1;
+    }
+    
+    unsigned char *block = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+    unsigned char *data = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+    BgzfInflater inflater;
+    size_t len = 0;
+    int result = -1;
+    ssize_t block_len = bgzf_read_block(fd, data_block, block);
+    if (block_len > 0 && bgzf_inflater_init(&inflater)) {
+        if (bgzf_inflate_block(&inflater, block, (size_t)block_len, data,
+                               BGZF_MAX_BLOCK_SIZE, &len) && len > 0) {
+            *last = data[len - 1];
+            result = 1;
+        }
+        bgzf_inflater_free(&inflater);
+    }
+    free(data);
+    free(block);
+    return result;
+}
+
+/* Last byte input_file decompresses to ('\n' if it holds no data). BGZF
+ * needs only its last block; other gzip files are read through once. */
+static int gzip_last_byte(const char *input_file, int fd, off_t size, int *last) {
+    int found = bgzf_last_byte(fd, size, last);
+    if (found > 0) {
+        return SUCCESS;
+    }
+    if (found < 0) {
+        fprintf(stderr, "Error: Failed to read from '%s'\n", input_file);
+        return ERR_FILE_READ;
+    }
+    
+    InputStream *in = input_stream_open(input_file);
+    if (in == NULL) {
+        return ERR_FILE_OPEN;
+    }
+    char *data = safe_malloc(BGZF_BLOCK_DATA_SIZE);
+    ssize_t n;
+    *last = '\n';
+    while ((n = input_stream_read(in, data, BGZF_BLOCK_DATA_SIZE)) > 0) {
+        *last = (unsigned char)data[n - 1];
+    }
+    free(data);
+    input_stream_close(in);
+    if (n < 0) {
+        fprintf(stderr, "Error: Failed to read from '%s'\n", input_file);
+        return ERR_FILE_READ;
+    }
+    return SUCCESS;
+}
+
+/* End the output with a line break, as its own BGZF block if compressed */
+static int append_newline(int out_fd, int compress) {
+    unsigned char block[BGZF_HEADER_SIZE + 6 + BGZF_FOOTER_SIZE];
+    const unsigned char *data = (const unsigned char *)"\n";
+    size_t len = 1;
+    
+    if (compress) {
+        len = bgzf_store_block(block, data, 1);
+        data = block;
+    }
+    if (write_fd_all(out_fd, data, len) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
+
+/* Append input_file to out_fd, decompressing it or compressing it to BGZF
+ * when its format differs from the output's; *last receives the last
+ * uncompressed byte ('\n' if the input is empty) */
+static int append_converted(const char *input_file, int out_fd, int compress, int *last) {
+    InputStream *in = input_stream_open(input_file);
+    if (in == NULL) {
+        return ERR_FILE_OPEN;
+    }
+    
+    unsigned char *data = safe_malloc(BGZF_BLOCK_DATA_SIZE);
+    unsigned char *block = compress ? safe_malloc(BGZF_MAX_BLOCK_SIZE) : NULL;
+    z_stream strm;
+    int result = SUCCESS;
+    
+    if (compress && !bgzf_deflate_init(&strm, Z_DEFAULT_COMPRESSION)) {
+        fprintf(stderr, "Error: Failed to initialize compression for '%s'\n", input_file);
+        result = ERR_MEMORY_ALLOC;
+        compress = -1;
+    }
+    
+    while (result == SUCCESS) {
+        /* Fill a whole block so compressed output uses full-size BGZF blocks */
+        size_t len = 0;
+        ssize_t n = 1;
+        while (len < BGZF_BLOCK_DATA_SIZE &&
+               (n = input_stream_read(in, data + len, BGZF_BLOCK_DATA_SIZE - len)) > 0) {
+            len += (size_t)n;
+        }
+        if (n < 0) {
             fprintf(stderr, "Error: Failed to read from '%s'\n", input_file);
-            fastq_reader_close(reader);
-            if (is_output_pipe) {
-                pclose(out_fp);
-            } else {
-                fclose(out_fp);
+            result = ERR_FILE_READ;
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        *last = data[len - 1];
+        
+        if (compress > 0) {
+            size_t block_len = bgzf_compress_block(&strm, block, data, len);
+            if (block_len == 0) {
+                fprintf(stderr, "Error: Failed to compress '%s'\n", input_file);
+                result = ERR_FILE_WRITE;
+            } else if (write_fd_all(out_fd, block, block_len) != SUCCESS) {
+                fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+                result = ERR_FILE_WRITE;
+            }
+        } else if (write_fd_all(out_fd, data, len) != SUCCESS) {
+            fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+            result = ERR_FILE_WRITE;
+        }
+        if (n == 0) {
+            break;
+        }
+    }
+    
+    if (compress > 0) {
+        deflateEnd(&strm);
+    }
+    free(block);
+    free(data);
+    input_stream_close(in);
+    return result;
+}
+
+/* Concatenate the inputs without renaming any reads.
+ *
+ * gzip members are valid when concatenated, so gzip input going to .gz
+ * output and plain input going to plain output are appended as raw bytes
+ * (copy_file_range() where the kernel supports it). Other combinations are
+ * decompressed or compressed on the way, and once the output starts as
+ * BGZF, plain gzip input is recompressed so it stays readable
+ * block-parallel. An input whose last line has no '\n' gets one, so its
+ * last record does not run into the next file's first. With
+ * config->verify, a second thread parses and validates every record while
+ * the bytes are copied. */
+static int merge_keep_ids(const MergerConfig *config, MergerStats *stats) {
+    int n = config->num_input_files;
+    size_t name_len = strlen(config->output_file);
+    int out_compressed = (name_len > 3 && strcmp(config->output_file + name_len - 3, ".gz") == 0);
+    
+    int out_fd = open(config->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0) {
+        fprintf(stderr, "Error: Cannot open output file '%s': %s\n",
+                config->output_file, strerror(errno));
+        return ERR_FILE_OPEN;
+    }
+    
+    VerifyPass pass;
+    pass.config = config;
+    pass.records = safe_malloc(sizeof(size_t) * (size_t)n);
+    memset(pass.records, 0, sizeof(size_t) * (size_t)n);
+    pass.unterminated = safe_malloc((size_t)n);
+    memset(pass.unterminated, 0, (size_t)n);
+    pass.status = SUCCESS;
+    pass.cancel = 0;
+    unsigned char *newline_added = safe_malloc((size_t)n);
+    memset(newline_added, 0, (size_t)n);
+    
+    pthread_t verifier;
+    int verifier_started = 0;
+    if (config->verify) {
+        if (pthread_create(&verifier, NULL, verify_thread, &pass) == 0) {
+            verifier_started = 1;
+        }
+    }
+    
+    int result = SUCCESS;
+    int copied = 0;
+    int out_bgzf = -1;        /* Output is BGZF so far (-1 until the first file) */
+    for (int i = 0; i < n && result == SUCCESS; i++) {
+        const char *input_file = config->input_files[i];
+        int in_fd = open(input_file, O_RDONLY);
+        struct stat st;
+        if (in_fd < 0 || fstat(in_fd, &st) != 0) {
+            fprintf(stderr, "Error: Failed to open input file '%s'\n", input_file);
+            if (in_fd >= 0) {
+                close(in_fd);
             }
-            free(write_buffer);
-            return ERR_FILE_READ;
+            result = ERR_FILE_OPEN;
+            break;
         }
         
+        int kind = fd_gzip_kind(in_fd);
+        int raw;
+        if (!out_compressed) {
+            raw = (kind == 0);
+        } else {
+            if (out_bgzf < 0) {
+                out_bgzf = (kind != 1);
+            }
+            raw = (kind == 2 || (kind == 1 && !out_bgzf));
+        }
         if (config->verbose) {
-            printf("  Completed: %zu sequences from '%s'\n", file_sequences, input_file);
+            printf("Appending file %d/%d: %s (%s)\n", i + 1, n, input_file,
+                   raw ? "raw copy" : (!out_compressed ? "decompressing" :
+                                       (kind == 0 ? "compressing" : "recompressing to BGZF")));
         }
         
-        fastq_reader_close(reader);
-        stats->total_files++;
+        int last = '\n';
+        if (raw) {
+            if (copy_fd_range(in_fd, out_fd, (size_t)st.st_size) != SUCCESS) {
+                fprintf(stderr, "Error: Failed to append '%s' to output: %s\n",
+                        input_file, strerror(errno));
+                result = ERR_FILE_WRITE;
+            } else if (kind != 0) {
+                result = gzip_last_byte(input_file, in_fd, st.st_size, &last);
+            } else if (st.st_size > 0) {
+                unsigned char byte;
+                if (pread(in_fd, &byte, 1, st.st_size - 1) != 1) {
+                    fprintf(stderr, "Error: Failed to read from '%s'\n", input_file);
+                    result = ERR_FILE_READ;
+                } else {
+                    last = byte;
+                }
+            }
+        } else {
+            result = append_converted(input_file, out_fd, out_compressed, &last);
+        }
+        close(in_fd);
+        
+        if (result == SUCCESS && last != '\n') {
+            result = append_newline(out_fd, out_compressed);
+            newline_added[i] = 1;
+        }
+        
+        if (result == SUCCESS) {
+            copied++;
+        }
+    }
+    
+    /* Finish with a BGZF end-of-file marker (an empty gzip member) */
+    if (result == SUCCESS && out_compressed &&
+        write_fd_all(out_fd, BGZF_EOF_BLOCK, BGZF_EOF_SIZE) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+        result = ERR_FILE_WRITE;
+    }
+    if (close(out_fd) != 0 && result == SUCCESS) {
+        fprintf(stderr, "Error: Failed to finish output file '%s': %s\n",
+                config->output_file, strerror(errno));
+        result = ERR_FILE_WRITE;
+    }
+    
+    if (config->verify) {
+        if (verifier_started) {
+            if (result != SUCCESS) {
+                __atomic_store_n(&pass.cancel, 1, __ATOMIC_RELEASE);
+            }
+            pthread_join(verifier, NULL);
+        } else {
+            verify_thread(&pass);  /* No thread available: check afterwards */
+        }
+        if (result == SUCCESS) {
+            result = pass.status;
+        }
+        
+        /* Every input must end in a line break of its own or one added
+         * after it, or two records are joined in the output */
+        for (int i = 0; i < copied && result == SUCCESS; i++) {
+            if (pass.unterminated[i] != newline_added[i]) {
+                fprintf(stderr, "Error: Output line break after '%s' does not match its "
+                        "last line\n", config->input_files[i]);
+                result = ERR_INVALID_FORMAT;
+            }
+        }
+        for (int i = 0; i < copied; i++) {
+            stats->total_sequences += pass.records[i];
+            if (config->verbose) {
+                printf("  Verified: %zu sequences from '%s'\n",
+                       pass.records[i], config->input_files[i]);
+            }
+        }
+    }
+    stats->total_files = (size_t)copied;
+    
+    free(newline_added);
+    free(pass.unterminated);
+    free(pass.records);
+    return result;
+}
+
+int merge_fastq_files(const MergerConfig *config, MergerStats *stats) {
+    if (config == NULL || stats == NULL) {
+        return ERR_INVALID_PARAM;
     }
     
-    /* Close output file */
-    if (is_output_pipe) {
-        pclose(out_fp);
+    /* Initialize stats */
+    stats->total_sequences = 0;
+    stats->total_files = 0;
+    stats->success = 0;
+    
+    /* With --keep-ids, concatenate; with -j, merge several input files at once */
+    int result;
+    if (config->keep_ids) {
+        result = merge_keep_ids(config, stats);
+    } else if (config->jobs > 1 && config->num_input_files > 1) {
+        result = merge_concurrent(config, stats);
     } else {
-        fclose(out_fp);
+        result = merge_in_order(config, stats);
+    }
+    if (result != SUCCESS) {
+        return result;
     }
-    free(write_buffer);
     
     /* Print summary */
     if (config->verbose) {
         printf("\nMerge completed successfully:\n");
         printf("  Files processed: %zu\n", stats->total_files);
-        printf("  Total sequences: %zu\n", stats->total_sequences);
+        if (config->keep_ids && !config->verify) {
+            printf("  Total sequences: not counted (use --verify)\n");
+        } else {
+            printf("  Total sequences: %zu\n", stats->total_sequences);
+        }
         printf("  Output file: %s\n", config->output_file);
     }
     
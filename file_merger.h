@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include "id_generator.h"
 #include "fastq_parser.h"
+#include "output_stream.h"
+
+/* Record batches in flight between the parser and writer threads (about 256 KB each) */
+#define DEFAULT_QUEUE_DEPTH 8
 
 /* Merger configuration structure */
 typedef struct {
@@ -12,6 +16,12 @@ typedef struct {
     char *output_file;       /* Output file path */
     IdGenerator *id_gen;     /* ID generator */
     int verbose;             /* Verbose output flag */
+    int threads;             /* Worker threads; above 1 also pipelines parsing */
+    int queue_depth;         /* Record batches in flight (0 = default) */
+    int jobs;                /* Input files merged concurrently (<= 1 = one at a time) */
+    int keep_ids;            /* Concatenate the inputs without renaming reads */
+    int verify;              /* With keep_ids, validate every record while copying */
+    ValidateLevel validate;  /* Checks applied to every record (keep_ids: with verify) */
 } MergerConfig;
 
 /* Merger statistics structure */
@@ -24,7 +34,8 @@ typedef struct {
 /* Execute file merge */
 int merge_fastq_files(const MergerConfig *config, MergerStats *stats);
 
-/* Write FASTQ record to output file */
-int write_fastq_record(FILE *out_fp, const char *new_id, const FastqRecord *record);
+/* Write FASTQ record to output file under new_id (id_len bytes) */
+int write_fastq_record(OutputStream *out, const char *new_id, size_t id_len,
+                       const FastqRecord *record);
 
 #endif /* FILE_MERGER_H */
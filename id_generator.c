@@ -15,27 +15,270 @@
 #define DEFAULT_CONTROL_BITS 0
 #define DEFAULT_INDEX "ATCG"
 
+/* Illumina layout: INSTRUMENT:RUN:FLOWCELL:LANE:TILE:X:Y READ:FILTERED:CONTROL:INDEX */
+#define DEFAULT_TEMPLATE "{instrument}:{run}:{flowcell}:{lane}:{tile}:{x}:{y} " \
+                         "{read}:{filter}:{control}:{index}"
+
+/* Digits of a counter field, with room for any counter value */
+#define MAX_FIELD_DIGITS 20
+
+/* Marks an IdOp that copies literal text */
+#define ID_OP_LITERAL -1
+
+static void field_set(IdField *field, long long value) {
+    field->len = (size_t)snprintf(field->text, sizeof(field->text), "%lld", value);
+}
+
+/* Add one to the decimal text, carrying as needed */
+static void field_increment(IdField *field) {
+    size_t i = field->len;
+    while (i > 0 && field->text[i - 1] == '9') {
+        field->text[--i] = '0';
+    }
+    if (i > 0) {
+        field->text[i - 1]++;
+    } else {
+        memmove(field->text + 1, field->text, field->len);
+        field->text[0] = '1';
+        field->len++;
+    }
+}
+
+/* Append literal text to the compiled template, merging with a preceding literal */
+static void append_literal(IdGenerator *gen, size_t *ops_cap, size_t *literals_cap,
+                           const char *text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    
+    if (gen->literals_len + len > *literals_cap) {
+        while (gen->literals_len + len > *literals_cap) {
+            *literals_cap *= 2;
+        }
+        gen->literals = safe_realloc(gen->literals, *literals_cap);
+    }
+    memcpy(gen->literals + gen->literals_len, text, len);
+    
+    IdOp *last = (gen->num_ops > 0) ? &gen->ops[gen->num_ops - 1] : NULL;
+    if (last != NULL && last->field == ID_OP_LITERAL &&
+        last->offset + last->len == gen->literals_len) {
+        last->len += len;
+    } else {
+        if (gen->num_ops == *ops_cap) {
+            *ops_cap *= 2;
+            gen->ops = safe_realloc(gen->ops, sizeof(IdOp) * *ops_cap);
+        }
+        IdOp *op = &gen->ops[gen->num_ops++];
+        op->field = ID_OP_LITERAL;
+        op->offset = gen->literals_len;
+        op->len = len;
+        op->width = 0;
+    }
+    
+    gen->literals_len += len;
+}
+
+static void append_field(IdGenerator *gen, size_t *ops_cap, int field, size_t width) {
+    if (gen->num_ops == *ops_cap) {
+        *ops_cap *= 2;
+        gen->ops = safe_realloc(gen->ops, sizeof(IdOp) * *ops_cap);
+    }
+    IdOp *op = &gen->ops[gen->num_ops++];
+    op->field = field;
+    op->offset = 0;
+    op->len = 0;
+    op->width = width;
+}
+
+/* Parse the template once into literal and counter-field ops.
+ * Configuration values that never change are folded into literals.
+ * Returns 0 and prints an error if the template is malformed. */
+static int compile_template(IdGenerator *gen, const char *tmpl) {
+    const IdGeneratorConfig *c = &gen->config;
+    size_t ops_cap = 16;
+    size_t literals_cap = 64;
+    
+    gen->ops = safe_malloc(sizeof(IdOp) * ops_cap);
+    gen->num_ops = 0;
+    gen->literals = safe_malloc(literals_cap);
+    gen->literals_len = 0;
+    
+    const char *p = tmpl;
+    while (*p != '\0') {
+        if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')) {
+            append_literal(gen, &ops_cap, &literals_cap, p, 1);
+            p += 2;
+            continue;
+        }
+        if (*p == '}') {
+            fprintf(stderr, "Error: Unmatched '}' in ID template \"%s\"\n", tmpl);
+            return 0;
+        }
+        if (*p != '{') {
+            size_t len = strcspn(p, "{}");
+            append_literal(gen, &ops_cap, &literals_cap, p, len);
+            p += len;
+            continue;
+        }
+        
+        /* Placeholder: {name} or {name:width} */
+        const char *name = p + 1;
+        const char *end = strchr(name, '}');
+        if (end == NULL) {
+            fprintf(stderr, "Error: Unterminated '{' in ID template \"%s\"\n", tmpl);
+            return 0;
+        }
+        const char *colon = memchr(name, ':', (size_t)(end - name));
+        size_t name_len = (size_t)((colon != NULL ? colon : end) - name);
+        size_t width = 0;
+        if (colon != NULL) {
+            char *num_end;
+            long w = strtol(colon + 1, &num_end, 10);
+            if (num_end != end || w <= 0 || w > MAX_FIELD_DIGITS) {
+                fprintf(stderr, "Error: Invalid width in ID template placeholder \"%.*s\" "
+                        "(expected 1-%d)\n", (int)(end - p + 1), p, MAX_FIELD_DIGITS);
+                return 0;
+            }
+            width = (size_t)w;
+        }
+        
+        char text[32];
+        int field = ID_OP_LITERAL;
+        const char *value = NULL;
+
+#define NAME_IS(s) (name_len == sizeof(s) - 1 && memcmp(name, s, name_len) == 0)
+        if (NAME_IS("tile")) {
+            field = ID_FIELD_TILE;
+        } else if (NAME_IS("x")) {
+            field = ID_FIELD_X;
+        } else if (NAME_IS("y")) {
+            field = ID_FIELD_Y;
+        } else if (NAME_IS("n")) {
+            field = ID_FIELD_NUMBER;
+        } else if (NAME_IS("file")) {
+            field = ID_FIELD_FILE;
+        } else if (NAME_IS("instrument") || NAME_IS("prefix")) {
+            value = c->instrument_name;
+        } else if (NAME_IS("run")) {
+            value = c->run_id;
+        } else if (NAME_IS("flowcell")) {
+            value = c->flowcell_id;
+        } else if (NAME_IS("index")) {
+            value = c->index_seq;
+        } else if (NAME_IS("lane")) {
+            snprintf(text, sizeof(text), "%d", c->lane);
+            value = text;
+        } else if (NAME_IS("read")) {
+            snprintf(text, sizeof(text), "%d", c->read_num);
+            value = text;
+        } else if (NAME_IS("filter")) {
+            snprintf(text, sizeof(text), "%c", c->is_filtered);
+            value = text;
+        } else if (NAME_IS("control")) {
+            snprintf(text, sizeof(text), "%d", c->control_bits);
+            value = text;
+        } else {
+            fprintf(stderr, "Error: Unknown ID template placeholder \"%.*s\"\n",
+                    (int)(end - p + 1), p);
+            return 0;
+        }
+#undef NAME_IS
+        
+        if (field != ID_OP_LITERAL) {
+            append_field(gen, &ops_cap, field, width);
+        } else {
+            size_t len = strlen(value);
+            for (size_t pad = len; pad < width; pad++) {
+                append_literal(gen, &ops_cap, &literals_cap, "0", 1);
+            }
+            append_literal(gen, &ops_cap, &literals_cap, value, len);
+        }
+        p = end + 1;
+    }
+    
+    return 1;
+}
+
+/* Render the counter fields for a counter value directly from the configuration */
+static void render_fields(const IdGeneratorConfig *c, size_t counter, IdField *fields) {
+    field_set(&fields[ID_FIELD_X], (long long)c->x_pos + (long long)(counter % 1000));
+    field_set(&fields[ID_FIELD_Y], (long long)c->y_pos + (long long)(counter / 1000));
+    field_set(&fields[ID_FIELD_TILE], (long long)c->tile + (long long)(counter / 1000000));
+    field_set(&fields[ID_FIELD_NUMBER], (long long)counter);
+}
+
+/* Bring the counter fields up to date with sequence_counter */
+static void update_fields(IdGenerator *gen) {
+    size_t counter = gen->sequence_counter;
+    
+    if (gen->rendered_counter != 0 && counter == gen->rendered_counter + 1 &&
+        gen->config.tile >= 0 && gen->config.x_pos >= 0 && gen->config.y_pos >= 0) {
+        /* Step by one: x counts up and wraps every 1000 reads, carrying into y,
+         * and tile advances every million reads */
+        if (counter % 1000 != 0) {
+            field_increment(&gen->fields[ID_FIELD_X]);
+        } else {
+            field_set(&gen->fields[ID_FIELD_X], gen->config.x_pos);
+            field_increment(&gen->fields[ID_FIELD_Y]);
+            if (counter % 1000000 == 0) {
+                field_increment(&gen->fields[ID_FIELD_TILE]);
+            }
+        }
+        field_increment(&gen->fields[ID_FIELD_NUMBER]);
+    } else {
+        /* First use, the counter was moved, or a field may be negative:
+         * render from scratch */
+        render_fields(&gen->config, counter, gen->fields);
+    }
+    
+    gen->rendered_counter = counter;
+}
+
+/* Run the compiled template into buf; returns the length */
+static size_t assemble_id(const IdGenerator *gen, const IdField *fields, char *buf) {
+    char *p = buf;
+    for (size_t i = 0; i < gen->num_ops; i++) {
+        const IdOp *op = &gen->ops[i];
+        if (op->field == ID_OP_LITERAL) {
+            memcpy(p, gen->literals + op->offset, op->len);
+            p += op->len;
+        } else {
+            const IdField *f = &fields[op->field];
+            for (size_t pad = f->len; pad < op->width; pad++) {
+                *p++ = '0';
+            }
+            memcpy(p, f->text, f->len);
+            p += f->len;
+        }
+    }
+    *p = '\0';
+    
+    return (size_t)(p - buf);
+}
+
 IdGenerator* id_generator_init(const IdGeneratorConfig *config) {
     IdGenerator *gen = safe_malloc(sizeof(IdGenerator));
     
     /* Set default values or use provided config */
     if (config != NULL) {
-        gen->config.instrument_name = (config->instrument_name != NULL) ? 
+        gen->config.instrument_name = (config->instrument_name != NULL) ?
             safe_strdup(config->instrument_name) : safe_strdup(DEFAULT_INSTRUMENT);
-        gen->config.run_id = (config->run_id != NULL) ? 
+        gen->config.run_id = (config->run_id != NULL) ?
             safe_strdup(config->run_id) : safe_strdup(DEFAULT_RUN_ID);
-        gen->config.flowcell_id = (config->flowcell_id != NULL) ? 
+        gen->config.flowcell_id = (config->flowcell_id != NULL) ?
             safe_strdup(config->flowcell_id) : safe_strdup(DEFAULT_FLOWCELL);
         gen->config.lane = (config->lane > 0) ? config->lane : DEFAULT_LANE;
         gen->config.tile = (config->tile > 0) ? config->tile : DEFAULT_TILE;
         gen->config.x_pos = (config->x_pos > 0) ? config->x_pos : DEFAULT_X_POS;
         gen->config.y_pos = (config->y_pos > 0) ? config->y_pos : DEFAULT_Y_POS;
         gen->config.read_num = (config->read_num > 0) ? config->read_num : DEFAULT_READ_NUM;
-        gen->config.is_filtered = (config->is_filtered == 'Y' || config->is_filtered == 'N') ? 
+        gen->config.is_filtered = (config->is_filtered == 'Y' || config->is_filtered == 'N') ?
             config->is_filtered : DEFAULT_IS_FILTERED;
         gen->config.control_bits = config->control_bits;
-        gen->config.index_seq = (config->index_seq != NULL) ? 
+        gen->config.index_seq = (config->index_seq != NULL) ?
             safe_strdup(config->index_seq) : safe_strdup(DEFAULT_INDEX);
+        gen->config.id_template = (config->id_template != NULL) ?
+            safe_strdup(config->id_template) : safe_strdup(DEFAULT_TEMPLATE);
     } else {
         /* Use all defaults */
         gen->config.instrument_name = safe_strdup(DEFAULT_INSTRUMENT);
@@ -49,10 +292,18 @@ IdGenerator* id_generator_init(const IdGeneratorConfig *config) {
         gen->config.is_filtered = DEFAULT_IS_FILTERED;
         gen->config.control_bits = DEFAULT_CONTROL_BITS;
         gen->config.index_seq = safe_strdup(DEFAULT_INDEX);
+        gen->config.id_template = safe_strdup(DEFAULT_TEMPLATE);
     }
     
     /* Initialize sequence counter */
     gen->sequence_counter = 0;
+    gen->rendered_counter = 0;
+    
+    if (!compile_template(gen, gen->config.id_template)) {
+        id_generator_free(gen);
+        return NULL;
+    }
+    id_generator_set_file(gen, 0);
     
     return gen;
 }
@@ -62,30 +313,89 @@ char* id_generator_next(IdGenerator *gen) {
         return NULL;
     }
     
+    size_t size = id_generator_max_length(gen) + 1;
+    char *id = safe_malloc(size);
+    id_generator_next_into(gen, id, size);
+    
+    return id;
+}
+
+size_t id_generator_next_into(IdGenerator *gen, char *buf, size_t size) {
+    if (gen == NULL || buf == NULL || size < id_generator_max_length(gen) + 1) {
+        return 0;
+    }
+    
     /* Increment counter */
     gen->sequence_counter++;
+    update_fields(gen);
     
-    /* Calculate coordinates based on counter */
-    int x = gen->config.x_pos + (gen->sequence_counter % 1000);
-    int y = gen->config.y_pos + (gen->sequence_counter / 1000);
-    int tile = gen->config.tile + (gen->sequence_counter / 1000000);
-    
-    /* Format: @INSTRUMENT:RUN:FLOWCELL:LANE:TILE:X:Y READ:FILTERED:CONTROL:INDEX */
-    char *id = safe_malloc(512);
-    snprintf(id, 512, "%s:%s:%s:%d:%d:%d:%d %d:%c:%d:%s",
-             gen->config.instrument_name,
-             gen->config.run_id,
-             gen->config.flowcell_id,
-             gen->config.lane,
-             tile,
-             x,
-             y,
-             gen->config.read_num,
-             gen->config.is_filtered,
-             gen->config.control_bits,
-             gen->config.index_seq);
+    return assemble_id(gen, gen->fields, buf);
+}
+
+size_t id_generator_at(const IdGenerator *gen, size_t index, char *buf, size_t size) {
+    if (gen == NULL || buf == NULL || size < id_generator_max_length(gen) + 1) {
+        return 0;
+    }
     
-    return id;
+    /* Record `index` is issued when the counter reaches index + 1 */
+    IdField fields[ID_FIELD_COUNT];
+    render_fields(&gen->config, index + 1, fields);
+    fields[ID_FIELD_FILE] = gen->fields[ID_FIELD_FILE];
+    
+    return assemble_id(gen, fields, buf);
+}
+
+void id_generator_seek(IdGenerator *gen, size_t index) {
+    if (gen == NULL) {
+        return;
+    }
+    
+    /* The next id_generator_next* call issues record `index`; the fields
+     * are re-rendered from scratch on that call */
+    gen->sequence_counter = index;
+}
+
+void id_generator_set_file(IdGenerator *gen, int file_index) {
+    if (gen == NULL) {
+        return;
+    }
+    
+    field_set(&gen->fields[ID_FIELD_FILE], (long long)file_index + 1);
+}
+
+size_t id_generator_max_length(const IdGenerator *gen) {
+    if (gen == NULL) {
+        return 0;
+    }
+    
+    /* Widths are capped at MAX_FIELD_DIGITS, so each field op fits in that */
+    size_t len = gen->literals_len;
+    for (size_t i = 0; i < gen->num_ops; i++) {
+        if (gen->ops[i].field != ID_OP_LITERAL) {
+            len += MAX_FIELD_DIGITS;
+        }
+    }
+    return len;
+}
+
+IdGenerator* id_generator_clone(const IdGenerator *gen) {
+    if (gen == NULL) {
+        return NULL;
+    }
+    
+    return id_generator_clone_at(gen, gen->sequence_counter);
+}
+
+IdGenerator* id_generator_clone_at(const IdGenerator *gen, size_t index) {
+    if (gen == NULL) {
+        return NULL;
+    }
+    
+    IdGenerator *copy = id_generator_init(&gen->config);
+    copy->fields[ID_FIELD_FILE] = gen->fields[ID_FIELD_FILE];
+    id_generator_seek(copy, index);
+    
+    return copy;
 }
 
 void id_generator_free(IdGenerator *gen) {
@@ -105,6 +415,11 @@ void id_generator_free(IdGenerator *gen) {
     if (gen->config.index_seq != NULL) {
         free(gen->config.index_seq);
     }
+    if (gen->config.id_template != NULL) {
+        free(gen->config.id_template);
+    }
+    free(gen->ops);
+    free(gen->literals);
     
     free(gen);
 }
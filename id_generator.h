@@ -16,20 +16,82 @@ typedef struct {
     char is_filtered;       /* Filtered flag (Y/N) */
     int control_bits;       /* Control bits */
     char *index_seq;        /* Index sequence */
+    char *id_template;      /* Read-name template (NULL = Illumina layout) */
 } IdGeneratorConfig;
 
+/* Decimal text of a counter field, updated in place */
+typedef struct {
+    char text[24];
+    size_t len;
+} IdField;
+
+/* Counter fields an ID template can reference */
+typedef enum {
+    ID_FIELD_TILE,            /* {tile} */
+    ID_FIELD_X,               /* {x} */
+    ID_FIELD_Y,               /* {y} */
+    ID_FIELD_NUMBER,          /* {n}: 1-based record number */
+    ID_FIELD_FILE,            /* {file}: 1-based input file number */
+    ID_FIELD_COUNT
+} IdFieldType;
+
+/* One step of a compiled template: copy literal text or a counter field */
+typedef struct {
+    int field;                /* IdFieldType, or -1 for literal text */
+    size_t offset;            /* Literal: start in the generator's literals */
+    size_t len;               /* Literal: length */
+    size_t width;             /* Field: zero-pad to this many digits */
+} IdOp;
+
 /* ID generator structure */
 typedef struct {
     IdGeneratorConfig config;
     size_t sequence_counter;  /* Sequence counter */
+    
+    /* Template compiled once at init; constant values are pre-rendered */
+    IdOp *ops;
+    size_t num_ops;
+    char *literals;           /* Text of all literal ops */
+    size_t literals_len;
+    IdField fields[ID_FIELD_COUNT];
+    size_t rendered_counter;  /* Counter the fields hold (0 = not rendered) */
 } IdGenerator;
 
-/* Initialize ID generator */
+/* Initialize ID generator.
+ * The template uses {instrument} (or {prefix}), {run}, {flowcell}, {lane},
+ * {read}, {filter}, {control}, {index}, {tile}, {x}, {y}, {n} and {file};
+ * {name:width} zero-pads and {{ / }} are literal braces.
+ * Returns NULL (after printing an error) if the template is invalid. */
 IdGenerator* id_generator_init(const IdGeneratorConfig *config);
 
-/* Generate next sequence ID */
+/* Generate next sequence ID (allocated, caller frees) */
 char* id_generator_next(IdGenerator *gen);
 
+/* Write the next sequence ID into buf (NUL-terminated) without allocating.
+ * Returns its length, or 0 if buf is smaller than id_generator_max_length() + 1. */
+size_t id_generator_next_into(IdGenerator *gen, char *buf, size_t size);
+
+/* Write the ID of record `index` (0-based, as the serial generator would
+ * issue it) into buf without touching the generator's position.
+ * Returns its length, or 0 if buf is too small. */
+size_t id_generator_at(const IdGenerator *gen, size_t index, char *buf, size_t size);
+
+/* Position the generator so its next ID is that of record `index` (0-based) */
+void id_generator_seek(IdGenerator *gen, size_t index);
+
+/* Set the input file (0-based) that {file} reports for the following IDs */
+void id_generator_set_file(IdGenerator *gen, int file_index);
+
+/* Upper bound on the length of any ID this generator produces */
+size_t id_generator_max_length(const IdGenerator *gen);
+
+/* Create an independent copy of a generator, including its counter */
+IdGenerator* id_generator_clone(const IdGenerator *gen);
+
+/* Create a copy of a generator positioned at record `index` (0-based), so
+ * independent workers can each produce a slice of the global ID sequence */
+IdGenerator* id_generator_clone_at(const IdGenerator *gen, size_t index);
+
 /* Free ID generator */
 void id_generator_free(IdGenerator *gen);
 
@@ -0,0 +1,659 @@
+#define _POSIX_C_SOURCE 200809L
+#include "input_stream.h"
+#include "ordered_pool.h"
+#include "bgzf.h"
+#include "utils.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define COMPRESSED_READ_SIZE (256 * 1024)
+#define INFLATE_CHUNK_SIZE (1 << 20)
+#define INFLATE_QUEUE_DEPTH 4
+#define LINE_BUFFER_SIZE (64 * 1024)
+#define BLOCK_JOBS_PER_THREAD 4
+
+/* Block of decompressed data handed from the read-ahead thread */
+typedef struct {
+    unsigned char *data;
+    size_t len;
+} InflateChunk;
+
+/* One BGZF block on its way through the inflate pool */
+typedef struct {
+    unsigned char *block;      /* Compressed block as read from the file */
+    size_t block_len;
+    unsigned char *data;       /* Decompressed bytes */
+    size_t len;
+    BgzfInflater inflater;     /* Decompression state reused across blocks */
+    int inflated;              /* data was filled by the reader thread */
+    int failed;                /* Block could not be read (already reported) */
+} InflateBlockJob;
+
+/* Serial inflate state for gzip members of any kind */
+typedef struct {
+    z_stream strm;
+    unsigned char *in_buffer;
+    int input_eof;
+    int member_done;
+} GzipInflate;
+
+struct InputStream {
+    int fd;
+    char *filename;
+    int is_compressed;
+    
+    /* Read-ahead state for compressed input */
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_ready;    /* Signalled when a chunk has been filled */
+    pthread_cond_t chunk_free;     /* Signalled when a chunk has been consumed */
+    InflateChunk chunks[INFLATE_QUEUE_DEPTH];
+    size_t fill_count;             /* Chunks filled by the read-ahead thread */
+    size_t take_count;             /* Chunks fully consumed by the reader */
+    size_t chunk_pos;              /* Read position inside the current chunk */
+    int producer_done;
+    int producer_error;
+    int stop;                      /* Set by close to cancel the read-ahead thread */
+    
+    /* Block-parallel BGZF state (the read-ahead thread feeds the pool) */
+    int is_parallel;
+    OrderedPool *pool;
+    InflateBlockJob *block_jobs;
+    int num_block_jobs;
+    InflateBlockJob *current_block;
+    size_t block_pos;
+    int blocks_done;
+    int block_error;
+    
+    /* Buffer for input_stream_getline */
+    char *line_buffer;
+    size_t line_pos;
+    size_t line_end;
+    int line_eof;
+};
+
+static ssize_t read_fd(int fd, void *buf, size_t len) {
+    ssize_t n;
+    do {
+        n = read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/* Read exactly len bytes unless the file ends first; returns bytes read or -1 */
+static ssize_t read_full(int fd, void *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = read_fd(fd, (char *)buf + total, len - total);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+/* Publish a filled chunk (or the end of the stream) to the reader */
+static void publish_chunk(InputStream *stream, size_t len, int done, int error) {
+    pthread_mutex_lock(&stream->lock);
+    if (len > 0) {
+        stream->fill_count++;
+    }
+    if (error) {
+        stream->producer_error = 1;
+    }
+    if (done || error) {
+        stream->producer_done = 1;
+    }
+    pthread_cond_signal(&stream->chunk_ready);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/* Prepare / release serial inflate state */
+static int gzip_inflate_init(InputStream *stream, GzipInflate *gz) {
+    memset(gz, 0, sizeof(GzipInflate));
+    if (inflateInit2(&gz->strm, 15 + 16) != Z_OK) {
+        fprintf(stderr, "Error: Cannot initialize decompression for '%s'\n", stream->filename);
+        return 0;
+    }
+    gz->in_buffer = safe_malloc(COMPRESSED_READ_SIZE);
+    return 1;
+}
+
+static void gzip_inflate_free(GzipInflate *gz) {
+    inflateEnd(&gz->strm);
+    free(gz->in_buffer);
+}
+
+/* Inflate from the file's current position into out until it is full or
+ * the data ends (concatenated members included). Returns 1 at the end of
+ * the data, 0 if more follows, -1 on error (reported). */
+static int gzip_inflate_fill(InputStream *stream, GzipInflate *gz,
+                             unsigned char *out, size_t out_size, size_t *out_len) {
+    z_stream *strm = &gz->strm;
+    
+    while (*out_len < out_size) {
+        if (strm->avail_in == 0 && !gz->input_eof) {
+            ssize_t n = read_fd(stream->fd, gz->in_buffer, COMPRESSED_READ_SIZE);
+            if (n < 0) {
+                fprintf(stderr, "Error: Failed to read from '%s': %s\n",
+                        stream->filename, strerror(errno));
+                return -1;
+            }
+            if (n == 0) {
+                gz->input_eof = 1;
+            }
+            strm->next_in = gz->in_buffer;
+            strm->avail_in = (uInt)n;
+        }
+        
+        if (gz->member_done) {
+            if (strm->avail_in == 0) {
+                if (gz->input_eof) {
+                    return 1;
+                }
+                continue;
+            }
+            if (strm->next_in[0] != 0x1f) {
+                /* Same as gzip -d: ignore trailing garbage after a member */
+                warning_msg("Trailing garbage ignored in '%s'", stream->filename);
+                return 1;
+            }
+            inflateReset(strm);
+            gz->member_done = 0;
+        }
+        
+        if (strm->avail_in == 0 && gz->input_eof) {
+            fprintf(stderr, "Error: Unexpected end of compressed data in '%s'\n",
+                    stream->filename);
+            return -1;
+        }
+        
+        strm->next_out = out + *out_len;
+        strm->avail_out = (uInt)(out_size - *out_len);
+        int ret = inflate(strm, Z_NO_FLUSH);
+        *out_len = out_size - strm->avail_out;
+        
+        if (ret == Z_STREAM_END) {
+            gz->member_done = 1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "Error: Corrupt compressed data in '%s': %s\n",
+                    stream->filename, strm->msg != NULL ? strm->msg : "inflate failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Read-ahead thread: inflate gzip members (concatenated members included)
+ * into the chunk ring while the reader parses earlier chunks. */
+static void* inflate_thread(void *arg) {
+    InputStream *stream = arg;
+    GzipInflate gz;
+    int error = 0;
+    int done = 0;
+    
+    if (!gzip_inflate_init(stream, &gz)) {
+        publish_chunk(stream, 0, 1, 1);
+        return NULL;
+    }
+    
+    while (!done && !error) {
+        /* Wait for a free chunk */
+        pthread_mutex_lock(&stream->lock);
+        while (stream->fill_count - stream->take_count >= INFLATE_QUEUE_DEPTH && !stream->stop) {
+            pthread_cond_wait(&stream->chunk_free, &stream->lock);
+        }
+        int stop = stream->stop;
+        InflateChunk *chunk = &stream->chunks[stream->fill_count % INFLATE_QUEUE_DEPTH];
+        pthread_mutex_unlock(&stream->lock);
+        
+        if (stop) {
+            break;
+        }
+        
+        chunk->len = 0;
+        int status = gzip_inflate_fill(stream, &gz, chunk->data, INFLATE_CHUNK_SIZE, &chunk->len);
+        done = (status > 0);
+        error = (status < 0);
+        
+        publish_chunk(stream, chunk->len, done, error);
+    }
+    
+    gzip_inflate_free(&gz);
+    return NULL;
+}
+
+/* Pool job: inflate one BGZF block */
+static int inflate_block_job(void *job, void *ctx) {
+    InflateBlockJob *bj = job;
+    InputStream *stream = ctx;
+    
+    if (bj->failed) {
+        return -1;
+    }
+    if (bj->inflated) {
+        return 0;
+    }
+    if (!bj->inflater.ready && !bgzf_inflater_init(&bj->inflater)) {
+        fprintf(stderr, "Error: Cannot initialize decompression for '%s'\n", stream->filename);
+        return -1;
+    }
+    if (!bgzf_inflate_block(&bj->inflater, bj->block, bj->block_len,
+                            bj->data, BGZF_MAX_BLOCK_SIZE, &bj->len)) {
+        fprintf(stderr, "Error: Corrupt compressed data in '%s'\n", stream->filename);
+        return -1;
+    }
+    return 0;
+}
+
+/* The rest of the file from offset on holds ordinary gzip members (as in
+ * a BGZF file concatenated with a gzip one): inflate it serially here and
+ * pass the data through the pool as already inflated jobs, in order. */
+static void inflate_serial_rest(InputStream *stream, off_t offset) {
+    GzipInflate gz;
+    int ready = 0;
+    if (lseek(stream->fd, offset, SEEK_SET) < 0) {
+        fprintf(stderr, "Error: Failed to read from '%s': %s\n",
+                stream->filename, strerror(errno));
+    } else {
+        ready = gzip_inflate_init(stream, &gz);
+    }
+    
+    int status = ready ? 0 : -1;
+    do {
+        InflateBlockJob *job = ordered_pool_acquire(stream->pool);
+        if (__atomic_load_n(&stream->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        
+        job->inflated = 1;
+        job->block_len = 0;
+        job->len = 0;
+        if (status == 0) {
+            status = gzip_inflate_fill(stream, &gz, job->data, BGZF_MAX_BLOCK_SIZE, &job->len);
+        }
+        job->failed = (status < 0);
+        ordered_pool_submit(stream->pool);
+    } while (status == 0);
+    
+    if (ready) {
+        gzip_inflate_free(&gz);
+    }
+}
+
+/* Read-ahead thread for BGZF input: split the file into blocks using the
+ * BSIZE header field and queue them for the inflate workers. A gzip member
+ * that is not a BGZF block switches to serial inflating from there on. */
+static void* bgzf_reader_thread(void *arg) {
+    InputStream *stream = arg;
+    off_t offset = 0;
+    
+    for (;;) {
+        InflateBlockJob *job = ordered_pool_acquire(stream->pool);
+        if (__atomic_load_n(&stream->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        
+        job->inflated = 0;
+        job->failed = 0;
+        job->block_len = 0;
+        job->len = 0;
+        
+        ssize_t n = read_full(stream->fd, job->block, BGZF_FIXED_HEADER_SIZE);
+        if (n == 0) {
+            break; /* End of file */
+        }
+        
+        size_t block_size = 0;
+        size_t xlen = (n == BGZF_FIXED_HEADER_SIZE) ? bgzf_extra_length(job->block) : 0;
+        if (xlen > 0 && BGZF_FIXED_HEADER_SIZE + xlen <= BGZF_MAX_BLOCK_SIZE &&
+            read_full(stream->fd, job->block + BGZF_FIXED_HEADER_SIZE, xlen) == (ssize_t)xlen) {
+            block_size = bgzf_block_size(job->block, BGZF_FIXED_HEADER_SIZE + xlen);
+        }
+        
+        if (n > 0 && block_size == 0) {
+            /* Hand the job back empty, then inflate the rest in order */
+            job->inflated = 1;
+            ordered_pool_submit(stream->pool);
+            inflate_serial_rest(stream, offset);
+            break;
+        }
+        
+        size_t rest = (block_size > 0) ? block_size - BGZF_FIXED_HEADER_SIZE - xlen : 0;
+        if (n < 0 ||
+            read_full(stream->fd, job->block + BGZF_FIXED_HEADER_SIZE + xlen, rest) != (ssize_t)rest) {
+            if (n < 0) {
+                fprintf(stderr, "Error: Failed to read from '%s': %s\n",
+                        stream->filename, strerror(errno));
+            } else {
+                fprintf(stderr, "Error: Unexpected end of compressed data in '%s'\n",
+                        stream->filename);
+            }
+            job->failed = 1;
+            ordered_pool_submit(stream->pool);
+            break;
+        }
+        
+        job->block_len = block_size;
+        offset += (off_t)block_size;
+        ordered_pool_submit(stream->pool);
+    }
+    
+    ordered_pool_close(stream->pool);
+    return NULL;
+}
+
+/* Check whether the file starts with a BGZF block */
+static int starts_with_bgzf_block(int fd) {
+    unsigned char header[BGZF_FIXED_HEADER_SIZE + 64];
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    if (n < BGZF_FIXED_HEADER_SIZE) {
+        return 0;
+    }
+    return bgzf_block_size(header, (size_t)n) > 0;
+}
+
+/* Set up the inflate pool and block reader for BGZF input */
+static int start_parallel_inflate(InputStream *stream, int threads) {
+    stream->num_block_jobs = threads * BLOCK_JOBS_PER_THREAD;
+    stream->block_jobs = safe_malloc(sizeof(InflateBlockJob) * (size_t)stream->num_block_jobs);
+    void **job_ptrs = safe_malloc(sizeof(void *) * (size_t)stream->num_block_jobs);
+    for (int i = 0; i < stream->num_block_jobs; i++) {
+        memset(&stream->block_jobs[i], 0, sizeof(InflateBlockJob));
+        stream->block_jobs[i].block = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+        stream->block_jobs[i].data = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+        job_ptrs[i] = &stream->block_jobs[i];
+    }
+    stream->pool = ordered_pool_create(threads, job_ptrs, stream->num_block_jobs,
+                                       inflate_block_job, stream);
+    free(job_ptrs);
+    stream->is_parallel = 1;
+    
+    return pthread_create(&stream->thread, NULL, bgzf_reader_thread, stream);
+}
+
+/* input_stream_read for block-parallel BGZF input */
+static ssize_t read_parallel(InputStream *stream, char *buf, size_t len) {
+    size_t copied = 0;
+    
+    while (copied < len) {
+        if (stream->current_block == NULL) {
+            if (stream->blocks_done) {
+                break;
+            }
+            int result = 0;
+            InflateBlockJob *job = ordered_pool_next(stream->pool, &result);
+            if (job == NULL) {
+                stream->blocks_done = 1;
+                break;
+            }
+            if (result != 0) {
+                ordered_pool_release(stream->pool);
+                stream->blocks_done = 1;
+                stream->block_error = 1;
+                break;
+            }
+            stream->current_block = job;
+            stream->block_pos = 0;
+        }
+        
+        InflateBlockJob *job = stream->current_block;
+        size_t n = job->len - stream->block_pos;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy(buf + copied, job->data + stream->block_pos, n);
+        stream->block_pos += n;
+        copied += n;
+        
+        if (stream->block_pos == job->len) {
+            ordered_pool_release(stream->pool);
+            stream->current_block = NULL;
+        }
+    }
+    
+    if (copied == 0 && stream->block_error) {
+        return -1;
+    }
+    return (ssize_t)copied;
+}
+
+InputStream* input_stream_open(const char *filename) {
+    return input_stream_open_threaded(filename, 1);
+}
+
+InputStream* input_stream_open_threaded(const char *filename, int threads) {
+    if (filename == NULL) {
+        return NULL;
+    }
+    
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file '%s': %s\n",
+                filename, strerror(errno));
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    InputStream *stream = safe_malloc(sizeof(InputStream));
+    memset(stream, 0, sizeof(InputStream));
+    stream->fd = fd;
+    stream->filename = safe_strdup(filename);
+    
+    /* Detect gzip by its magic bytes rather than the file name */
+    unsigned char magic[2];
+    stream->is_compressed = (pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+                             magic[0] == 0x1f && magic[1] == 0x8b);
+    
+    if (stream->is_compressed && threads > 1 && starts_with_bgzf_block(fd)) {
+        int err = start_parallel_inflate(stream, threads);
+        if (err != 0) {
+            fprintf(stderr, "Error: Cannot start decompression thread for '%s': %s\n",
+                    filename, strerror(err));
+            ordered_pool_close(stream->pool);
+            input_stream_close(stream);
+            return NULL;
+        }
+        stream->thread_started = 1;
+    } else if (stream->is_compressed) {
+        for (int i = 0; i < INFLATE_QUEUE_DEPTH; i++) {
+            stream->chunks[i].data = safe_malloc(INFLATE_CHUNK_SIZE);
+        }
+        pthread_mutex_init(&stream->lock, NULL);
+        pthread_cond_init(&stream->chunk_ready, NULL);
+        pthread_cond_init(&stream->chunk_free, NULL);
+        
+        int err = pthread_create(&stream->thread, NULL, inflate_thread, stream);
+        if (err != 0) {
+            fprintf(stderr, "Error: Cannot start decompression thread for '%s': %s\n",
+                    filename, strerror(err));
+            input_stream_close(stream);
+            return NULL;
+        }
+        stream->thread_started = 1;
+    }
+    
+    return stream;
+}
+
+ssize_t input_stream_read(InputStream *stream, void *buf, size_t len) {
+    if (stream == NULL || buf == NULL) {
+        return -1;
+    }
+    
+    if (!stream->is_compressed) {
+        ssize_t n = read_fd(stream->fd, buf, len);
+        if (n < 0) {
+            fprintf(stderr, "Error: Failed to read from '%s': %s\n",
+                    stream->filename, strerror(errno));
+        }
+        return n;
+    }
+    
+    if (stream->is_parallel) {
+        return read_parallel(stream, buf, len);
+    }
+    
+    size_t copied = 0;
+    while (copied < len) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->take_count == stream->fill_count && !stream->producer_done && copied == 0) {
+            pthread_cond_wait(&stream->chunk_ready, &stream->lock);
+        }
+        int have_chunk = (stream->take_count != stream->fill_count);
+        int failed = stream->producer_error;
+        pthread_mutex_unlock(&stream->lock);
+        
+        if (!have_chunk) {
+            if (copied == 0 && failed) {
+                return -1;
+            }
+            break;
+        }
+        
+        /* The chunk is owned by the reader until take_count moves past it */
+        InflateChunk *chunk = &stream->chunks[stream->take_count % INFLATE_QUEUE_DEPTH];
+        size_t n = chunk->len - stream->chunk_pos;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy((char *)buf + copied, chunk->data + stream->chunk_pos, n);
+        stream->chunk_pos += n;
+        copied += n;
+        
+        if (stream->chunk_pos == chunk->len) {
+            stream->chunk_pos = 0;
+            pthread_mutex_lock(&stream->lock);
+            stream->take_count++;
+            pthread_cond_signal(&stream->chunk_free);
+            pthread_mutex_unlock(&stream->lock);
+        }
+    }
+    
+    return (ssize_t)copied;
+}
+
+ssize_t input_stream_getline(InputStream *stream, char **line, size_t *line_size) {
+    if (stream == NULL || line == NULL || line_size == NULL) {
+        return -1;
+    }
+    
+    if (stream->line_buffer == NULL) {
+        stream->line_buffer = safe_malloc(LINE_BUFFER_SIZE);
+    }
+    
+    size_t len = 0;
+    for (;;) {
+        if (stream->line_pos == stream->line_end) {
+            if (stream->line_eof) {
+                break;
+            }
+            ssize_t n = input_stream_read(stream, stream->line_buffer, LINE_BUFFER_SIZE);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                stream->line_eof = 1;
+                break;
+            }
+            stream->line_pos = 0;
+            stream->line_end = (size_t)n;
+        }
+        
+        const char *start = stream->line_buffer + stream->line_pos;
+        size_t avail = stream->line_end - stream->line_pos;
+        const char *newline = memchr(start, '\n', avail);
+        size_t take = (newline != NULL) ? (size_t)(newline - start) + 1 : avail;
+        
+        if (*line == NULL || len + take + 1 > *line_size) {
+            size_t new_size = (*line_size > 0) ? *line_size : 128;
+            while (len + take + 1 > new_size) {
+                new_size *= 2;
+            }
+            *line = safe_realloc(*line, new_size);
+            *line_size = new_size;
+        }
+        
+        memcpy(*line + len, start, take);
+        len += take;
+        stream->line_pos += take;
+        
+        if (newline != NULL) {
+            break;
+        }
+    }
+    
+    if (len == 0) {
+        return -1; /* End of file */
+    }
+    
+    (*line)[len] = '\0';
+    return (ssize_t)len;
+}
+
+int input_stream_fd(const InputStream *stream) {
+    return (stream != NULL && !stream->is_compressed) ? stream->fd : -1;
+}
+
+int input_stream_is_compressed(const InputStream *stream) {
+    return (stream != NULL && stream->is_compressed);
+}
+
+void input_stream_close(InputStream *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    
+    if (stream->is_parallel) {
+        /* Stop the block reader, then drain what is still in flight */
+        __atomic_store_n(&stream->stop, 1, __ATOMIC_RELEASE);
+        if (stream->current_block != NULL) {
+            ordered_pool_release(stream->pool);
+        }
+        if (!stream->blocks_done) {
+            while (ordered_pool_next(stream->pool, NULL) != NULL) {
+                ordered_pool_release(stream->pool);
+            }
+        }
+        if (stream->thread_started) {
+            pthread_join(stream->thread, NULL);
+        }
+        ordered_pool_destroy(stream->pool);
+        for (int i = 0; i < stream->num_block_jobs; i++) {
+            bgzf_inflater_free(&stream->block_jobs[i].inflater);
+            free(stream->block_jobs[i].block);
+            free(stream->block_jobs[i].data);
+        }
+        free(stream->block_jobs);
+    } else if (stream->is_compressed) {
+        if (stream->thread_started) {
+            pthread_mutex_lock(&stream->lock);
+            stream->stop = 1;
+            pthread_cond_signal(&stream->chunk_free);
+            pthread_mutex_unlock(&stream->lock);
+            pthread_join(stream->thread, NULL);
+        }
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->chunk_ready);
+        pthread_cond_destroy(&stream->chunk_free);
+        for (int i = 0; i < INFLATE_QUEUE_DEPTH; i++) {
+            free(stream->chunks[i].data);
+        }
+    }
+    
+    if (stream->fd >= 0) {
+        close(stream->fd);
+    }
+    free(stream->filename);
+    free(stream->line_buffer);
+    free(stream);
+}
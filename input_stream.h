@@ -0,0 +1,41 @@
+#ifndef INPUT_STREAM_H
+#define INPUT_STREAM_H
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+/* Byte source over a plain or gzip-compressed file.
+ *
+ * Compressed input is recognised by its magic bytes and inflated in-process
+ * by a read-ahead thread, so decompression overlaps with the consumer.
+ * BGZF input (blocked gzip, detected from the first member's header) can
+ * be inflated block-parallel on a worker pool; blocks are still returned
+ * in file order.
+ */
+typedef struct InputStream InputStream;
+
+/* Open a file for reading; returns NULL (after printing an error) on failure */
+InputStream* input_stream_open(const char *filename);
+
+/* Same as input_stream_open, inflating BGZF input on the given number of
+ * threads (plain gzip and threads <= 1 use the serial read-ahead path) */
+InputStream* input_stream_open_threaded(const char *filename, int threads);
+
+/* Read up to len decompressed bytes; returns bytes read, 0 at end, -1 on error */
+ssize_t input_stream_read(InputStream *stream, void *buf, size_t len);
+
+/* Read one line including its '\n' into *line (grown as needed), like getline().
+ * Do not mix with input_stream_read() on the same stream. */
+ssize_t input_stream_getline(InputStream *stream, char **line, size_t *line_size);
+
+/* File descriptor of uncompressed input, positioned just after the bytes
+ * returned by input_stream_read(); -1 for compressed input */
+int input_stream_fd(const InputStream *stream);
+
+/* Non-zero if the underlying file is gzip-compressed */
+int input_stream_is_compressed(const InputStream *stream);
+
+/* Close the stream and release its resources */
+void input_stream_close(InputStream *stream);
+
+#endif /* INPUT_STREAM_H */
@@ -21,12 +21,47 @@ void print_usage(const char *program_name) {
     printf("  -r, --run-id <string>  Run number (default: \"1\")\n");
     printf("  -f, --flowcell <string> Flowcell ID (default: \"FLOWCELL\")\n");
     printf("  -l, --lane <int>       Lane number (default: 1)\n");
+    printf("  --id-template <string> Read-name template (default: Illumina layout)\n");
+    printf("                         Fields: {instrument} {run} {flowcell} {lane} {tile}\n");
+    printf("                         {x} {y} {read} {filter} {control} {index} {n} {file};\n");
+    printf("                         {n:8} zero-pads to 8 digits\n");
+    printf("  -t, --threads <int>    Threads for .gz output and BGZF input (default: 1)\n");
+    printf("                         With 2 or more, parsing also runs on its own thread\n");
+    printf("  --queue-depth <int>    Record batches buffered between threads (default: %d)\n",
+           DEFAULT_QUEUE_DEPTH);
+    printf("  -j, --jobs <int>       Input files to merge concurrently (default: 1)\n");
+    printf("  --keep-ids             Concatenate inputs as-is, keeping the original read IDs\n");
+    printf("                         (gzip members and plain files are copied as raw bytes;\n");
+    printf("                         not with the ID options, -j, or --validate without --verify)\n");
+    printf("  --verify               With --keep-ids, validate every record during the copy\n");
+    printf("  --validate <level>     Record checks: none, fast (separator line and lengths,\n");
+    printf("                         the default) or strict (also IUPAC bases and\n");
+    printf("                         Phred+33 quality characters)\n");
     printf("  -v, --verbose          Verbose output mode\n");
     printf("  -h, --help             Display help information\n");
     printf("  --version              Display version information\n\n");
     printf("Examples:\n");
     printf("  %s -i file1.fq.gz -i file2.fq.gz -o merged.fq.gz -v\n", program_name);
     printf("  %s -i file1.fq -o output.fq -p MYINST -r 100 -l 2\n", program_name);
+    printf("  %s -i file1.fq.gz -i file2.fq.gz -o merged.fq.gz -t 8\n", program_name);
+    printf("  %s -i lane1.fq.gz -i lane2.fq.gz -i lane3.fq.gz -o merged.fq.gz -j 3\n", program_name);
+    printf("  %s -i file1.fq -o output.fq --id-template '{prefix}.{n}'\n", program_name);
+    printf("  %s -i part1.fq.gz -i part2.fq.gz -o all.fq.gz --keep-ids --verify\n", program_name);
+    printf("  %s -i file1.fq.gz -i file2.fq.gz -o merged.fq.gz --validate=strict\n", program_name);
+}
+
+/* Parse a --validate level; returns 0 if it is not one */
+static int parse_validate_level(const char *text, ValidateLevel *level) {
+    if (strcmp(text, "none") == 0) {
+        *level = VALIDATE_NONE;
+    } else if (strcmp(text, "fast") == 0) {
+        *level = VALIDATE_FAST;
+    } else if (strcmp(text, "strict") == 0) {
+        *level = VALIDATE_STRICT;
+    } else {
+        return 0;
+    }
+    return 1;
 }
 
 void print_version() {
@@ -47,6 +82,14 @@ int main(int argc, char *argv[]) {
     char *run_id = NULL;
     char *flowcell_id = NULL;
     int lane = 0;
+    char *id_template = NULL;
+    int threads = 1;
+    int queue_depth = DEFAULT_QUEUE_DEPTH;
+    int jobs = 1;
+    int keep_ids = 0;
+    int verify = 0;
+    ValidateLevel validate = VALIDATE_FAST;
+    int validate_given = 0;
     int verbose = 0;
     
     /* Parse command line arguments */
@@ -111,6 +154,66 @@ int main(int argc, char *argv[]) {
                 free(input_files);
                 return ERR_INVALID_PARAM;
             }
+        } else if (strcmp(argv[i], "--id-template") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --id-template requires a string argument\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+            id_template = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -t/--threads requires an integer argument\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+            threads = atoi(argv[++i]);
+            if (threads <= 0) {
+                fprintf(stderr, "Error: Thread count must be a positive integer\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+        } else if (strcmp(argv[i], "--queue-depth") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --queue-depth requires an integer argument\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+            queue_depth = atoi(argv[++i]);
+            if (queue_depth <= 0) {
+                fprintf(stderr, "Error: Queue depth must be a positive integer\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -j/--jobs requires an integer argument\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+            jobs = atoi(argv[++i]);
+            if (jobs <= 0) {
+                fprintf(stderr, "Error: Job count must be a positive integer\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+        } else if (strcmp(argv[i], "--keep-ids") == 0) {
+            keep_ids = 1;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[i], "--validate") == 0 || strncmp(argv[i], "--validate=", 11) == 0) {
+            const char *level = NULL;
+            if (argv[i][10] == '=') {
+                level = argv[i] + 11;
+            } else if (i + 1 < argc) {
+                level = argv[++i];
+            }
+            if (level == NULL || !parse_validate_level(level, &validate)) {
+                fprintf(stderr, "Error: --validate requires none, fast or strict\n");
+                free(input_files);
+                return ERR_INVALID_PARAM;
+            }
+            validate_given = 1;
         } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
             verbose = 1;
         } else {
@@ -136,6 +239,41 @@ int main(int argc, char *argv[]) {
         return ERR_INVALID_PARAM;
     }
     
+    if (verify && validate == VALIDATE_NONE) {
+        fprintf(stderr, "Error: --verify cannot be combined with --validate=none\n");
+        free(input_files);
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (verify && !keep_ids) {
+        fprintf(stderr, "Error: --verify applies to --keep-ids (a normal merge always validates)\n");
+        free(input_files);
+        return ERR_INVALID_PARAM;
+    }
+    
+    /* --keep-ids copies the inputs in order without generating IDs */
+    if (keep_ids && (instrument_name != NULL || run_id != NULL || flowcell_id != NULL ||
+                     lane != 0 || id_template != NULL)) {
+        fprintf(stderr, "Error: -p, -r, -f, -l and --id-template set the generated IDs "
+                "and cannot be combined with --keep-ids\n");
+        free(input_files);
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (keep_ids && jobs > 1) {
+        fprintf(stderr, "Error: -j/--jobs cannot be combined with --keep-ids "
+                "(the inputs are copied one after another)\n");
+        free(input_files);
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (keep_ids && validate_given && !verify) {
+        fprintf(stderr, "Error: --validate with --keep-ids needs --verify "
+                "(the copied records are not parsed otherwise)\n");
+        free(input_files);
+        return ERR_INVALID_PARAM;
+    }
+    
     /* Validate input files exist */
     for (int i = 0; i < num_input_files; i++) {
         if (!file_exists(input_files[i])) {
@@ -167,12 +305,13 @@ int main(int argc, char *argv[]) {
     id_config.is_filtered = 'N';
     id_config.control_bits = 0;
     id_config.index_seq = NULL;
+    id_config.id_template = id_template;
     
     IdGenerator *id_gen = id_generator_init(&id_config);
     if (id_gen == NULL) {
-        fprintf(stderr, "Error: Failed to initialize ID generator\n");
+        /* id_generator_init has reported what was wrong with the template */
         free(input_files);
-        return ERR_MEMORY_ALLOC;
+        return ERR_INVALID_PARAM;
     }
     
     /* Create merger configuration */
@@ -182,6 +321,12 @@ int main(int argc, char *argv[]) {
     merger_config.output_file = output_file;
     merger_config.id_gen = id_gen;
     merger_config.verbose = verbose;
+    merger_config.threads = threads;
+    merger_config.queue_depth = queue_depth;
+    merger_config.jobs = jobs;
+    merger_config.keep_ids = keep_ids;
+    merger_config.verify = verify;
+    merger_config.validate = validate;
     
     /* Execute merge */
     MergerStats stats;
@@ -191,8 +336,19 @@ int main(int argc, char *argv[]) {
     if (result == SUCCESS) {
         printf("\nMerge completed successfully:\n");
         printf("  Files processed: %zu\n", stats.total_files);
-        printf("  Total sequences: %zu\n", stats.total_sequences);
+        if (keep_ids && !verify) {
+            printf("  Total sequences: not counted (use --verify)\n");
+        } else {
+            printf("  Total sequences: %zu\n", stats.total_sequences);
+        }
         printf("  Output file: %s\n", output_file);
+        if (verbose) {
+            AllocStats alloc;
+            alloc_stats_get(&alloc);
+            printf("  Arena blocks: %zu (%.1f MB, %.3f s to allocate)\n", alloc.arena_blocks,
+                   (double)alloc.arena_bytes / (1024.0 * 1024.0), alloc.arena_seconds);
+            printf("  Page faults: %ld minor, %ld major\n", alloc.minor_faults, alloc.major_faults);
+        }
     } else {
         fprintf(stderr, "\nMerge failed with error code: %d\n", result);
     }
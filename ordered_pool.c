@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ordered_pool.h"
+#include "utils.h"
+#include <string.h>
+#include <pthread.h>
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_READY,
+    SLOT_RUNNING,
+    SLOT_DONE
+} SlotState;
+
+typedef struct {
+    void *job;
+    SlotState state;
+    int result;
+} PoolSlot;
+
+struct OrderedPool {
+    PoolSlot *slots;
+    int num_slots;
+    OrderedPoolFn fn;
+    void *ctx;
+    
+    pthread_t *workers;
+    int num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   /* A job became ready, or shutdown */
+    pthread_cond_t done_cond;   /* A job finished, or the pool was closed */
+    pthread_cond_t free_cond;   /* A slot was released */
+    
+    size_t head;       /* Jobs submitted */
+    size_t dispatch;   /* Jobs handed to workers */
+    size_t tail;       /* Jobs released by the consumer */
+    int closed;
+    int shutdown;
+};
+
+static void* pool_worker(void *arg) {
+    OrderedPool *pool = arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->dispatch == pool->head && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->dispatch == pool->head) {
+            break;
+        }
+        
+        PoolSlot *slot = &pool->slots[pool->dispatch % (size_t)pool->num_slots];
+        pool->dispatch++;
+        slot->state = SLOT_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+        
+        int result = pool->fn(slot->job, pool->ctx);
+        
+        pthread_mutex_lock(&pool->lock);
+        slot->result = result;
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    return NULL;
+}
+
+OrderedPool* ordered_pool_create(int threads, void **jobs, int num_jobs,
+                                 OrderedPoolFn fn, void *ctx) {
+    if (jobs == NULL || num_jobs <= 0 || fn == NULL || threads < 0) {
+        return NULL;
+    }
+    
+    OrderedPool *pool = safe_malloc(sizeof(OrderedPool));
+    memset(pool, 0, sizeof(OrderedPool));
+    pool->slots = safe_malloc(sizeof(PoolSlot) * (size_t)num_jobs);
+    for (int i = 0; i < num_jobs; i++) {
+        pool->slots[i].job = jobs[i];
+        pool->slots[i].state = SLOT_FREE;
+        pool->slots[i].result = 0;
+    }
+    pool->num_slots = num_jobs;
+    pool->fn = fn;
+    pool->ctx = ctx;
+    
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pthread_cond_init(&pool->free_cond, NULL);
+    
+    if (threads > 0) {
+        pool->workers = safe_malloc(sizeof(pthread_t) * (size_t)threads);
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&pool->workers[i], NULL, pool_worker, pool) != 0) {
+                warning_msg("Could only start %d of %d worker threads", i, threads);
+                break;
+            }
+            pool->num_workers++;
+        }
+    }
+    
+    return pool;
+}
+
+void* ordered_pool_acquire(OrderedPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->head - pool->tail >= (size_t)pool->num_slots) {
+        pthread_cond_wait(&pool->free_cond, &pool->lock);
+    }
+    void *job = pool->slots[pool->head % (size_t)pool->num_slots].job;
+    pthread_mutex_unlock(&pool->lock);
+    
+    return job;
+}
+
+void ordered_pool_submit(OrderedPool *pool) {
+    PoolSlot *slot = &pool->slots[pool->head % (size_t)pool->num_slots];
+    
+    if (pool->num_workers == 0) {
+        /* No workers: run the job on the producer thread */
+        int result = pool->fn(slot->job, pool->ctx);
+        
+        pthread_mutex_lock(&pool->lock);
+        slot->result = result;
+        slot->state = SLOT_DONE;
+        pool->head++;
+        pool->dispatch++;
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    slot->state = SLOT_READY;
+    pool->head++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void ordered_pool_wait_idle(OrderedPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->tail < pool->head) {
+        pthread_cond_wait(&pool->free_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void ordered_pool_close(OrderedPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void* ordered_pool_next(OrderedPool *pool, int *result) {
+    void *job = NULL;
+    
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        if (pool->tail < pool->head) {
+            PoolSlot *slot = &pool->slots[pool->tail % (size_t)pool->num_slots];
+            if (slot->state == SLOT_DONE) {
+                job = slot->job;
+                if (result != NULL) {
+                    *result = slot->result;
+                }
+                break;
+            }
+        } else if (pool->closed) {
+            break;
+        }
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    return job;
+}
+
+void ordered_pool_release(OrderedPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->slots[pool->tail % (size_t)pool->num_slots].state = SLOT_FREE;
+    pool->tail++;
+    pthread_cond_signal(&pool->free_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void ordered_pool_destroy(OrderedPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+    
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->free_cond);
+    free(pool->workers);
+    free(pool->slots);
+    free(pool);
+}
@@ -0,0 +1,45 @@
+#ifndef ORDERED_POOL_H
+#define ORDERED_POOL_H
+
+/* Worker pool that runs jobs concurrently but hands them back in the order
+ * they were submitted.
+ *
+ * The caller owns a fixed set of job objects. One producer thread fills and
+ * submits them (acquire/submit), and one consumer thread takes the finished
+ * jobs in order (next/release). Holding at most num_jobs jobs in flight
+ * bounds the memory use.
+ */
+typedef struct OrderedPool OrderedPool;
+
+/* Job function run on a worker thread; the return value is passed to the consumer */
+typedef int (*OrderedPoolFn)(void *job, void *ctx);
+
+/* Create a pool with the given number of worker threads (0 runs jobs inline
+ * in ordered_pool_submit) over an array of num_jobs job objects. */
+OrderedPool* ordered_pool_create(int threads, void **jobs, int num_jobs,
+                                 OrderedPoolFn fn, void *ctx);
+
+/* Block until the next job object is free and return it for filling */
+void* ordered_pool_acquire(OrderedPool *pool);
+
+/* Queue the job returned by the last ordered_pool_acquire */
+void ordered_pool_submit(OrderedPool *pool);
+
+/* Block until every submitted job has been returned with
+ * ordered_pool_release (by the consumer thread) */
+void ordered_pool_wait_idle(OrderedPool *pool);
+
+/* Signal that no more jobs will be submitted */
+void ordered_pool_close(OrderedPool *pool);
+
+/* Block until the oldest job is finished and return it (with the job
+ * function's return value in *result); NULL once closed and drained. */
+void* ordered_pool_next(OrderedPool *pool, int *result);
+
+/* Return the job obtained from ordered_pool_next to the free set */
+void ordered_pool_release(OrderedPool *pool);
+
+/* Stop the workers and free the pool (job objects stay with the caller) */
+void ordered_pool_destroy(OrderedPool *pool);
+
+#endif /* ORDERED_POOL_H */
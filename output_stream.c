@@ -0,0 +1,549 @@
+#define _POSIX_C_SOURCE 200809L
+#include "output_stream.h"
+#include "ordered_pool.h"
+#include "bgzf.h"
+#include "utils.h"
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define PLAIN_BUFFERS 4
+#define JOBS_PER_THREAD 4
+
+struct OutputRegion {
+    size_t len;
+    off_t offset;             /* Plain output: file offset of the bytes */
+    off_t *block_offsets;     /* Compressed output: file offset of each stored block */
+    size_t num_blocks;
+    unsigned char *patch;     /* Replacement bytes, NULL if not patched */
+    struct OutputRegion *next;
+};
+
+/* One buffer on its way to the writer thread; for compressed output it
+ * first passes through the compression pool as one BGZF block */
+typedef struct {
+    unsigned char *data;      /* Bytes written by the caller */
+    size_t len;
+    unsigned char *block;     /* Compressed BGZF block (compressed output only) */
+    size_t block_len;
+    z_stream strm;            /* Deflate state reused across blocks */
+    int strm_ready;
+    OutputRegion *region;     /* Patchable region stored in this block, or NULL */
+    size_t region_block;      /* Index of this block within region */
+} OutputJob;
+
+struct OutputStream {
+    int fd;
+    char *filename;
+    int is_compressed;
+    
+    OrderedPool *pool;
+    OutputJob *jobs;
+    int num_jobs;
+    size_t job_size;          /* Bytes of data per job */
+    OutputJob *current;       /* Job being filled, NULL if none */
+    pthread_t writer;
+    int writer_started;
+    int write_error;          /* errno of the first failure, 0 if none */
+    off_t file_offset;        /* Bytes in the file; advanced by the writer */
+    
+    size_t bytes_in;          /* Uncompressed bytes accepted so far */
+    OutputRegion *regions;    /* Patchable regions, newest first */
+};
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const void *data, size_t len, off_t offset) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int get_error(OutputStream *stream) {
+    return __atomic_load_n(&stream->write_error, __ATOMIC_ACQUIRE);
+}
+
+static void set_error(OutputStream *stream, int err) {
+    int expected = 0;
+    __atomic_compare_exchange_n(&stream->write_error, &expected, err, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* Pool job: deflate one block */
+static int compress_job(void *job, void *ctx) {
+    OutputJob *oj = job;
+    (void)ctx;
+    
+    if (oj->region != NULL) {
+        /* Patchable bytes are stored so a patch keeps the block size */
+        oj->block_len = bgzf_store_block(oj->block, oj->data, oj->len);
+        return (oj->block_len > 0) ? 0 : -1;
+    }
+    
+    if (!oj->strm_ready) {
+        if (!bgzf_deflate_init(&oj->strm, Z_DEFAULT_COMPRESSION)) {
+            return -1;
+        }
+        oj->strm_ready = 1;
+    }
+    
+    oj->block_len = bgzf_compress_block(&oj->strm, oj->block, oj->data, oj->len);
+    return (oj->block_len > 0) ? 0 : -1;
+}
+
+/* Pool job for plain output: the buffer is written as is */
+static int plain_job(void *job, void *ctx) {
+    (void)job;
+    (void)ctx;
+    return 0;
+}
+
+/* Writer thread: write finished buffers in submission order, so the
+ * calling thread never blocks in write() while a buffer is free */
+static void* writer_thread(void *arg) {
+    OutputStream *stream = arg;
+    OutputJob *job;
+    int result;
+    
+    while ((job = ordered_pool_next(stream->pool, &result)) != NULL) {
+        if (get_error(stream) == 0) {
+            const void *data = stream->is_compressed ? job->block : job->data;
+            size_t len = stream->is_compressed ? job->block_len : job->len;
+            if (job->region != NULL) {
+                job->region->block_offsets[job->region_block] = stream->file_offset;
+            }
+            if (result != 0) {
+                set_error(stream, EIO);
+            } else if (write_all(stream->fd, data, len) != 0) {
+                set_error(stream, errno);
+            }
+            stream->file_offset += (off_t)len;
+        }
+        ordered_pool_release(stream->pool);
+    }
+    
+    return NULL;
+}
+
+/* Hand the buffer being filled to the pool */
+static void submit_current(OutputStream *stream) {
+    if (stream->current != NULL) {
+        ordered_pool_submit(stream->pool);
+        stream->current = NULL;
+    }
+}
+
+OutputStream* output_stream_open(const char *filename, int threads) {
+    if (filename == NULL) {
+        return NULL;
+    }
+    
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open output file '%s': %s\n",
+                filename, strerror(errno));
+        return NULL;
+    }
+    
+    OutputStream *stream = safe_malloc(sizeof(OutputStream));
+    memset(stream, 0, sizeof(OutputStream));
+    stream->fd = fd;
+    stream->filename = safe_strdup(filename);
+    
+    size_t name_len = strlen(filename);
+    stream->is_compressed = (name_len > 3 && strcmp(filename + name_len - 3, ".gz") == 0);
+    
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (stream->is_compressed) {
+        stream->num_jobs = threads * JOBS_PER_THREAD;
+        stream->job_size = BGZF_BLOCK_DATA_SIZE;
+    } else {
+        stream->num_jobs = PLAIN_BUFFERS;
+        stream->job_size = OUTPUT_BUFFER_SIZE;
+    }
+    
+    stream->jobs = safe_malloc(sizeof(OutputJob) * (size_t)stream->num_jobs);
+    void **job_ptrs = safe_malloc(sizeof(void *) * (size_t)stream->num_jobs);
+    for (int i = 0; i < stream->num_jobs; i++) {
+        memset(&stream->jobs[i], 0, sizeof(OutputJob));
+        stream->jobs[i].data = safe_malloc(stream->job_size);
+        if (stream->is_compressed) {
+            stream->jobs[i].block = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+        }
+        job_ptrs[i] = &stream->jobs[i];
+    }
+    if (stream->is_compressed) {
+        stream->pool = ordered_pool_create(threads, job_ptrs, stream->num_jobs, compress_job, NULL);
+    } else {
+        /* No workers: buffers go straight from the caller to the writer */
+        stream->pool = ordered_pool_create(0, job_ptrs, stream->num_jobs, plain_job, NULL);
+    }
+    free(job_ptrs);
+    
+    int err = pthread_create(&stream->writer, NULL, writer_thread, stream);
+    if (err != 0) {
+        fprintf(stderr, "Error: Cannot start writer thread for '%s': %s\n",
+                filename, strerror(err));
+        output_stream_close(stream);
+        return NULL;
+    }
+    stream->writer_started = 1;
+    
+    return stream;
+}
+
+int output_stream_write(OutputStream *stream, const void *data, size_t len) {
+    if (stream == NULL || (data == NULL && len > 0)) {
+        errno = EINVAL;
+        return ERR_INVALID_PARAM;
+    }
+    
+    const char *p = data;
+    
+    while (len > 0) {
+        if (stream->current == NULL) {
+            int err = get_error(stream);
+            if (err != 0) {
+                errno = err;
+                return ERR_FILE_WRITE;
+            }
+            stream->current = ordered_pool_acquire(stream->pool);
+            stream->current->len = 0;
+            stream->current->region = NULL;
+        }
+        
+        size_t n = stream->job_size - stream->current->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(stream->current->data + stream->current->len, p, n);
+        stream->current->len += n;
+        stream->bytes_in += n;
+        p += n;
+        len -= n;
+        
+        if (stream->current->len == stream->job_size) {
+            submit_current(stream);
+        }
+    }
+    
+    return SUCCESS;
+}
+
+int output_stream_writev(OutputStream *stream, const struct iovec *iov, int iovcnt) {
+    if (stream == NULL || iov == NULL || iovcnt < 0) {
+        errno = EINVAL;
+        return ERR_INVALID_PARAM;
+    }
+    
+    /* Common case: the whole record fits in the current buffer */
+    OutputJob *job = stream->current;
+    if (job != NULL) {
+        size_t total = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            total += iov[i].iov_len;
+        }
+        if (job->len + total < stream->job_size) {
+            for (int i = 0; i < iovcnt; i++) {
+                memcpy(job->data + job->len, iov[i].iov_base, iov[i].iov_len);
+                job->len += iov[i].iov_len;
+            }
+            stream->bytes_in += total;
+            return SUCCESS;
+        }
+    }
+    
+    for (int i = 0; i < iovcnt; i++) {
+        int result = output_stream_write(stream, iov[i].iov_base, iov[i].iov_len);
+        if (result != SUCCESS) {
+            return result;
+        }
+    }
+    return SUCCESS;
+}
+
+/* Let the writer finish, then copy len bytes from in_fd straight to the
+ * end of the file */
+static int copy_to_file(OutputStream *stream, int in_fd, size_t len) {
+    submit_current(stream);
+    ordered_pool_wait_idle(stream->pool);
+    int err = get_error(stream);
+    if (err != 0) {
+        errno = err;
+        return ERR_FILE_WRITE;
+    }
+    
+    int result = copy_fd_range(in_fd, stream->fd, len);
+    if (result != SUCCESS) {
+        set_error(stream, errno);
+        return result;
+    }
+    stream->file_offset += (off_t)len;
+    return SUCCESS;
+}
+
+/* Read up to len bytes from in_fd (less only at its end) and write them */
+static int copy_through(OutputStream *stream, int in_fd, size_t len, size_t *copied) {
+    unsigned char *buffer = safe_malloc(OUTPUT_BUFFER_SIZE);
+    int result = SUCCESS;
+    *copied = 0;
+    while (*copied < len) {
+        size_t want = len - *copied;
+        ssize_t n = read(in_fd, buffer, (want < OUTPUT_BUFFER_SIZE) ? want : OUTPUT_BUFFER_SIZE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            result = ERR_FILE_READ;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        result = output_stream_write(stream, buffer, (size_t)n);
+        if (result != SUCCESS) {
+            break;
+        }
+        *copied += (size_t)n;
+    }
+    free(buffer);
+    return result;
+}
+
+int output_stream_append_fd(OutputStream *stream, int in_fd) {
+    if (stream == NULL || in_fd < 0) {
+        errno = EINVAL;
+        return ERR_INVALID_PARAM;
+    }
+    
+    struct stat st;
+    off_t pos = lseek(in_fd, 0, SEEK_CUR);
+    if (!stream->is_compressed && pos >= 0 && fstat(in_fd, &st) == 0 &&
+        S_ISREG(st.st_mode) && st.st_size >= pos) {
+        return output_stream_copy_fd(stream, in_fd, (size_t)(st.st_size - pos));
+    }
+    
+    size_t copied;
+    return copy_through(stream, in_fd, SIZE_MAX, &copied);
+}
+
+int output_stream_copy_fd(OutputStream *stream, int in_fd, size_t len) {
+    if (stream == NULL || in_fd < 0) {
+        errno = EINVAL;
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (!stream->is_compressed) {
+        int result = copy_to_file(stream, in_fd, len);
+        if (result == SUCCESS) {
+            stream->bytes_in += len;
+        }
+        return result;
+    }
+    
+    size_t copied;
+    int result = copy_through(stream, in_fd, len, &copied);
+    if (result == SUCCESS && copied < len) {
+        errno = EIO;  /* Source ended early */
+        result = ERR_FILE_READ;
+    }
+    return result;
+}
+
+int output_stream_copy_blocks(OutputStream *stream, int in_fd, size_t len) {
+    if (stream == NULL || in_fd < 0 || !stream->is_compressed) {
+        errno = EINVAL;
+        return ERR_INVALID_PARAM;
+    }
+    return copy_to_file(stream, in_fd, len);
+}
+
+OutputRegion* output_stream_write_patchable(OutputStream *stream, const void *data, size_t len) {
+    if (stream == NULL || (data == NULL && len > 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    OutputRegion *region = safe_malloc(sizeof(OutputRegion));
+    memset(region, 0, sizeof(OutputRegion));
+    region->len = len;
+    region->offset = (off_t)stream->bytes_in;
+    region->next = stream->regions;
+    stream->regions = region;
+    
+    if (!stream->is_compressed) {
+        /* Uncompressed bytes sit at their stream offset in the file */
+        return (output_stream_write(stream, data, len) == SUCCESS) ? region : NULL;
+    }
+    
+    /* Close the block being filled so the region starts a block of its own */
+    if (stream->current != NULL && stream->current->len > 0) {
+        submit_current(stream);
+    }
+    
+    region->num_blocks = (len + BGZF_BLOCK_DATA_SIZE - 1) / BGZF_BLOCK_DATA_SIZE;
+    region->block_offsets = safe_malloc(sizeof(off_t) * (region->num_blocks + 1));
+    
+    const unsigned char *p = data;
+    for (size_t b = 0; b < region->num_blocks; b++) {
+        if (stream->current == NULL) {
+            int err = get_error(stream);
+            if (err != 0) {
+                errno = err;
+                return NULL;
+            }
+            stream->current = ordered_pool_acquire(stream->pool);
+        }
+        
+        size_t n = (len < BGZF_BLOCK_DATA_SIZE) ? len : BGZF_BLOCK_DATA_SIZE;
+        memcpy(stream->current->data, p, n);
+        stream->current->len = n;
+        stream->current->region = region;
+        stream->current->region_block = b;
+        submit_current(stream);
+        
+        stream->bytes_in += n;
+        p += n;
+        len -= n;
+    }
+    
+    return region;
+}
+
+int output_stream_patch(OutputStream *stream, OutputRegion *region, const void *data) {
+    if (stream == NULL || region == NULL || (data == NULL && region->len > 0)) {
+        errno = EINVAL;
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (region->patch == NULL) {
+        region->patch = safe_malloc(region->len + 1);
+    }
+    memcpy(region->patch, data, region->len);
+    return SUCCESS;
+}
+
+/* Overwrite patched regions in the finished file */
+static void apply_patches(OutputStream *stream) {
+    unsigned char *block = stream->is_compressed ? safe_malloc(BGZF_MAX_BLOCK_SIZE) : NULL;
+    
+    for (OutputRegion *region = stream->regions;
+         region != NULL && get_error(stream) == 0; region = region->next) {
+        if (region->patch == NULL) {
+            continue;
+        }
+        
+        if (!stream->is_compressed) {
+            if (pwrite_all(stream->fd, region->patch, region->len, region->offset) != 0) {
+                set_error(stream, errno);
+            }
+            continue;
+        }
+        
+        /* Rebuild each stored block; its size is unchanged */
+        for (size_t b = 0; b < region->num_blocks; b++) {
+            size_t start = b * BGZF_BLOCK_DATA_SIZE;
+            size_t n = region->len - start;
+            if (n > BGZF_BLOCK_DATA_SIZE) {
+                n = BGZF_BLOCK_DATA_SIZE;
+            }
+            size_t block_len = bgzf_store_block(block, region->patch + start, n);
+            if (pwrite_all(stream->fd, block, block_len, region->block_offsets[b]) != 0) {
+                set_error(stream, errno);
+                break;
+            }
+        }
+    }
+    
+    free(block);
+}
+
+int output_stream_is_compressed(const OutputStream *stream) {
+    return (stream != NULL && stream->is_compressed);
+}
+
+int output_stream_close(OutputStream *stream) {
+    if (stream == NULL) {
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (stream->current != NULL && stream->current->len > 0) {
+        submit_current(stream);
+    }
+    if (stream->pool != NULL) {
+        ordered_pool_close(stream->pool);
+    }
+    if (stream->writer_started) {
+        pthread_join(stream->writer, NULL);
+    }
+    ordered_pool_destroy(stream->pool);
+    for (int i = 0; i < stream->num_jobs; i++) {
+        if (stream->jobs[i].strm_ready) {
+            deflateEnd(&stream->jobs[i].strm);
+        }
+        free(stream->jobs[i].data);
+        free(stream->jobs[i].block);
+    }
+    free(stream->jobs);
+    
+    /* Every block is on disk now, so patched regions can be rewritten */
+    apply_patches(stream);
+    while (stream->regions != NULL) {
+        OutputRegion *next = stream->regions->next;
+        free(stream->regions->block_offsets);
+        free(stream->regions->patch);
+        free(stream->regions);
+        stream->regions = next;
+    }
+    
+    if (stream->is_compressed && get_error(stream) == 0 &&
+        write_all(stream->fd, BGZF_EOF_BLOCK, BGZF_EOF_SIZE) != 0) {
+        set_error(stream, errno);
+    }
+    
+    if (close(stream->fd) != 0) {
+        set_error(stream, errno);
+    }
+    
+    int err = get_error(stream);
+    free(stream->filename);
+    free(stream);
+    
+    if (err != 0) {
+        errno = err;
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
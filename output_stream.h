@@ -0,0 +1,68 @@
+#ifndef OUTPUT_STREAM_H
+#define OUTPUT_STREAM_H
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+/* Buffered output to a plain file, or to a BGZF-compressed file when the
+ * name ends in ".gz".
+ *
+ * Writes are copied into buffers that a dedicated writer thread drains, so
+ * the caller keeps working while the file system is busy. Plain output
+ * fills 1 MB buffers with at most four in flight.
+ *
+ * Compressed output is deflated in independent 64 KB blocks on a pool of
+ * worker threads and written in order by the writer thread. The result is a
+ * multi-member gzip file readable by gzip, zcat and htslib.
+ */
+typedef struct OutputStream OutputStream;
+
+/* Open filename for writing with the given number of compression threads
+ * (used for .gz output only); returns NULL after printing an error. */
+OutputStream* output_stream_open(const char *filename, int threads);
+
+/* Append len bytes; returns SUCCESS or ERR_FILE_WRITE (errno is set) */
+int output_stream_write(OutputStream *stream, const void *data, size_t len);
+
+/* Append the iovcnt pieces of iov in order, e.g. the lines of one record;
+ * returns SUCCESS or ERR_FILE_WRITE (errno is set) */
+int output_stream_writev(OutputStream *stream, const struct iovec *iov, int iovcnt);
+
+/* Append everything from in_fd's current offset to its end. Plain output
+ * waits for the queued buffers and then copies with copy_file_range() where
+ * possible; compressed output reads and compresses the bytes. Returns
+ * SUCCESS or an error code (errno is set). */
+int output_stream_append_fd(OutputStream *stream, int in_fd);
+
+/* Append len bytes from in_fd's current offset, the same way as
+ * output_stream_append_fd(); returns SUCCESS or an error code (errno is
+ * set), ERR_FILE_READ if in_fd ends early. */
+int output_stream_copy_fd(OutputStream *stream, int in_fd, size_t len);
+
+/* Compressed output only: append len bytes of whole BGZF blocks from
+ * in_fd's current offset as they are, without recompressing them. The
+ * blocks start after the data written so far, which is flushed as a
+ * (possibly short) block first. Returns SUCCESS or an error code (errno
+ * is set). */
+int output_stream_copy_blocks(OutputStream *stream, int in_fd, size_t len);
+
+/* Bytes written with output_stream_write_patchable() */
+typedef struct OutputRegion OutputRegion;
+
+/* Append len bytes that can later be overwritten with output_stream_patch().
+ * Compressed output stores them uncompressed in blocks of their own, so a
+ * patch never changes the size of the file. The region belongs to the
+ * stream; returns NULL (errno set) on error. */
+OutputRegion* output_stream_write_patchable(OutputStream *stream, const void *data, size_t len);
+
+/* Replace the bytes of region with data of the same length. Patches are
+ * applied when the stream is closed; a later patch of a region wins. */
+int output_stream_patch(OutputStream *stream, OutputRegion *region, const void *data);
+
+/* Non-zero if output is compressed */
+int output_stream_is_compressed(const OutputStream *stream);
+
+/* Flush, finish and close the file; returns SUCCESS or ERR_FILE_WRITE */
+int output_stream_close(OutputStream *stream);
+
+#endif /* OUTPUT_STREAM_H */
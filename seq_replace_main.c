@@ -21,10 +21,24 @@ void print_usage(const char *program_name) {
     printf("  -p, --position <pos>   Position mode: replace at position <pos> in all sequences\n");
     printf("                         (0-based position)\n");
     printf("  -1, --single <n> <pos> Single mode: replace only read #n at position <pos>\n");
-    printf("                         (read number is 1-based, position is 0-based)\n\n");
+    printf("                         (read number is 1-based, position is 0-based)\n");
+    printf("  -e, --edits <file>     Edits mode: apply the edits listed in <file>, one\n");
+    printf("                         '<read> <position> <sequence>' per line, where <read>\n");
+    printf("                         is a 1-based read number or a read ID (-s not needed)\n\n");
     printf("Optional arguments:\n");
     printf("  -l, --log <file>       Log file for replacement records (default: replacements.log)\n");
     printf("  --seed <n>             Random seed for reproducibility (default: current time)\n");
+    printf("  -t, --threads <int>    Threads for position mode, .gz output and BGZF input\n");
+    printf("                         (default: 1)\n");
+    printf("  -x, --index            FASTQ in single, random or read-number edits mode:\n");
+    printf("                         seek to the reads through <input>.fqi (built and\n");
+    printf("                         saved on first use) and copy the rest unparsed;\n");
+    printf("                         uncompressed FASTA in any mode: patch only the\n");
+    printf("                         replaced bases through <input>.fai, keeping the\n");
+    printf("                         rest byte for byte (records without sequence and\n");
+    printf("                         blank lines too, which streaming drops)\n");
+    printf("  --in-place             Uncompressed FASTA: patch the input file itself\n");
+    printf("                         through its .fai index (implies -x, no -o)\n");
     printf("  -v, --verbose          Verbose output mode\n");
     printf("  -h, --help             Display help information\n");
     printf("  --version              Display version information\n\n");
@@ -37,8 +51,16 @@ void print_usage(const char *program_name) {
     printf("  %s -i input.fq.gz -o output.fq.gz -s ATCGATCG -r -v\n\n", program_name);
     printf("  # Replace at position 50 in all sequences with multiple sequences\n");
     printf("  %s -i input.fa -o output.fa -s NNNNNNNN -s XXXXXXXX -p 50 -l changes.log\n\n", program_name);
+    printf("  # Position mode on 8 threads\n");
+    printf("  %s -i input.fq.gz -o output.fq.gz -s NNNNNNNN -p 50 -t 8\n\n", program_name);
     printf("  # Reproducible random replacement with seed\n");
-    printf("  %s -i input.fq -o output.fq -s GCGCGCGC -r --seed 12345\n", program_name);
+    printf("  %s -i input.fq -o output.fq -s GCGCGCGC -r --seed 12345\n\n", program_name);
+    printf("  # Spike in many edits listed in a file\n");
+    printf("  %s -i input.fq.gz -o output.fq.gz -e edits.txt\n\n", program_name);
+    printf("  # Replace read #5000000 of a BGZF file through its index\n");
+    printf("  %s -i input.fq.gz -o output.fq.gz -s ATCGATCG -1 5000000 10 -x\n\n", program_name);
+    printf("  # Patch edits into a copy of a reference genome without rewriting it\n");
+    printf("  cp genome.fa patched.fa && %s -i patched.fa -e edits.txt --in-place\n", program_name);
 }
 
 void print_version() {
@@ -54,13 +76,18 @@ int main(int argc, char *argv[]) {
     /* Variables for command line arguments */
     char *input_file = NULL;
     char *output_file = NULL;
-    char **replacement_seqs = safe_malloc(sizeof(char*) * 100);  /* Max 100 sequences */
+    int seqs_capacity = 16;
+    char **replacement_seqs = safe_malloc(sizeof(char*) * seqs_capacity);
     int num_replacement_seqs = 0;
+    char *edits_file = NULL;
     char *log_file = "replacements.log";
     ReplacementMode mode = MODE_RANDOM;
     size_t position = 0;
     size_t target_read_index = 1;
     int verbose = 0;
+    int threads = 1;
+    int use_index = 0;
+    int in_place = 0;
     unsigned int seed = (unsigned int)time(NULL);
     int mode_set = 0;
     
@@ -90,10 +117,9 @@ int main(int argc, char *argv[]) {
                 free(replacement_seqs);
                 return ERR_INVALID_PARAM;
             }
-            if (num_replacement_seqs >= 100) {
-                fprintf(stderr, "Error: Too many replacement sequences (max 100)\n");
-                free(replacement_seqs);
-                return ERR_INVALID_PARAM;
+            if (num_replacement_seqs == seqs_capacity) {
+                seqs_capacity *= 2;
+                replacement_seqs = safe_realloc(replacement_seqs, sizeof(char*) * seqs_capacity);
             }
             replacement_seqs[num_replacement_seqs++] = argv[++i];
         } else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--random") == 0) {
@@ -128,6 +154,14 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Error: Read number must be >= 1\n");
                 return ERR_INVALID_PARAM;
             }
+        } else if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--edits") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -e/--edits requires a file argument\n");
+                return ERR_INVALID_PARAM;
+            }
+            mode = MODE_EDITS;
+            edits_file = argv[++i];
+            mode_set = 1;
         } else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--log") == 0) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "Error: -l/--log requires a file argument\n");
@@ -140,6 +174,21 @@ int main(int argc, char *argv[]) {
                 return ERR_INVALID_PARAM;
             }
             seed = (unsigned int)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -t/--threads requires an integer argument\n");
+                return ERR_INVALID_PARAM;
+            }
+            threads = atoi(argv[++i]);
+            if (threads <= 0) {
+                fprintf(stderr, "Error: Thread count must be a positive integer\n");
+                return ERR_INVALID_PARAM;
+            }
+        } else if (strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "--index") == 0) {
+            use_index = 1;
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            in_place = 1;
+            use_index = 1;
         } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
             verbose = 1;
         } else {
@@ -156,13 +205,25 @@ int main(int argc, char *argv[]) {
         return ERR_INVALID_PARAM;
     }
     
-    if (output_file == NULL) {
+    if (in_place && output_file != NULL) {
+        fprintf(stderr, "Error: --in-place cannot be combined with -o/--output\n");
+        free(replacement_seqs);
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (output_file == NULL && !in_place) {
         fprintf(stderr, "Error: Output file must be specified\n");
         print_usage(argv[0]);
         return ERR_INVALID_PARAM;
     }
     
-    if (num_replacement_seqs == 0) {
+    if (mode == MODE_EDITS && num_replacement_seqs > 0) {
+        fprintf(stderr, "Error: -s/--sequence cannot be combined with -e/--edits\n");
+        free(replacement_seqs);
+        return ERR_INVALID_PARAM;
+    }
+    
+    if (num_replacement_seqs == 0 && mode != MODE_EDITS) {
         fprintf(stderr, "Error: At least one replacement sequence must be specified\n");
         print_usage(argv[0]);
         free(replacement_seqs);
@@ -170,7 +231,7 @@ int main(int argc, char *argv[]) {
     }
     
     if (!mode_set) {
-        fprintf(stderr, "Error: Must specify either -r/--random, -p/--position, or -1/--single\n");
+        fprintf(stderr, "Error: Must specify either -r/--random, -p/--position, -1/--single, or -e/--edits\n");
         print_usage(argv[0]);
         return ERR_INVALID_PARAM;
     }
@@ -192,23 +253,36 @@ int main(int argc, char *argv[]) {
     config.position = position;
     config.target_read_index = target_read_index;
     config.total_reads = 0;
+    config.edits_file = edits_file;
     config.verbose = verbose;
     config.seed = seed;
+    config.threads = threads;
+    config.use_index = use_index;
+    config.in_place = in_place;
     
     /* Print configuration */
     if (verbose) {
         printf("Configuration:\n");
         printf("  Input: %s\n", input_file);
-        printf("  Output: %s\n", output_file);
-        printf("  Replacement sequences (%d): ", num_replacement_seqs);
-        for (int i = 0; i < num_replacement_seqs; i++) {
-            printf("%s%s", replacement_seqs[i], i < num_replacement_seqs - 1 ? ", " : "\n");
+        if (in_place) {
+            printf("  Output: %s (in place)\n", input_file);
+        } else {
+            printf("  Output: %s\n", output_file);
+        }
+        if (mode != MODE_EDITS) {
+            printf("  Replacement sequences (%d): ", num_replacement_seqs);
+            for (int i = 0; i < num_replacement_seqs; i++) {
+                printf("%s%s", replacement_seqs[i], i < num_replacement_seqs - 1 ? ", " : "\n");
+            }
         }
         printf("  Mode: %s\n", 
                mode == MODE_SINGLE ? "Single" : 
                (mode == MODE_RANDOM ? "Random" : 
-               (mode == MODE_RANDOM_FIXED ? "Random-Fixed" : "Position")));
-        if (mode == MODE_SINGLE) {
+               (mode == MODE_RANDOM_FIXED ? "Random-Fixed" : 
+               (mode == MODE_EDITS ? "Edits" : "Position"))));
+        if (mode == MODE_EDITS) {
+            printf("  Edits file: %s\n", edits_file);
+        } else if (mode == MODE_SINGLE) {
             printf("  Target read: #%zu\n", target_read_index);
             printf("  Position in read: %zu\n", position);
         } else if (mode == MODE_RANDOM) {
@@ -219,6 +293,7 @@ int main(int argc, char *argv[]) {
         } else {
             printf("  Position: %zu\n", position);
         }
+        printf("  Threads: %d\n", threads);
         printf("  Log file: %s\n\n", log_file);
     }
     
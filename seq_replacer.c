@@ -2,9 +2,22 @@
 #include "seq_replacer.h"
 #include "utils.h"
 #include "fastq_parser.h"
+#include "fasta_parser.h"
+#include "input_stream.h"
+#include "output_stream.h"
+#include "edit_set.h"
+#include "ordered_pool.h"
+#include "fastq_index.h"
+#include "fasta_index.h"
+#include "bgzf.h"
+#include <errno.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 int is_fasta_file(const char *filename) {
     size_t len = strlen(filename);
@@ -52,23 +65,40 @@ int is_fastq_file(const char *filename) {
     return 0;
 }
 
-/* Replace sequence at specified position */
-static char* replace_at_position(const char *original, const char *replacement, 
-                                 size_t position, size_t *actual_pos) {
-    size_t orig_len = strlen(original);
-    size_t repl_len = strlen(replacement);
-    
-    if (position + repl_len > orig_len) {
-        /* Replacement would exceed sequence length */
-        *actual_pos = 0;
-        return NULL;
+/* Reusable buffer holding the original bytes of the last replaced segment */
+typedef struct {
+    char *data;
+    size_t capacity;
+} SegmentBuffer;
+
+/* Overwrite len bytes of seq at position with replacement, in place.
+ * The bytes it covered are saved in saved (NUL-terminated) and returned. */
+static const char* replace_segment(SegmentBuffer *saved, char *seq, size_t position,
+                                   const char *replacement, size_t len) {
+    if (len + 1 > saved->capacity) {
+        saved->capacity = (len + 1) * 2;
+        saved->data = safe_realloc(saved->data, saved->capacity);
     }
-    
-    char *result = safe_strdup(original);
-    memcpy(result + position, replacement, repl_len);
-    *actual_pos = position;
-    
-    return result;
+    memcpy(saved->data, seq + position, len);
+    saved->data[len] = '\0';
+    memcpy(seq + position, replacement, len);
+    return saved->data;
+}
+
+/* Growable byte buffer */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} ByteBuffer;
+
+static inline void buffer_append(ByteBuffer *buf, const void *src, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        buf->capacity = (buf->len + len) * 2;
+        buf->data = safe_realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->len, src, len);
+    buf->len += len;
 }
 
 /* Find random valid position for replacement */
@@ -85,6 +115,27 @@ static size_t find_random_position(size_t seq_len, size_t repl_len) {
     return rand() % (max_pos + 1);
 }
 
+/* Write one FASTQ record; returns SUCCESS or ERR_FILE_WRITE */
+static int write_fastq(OutputStream *out, const FastqRecord *record) {
+    struct iovec parts[9] = {
+        { (void *)"@", 1 },
+        { record->seq_id, record->seq_id_len },
+        { (void *)"\n", 1 },
+        { record->sequence, record->sequence_len },
+        { (void *)"\n", 1 },
+        { record->plus_line, record->plus_line_len },
+        { (void *)"\n", 1 },
+        { record->quality, record->quality_len },
+        { (void *)"\n", 1 }
+    };
+    
+    if (output_stream_writev(out, parts, 9) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
+
 /* Log replacement to file */
 static void log_replacement(FILE *log_fp, const ReplacementRecord *record) {
     fprintf(log_fp, "Sequence ID: %s\n", record->seq_id);
@@ -94,508 +145,2326 @@ static void log_replacement(FILE *log_fp, const ReplacementRecord *record) {
     fprintf(log_fp, "---\n");
 }
 
-/* Process FASTQ file */
-static int process_fastq(const ReplacerConfig *config) {
-    size_t *random_read_indices = NULL;
-    size_t *random_positions = NULL;
-    int num_to_replace = config->num_replacements;
+/* Log a replacement and print it in verbose mode */
+static void report_replacement(const ReplacerConfig *config, FILE *log_fp, const char *seq_id,
+                               size_t position, const char *original, const char *replacement) {
+    if (log_fp != NULL) {
+        ReplacementRecord rep_record;
+        rep_record.seq_id = (char *)seq_id;
+        rep_record.position = position;
+        rep_record.original_seq = (char *)original;
+        rep_record.new_seq = (char *)replacement;
+        log_replacement(log_fp, &rep_record);
+    }
+    
+    if (config->verbose) {
+        printf("Replaced in %s at position %zu: %s -> %s\n",
+               seq_id, position, original, replacement);
+    }
+}
+
+/* A read chosen by reservoir sampling. Until the input ends another read
+ * may take its slot, so its bytes are written patchable and the
+ * replacement is applied to the output afterwards. */
+typedef struct {
+    size_t record_index;      /* 1-based record number, 0 while the slot is empty */
+    int seq_number;           /* Replacement sequence used (1-based) */
+    char *seq_id;
+    size_t position;
+    const char *replacement;
+    size_t replacement_len;
+    char *original;           /* Bytes at position, NULL if the replacement does not fit */
+    OutputRegion *region;     /* Output bytes at position */
+    char *region_text;        /* FASTA: those bytes with their line breaks, NULL if none */
+} SampledRead;
+
+/* Uniform random value in [0, n), also for n above RAND_MAX */
+static size_t random_below(size_t n) {
+    unsigned long long r = ((unsigned long long)rand() << 31) ^ (unsigned long long)rand();
+    return (size_t)(r % n);
+}
+
+/* Reservoir sampling step for record n (1-based) with the given number of
+ * slots: returns the slot the record takes over, or -1 to pass it by */
+static int reservoir_slot(size_t n, int slots) {
+    if (n <= (size_t)slots) {
+        return (int)(n - 1);
+    }
+    size_t j = random_below(n);
+    return (j < (size_t)slots) ? (int)j : -1;
+}
+
+/* Put the current read in a sample slot */
+static void begin_sample(SampledRead *sample, size_t record_index, int seq_number,
+                         const char *replacement, size_t repl_len, const char *seq_id) {
+    free(sample->seq_id);
+    free(sample->original);
+    free(sample->region_text);
     
-    /* Allocate arrays for multiple replacements */
-    random_read_indices = safe_malloc(sizeof(size_t) * num_to_replace);
-    random_positions = safe_malloc(sizeof(size_t) * num_to_replace);
+    sample->record_index = record_index;
+    sample->seq_number = seq_number;
+    sample->seq_id = safe_strdup(seq_id);
+    sample->replacement = replacement;
+    sample->replacement_len = repl_len;
+    sample->original = NULL;
+    sample->region = NULL;
+    sample->region_text = NULL;
+}
+
+/* Put the current read in a sample slot and pick where its replacement goes */
+static void sample_read(SampledRead *sample, size_t record_index, int seq_number,
+                        const char *replacement, size_t repl_len, int random_position,
+                        size_t position, const char *seq_id, const char *seq, size_t seq_len) {
+    begin_sample(sample, record_index, seq_number, replacement, repl_len, seq_id);
     
-    /* For random modes: quickly count reads and select multiple random reads */
-    if (config->mode == MODE_RANDOM || config->mode == MODE_RANDOM_FIXED) {
-        char command[2048];
-        FILE *wc_fp;
-        
-        if (strstr(config->input_file, ".gz") != NULL) {
-            snprintf(command, sizeof(command), "gzip -dc '%s' | wc -l", config->input_file);
-        } else {
-            snprintf(command, sizeof(command), "wc -l < '%s'", config->input_file);
+    sample->position = random_position ? find_random_position(seq_len, repl_len) : position;
+    if (seq_len >= sample->position + repl_len) {
+        sample->original = safe_malloc(repl_len + 1);
+        memcpy(sample->original, seq + sample->position, repl_len);
+        sample->original[repl_len] = '\0';
+    }
+}
+
+static int compare_samples(const void *a, const void *b) {
+    const SampledRead *x = a;
+    const SampledRead *y = b;
+    return (x->record_index > y->record_index) - (x->record_index < y->record_index);
+}
+
+/* Apply the replacements of the final sample (sorted by read) to the
+ * output and log them; returns the number of replacements */
+static size_t apply_samples(const ReplacerConfig *config, OutputStream *out, FILE *log_fp,
+                            SampledRead *samples, int num_samples, int show_seq_number) {
+    size_t count = 0;
+    
+    for (int i = 0; i < num_samples; i++) {
+        SampledRead *sample = &samples[i];
+        if (sample->region == NULL) {
+            continue;
         }
         
-        wc_fp = popen(command, "r");
-        if (wc_fp != NULL) {
-            size_t total_lines = 0;
-            if (fscanf(wc_fp, "%zu", &total_lines) == 1) {
-                size_t total_reads = total_lines / 4;  /* FASTQ has 4 lines per read */
-                if (total_reads > 0) {
-                    /* Select multiple random reads (one for each replacement sequence) */
-                    for (int i = 0; i < num_to_replace; i++) {
-                        random_read_indices[i] = (rand() % total_reads) + 1;
-                        random_positions[i] = 0;  /* Will be set later if needed */
-                    }
-                    if (config->verbose) {
-                        printf("Random mode: selected %d reads out of %zu total reads: ", 
-                               num_to_replace, total_reads);
-                        for (int i = 0; i < num_to_replace; i++) {
-                            printf("#%zu%s", random_read_indices[i], 
-                                   i < num_to_replace - 1 ? ", " : "\n");
-                        }
-                    }
+        if (sample->region_text != NULL) {
+            /* Put the replacement between the line breaks of the region */
+            const char *src = sample->replacement;
+            for (char *p = sample->region_text; *p != '\0'; p++) {
+                if (*p != '\n') {
+                    *p = *src++;
                 }
             }
-            pclose(wc_fp);
+            output_stream_patch(out, sample->region, sample->region_text);
+        } else {
+            output_stream_patch(out, sample->region, sample->replacement);
         }
         
-        if (random_read_indices[0] == 0) {
-            fprintf(stderr, "Error: Could not count reads in input file\n");
-            free(random_read_indices);
-            free(random_positions);
-            return ERR_INVALID_FORMAT;
+        if (log_fp != NULL) {
+            ReplacementRecord rep_record;
+            rep_record.seq_id = sample->seq_id;
+            rep_record.position = sample->position;
+            rep_record.original_seq = sample->original;
+            rep_record.new_seq = (char *)sample->replacement;
+            log_replacement(log_fp, &rep_record);
         }
+        
+        if (config->verbose) {
+            printf("Replaced in %s at position %zu: %s -> %s",
+                   sample->seq_id, sample->position, sample->original, sample->replacement);
+            if (show_seq_number) {
+                printf(" (seq #%d)\n", sample->seq_number);
+            } else {
+                printf("\n");
+            }
+        }
+        count++;
     }
     
-    /* Open input file for processing */
-    FastqReader *reader = fastq_reader_open(config->input_file);
-    if (reader == NULL) {
-        return ERR_FILE_OPEN;
+    return count;
+}
+
+static void free_samples(SampledRead *samples, int num_samples) {
+    if (samples == NULL) {
+        return;
     }
-    
-    /* Open output file */
-    FILE *out_fp = NULL;
-    int is_output_pipe = 0;
-    
-    if (strstr(config->output_file, ".gz") != NULL) {
-        char command[2048];
-        snprintf(command, sizeof(command), "gzip -c > '%s'", config->output_file);
-        out_fp = popen(command, "w");
-        is_output_pipe = 1;
-    } else {
-        out_fp = fopen(config->output_file, "w");
+    for (int i = 0; i < num_samples; i++) {
+        free(samples[i].seq_id);
+        free(samples[i].original);
+        free(samples[i].region_text);
     }
-    
-    if (out_fp == NULL) {
-        fastq_reader_close(reader);
-        return ERR_FILE_OPEN;
+    free(samples);
+}
+
+/* Write a sampled FASTQ record, with the bytes its replacement would cover
+ * as a patchable region */
+static int write_fastq_sampled(OutputStream *out, const FastqRecord *record, SampledRead *sample) {
+    if (sample->original == NULL) {
+        return write_fastq(out, record);
     }
     
-    /* Open log file */
-    FILE *log_fp = fopen(config->log_file, "w");
-    if (log_fp == NULL) {
-        fprintf(stderr, "Warning: Cannot open log file '%s'\n", config->log_file);
+    size_t pos = sample->position;
+    size_t repl_len = sample->replacement_len;
+    struct iovec head[4] = {
+        { (void *)"@", 1 },
+        { record->seq_id, record->seq_id_len },
+        { (void *)"\n", 1 },
+        { record->sequence, pos }
+    };
+    struct iovec tail[6] = {
+        { record->sequence + pos + repl_len, record->sequence_len - pos - repl_len },
+        { (void *)"\n", 1 },
+        { record->plus_line, record->plus_line_len },
+        { (void *)"\n", 1 },
+        { record->quality, record->quality_len },
+        { (void *)"\n", 1 }
+    };
+    
+    if (output_stream_writev(out, head, 4) != SUCCESS ||
+        (sample->region = output_stream_write_patchable(out, record->sequence + pos, repl_len)) == NULL ||
+        output_stream_writev(out, tail, 6) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
+
+/* FASTQ record view. Sequence bytes are edited in place before the
+ * record is written. */
+typedef struct {
+    char *id;
+    size_t id_len;
+    char *seq;
+    size_t seq_len;
+    FastqRecord fastq;        /* The parsed record */
+} SeqRecord;
+
+/* A replacement planned for the FASTA record being streamed */
+typedef struct {
+    size_t position;
+    const char *sequence;
+    size_t len;
+    size_t span;              /* Bases held back from position: len, or up to the
+                                 end of the record for a random position */
+    size_t line;              /* Edits mode: line in the edits file, else 0 */
+    SampledRead *sample;      /* Random modes: written patchable, not applied */
+    int applied;
+    char *original;           /* Bases it replaced, NUL-terminated */
+    size_t original_capacity;
+} PlannedEdit;
+
+/* FASTQ input read through its .fqi index */
+typedef struct IndexedInput IndexedInput;
+
+/* FASTA input patched through its .fai index */
+typedef struct FaiInput FaiInput;
+
+/* State of one replacement run, shared by the per-mode loops */
+typedef struct {
+    const ReplacerConfig *config;
+    FastqReader *fastq;
+    FastqBatch batch;         /* FASTQ records read ahead from fastq */
+    size_t batch_next;        /* Next record of batch to hand out */
+    size_t records_read;      /* Records read into batches so far */
+    size_t read_limit;        /* Records to parse before passthrough_rest(), or SIZE_MAX */
+    IndexedInput *indexed;    /* Used instead of fastq with -x */
+    FastaReader *fasta;
+    FaiInput *fai;            /* Used instead of fasta with -x */
+    OutputStream *out;        /* NULL with --in-place */
+    FILE *log_fp;
+    EditSet *edits;
+    char **replacements;      /* Replacement sequences used by this run */
+    size_t *repl_lens;
+    int num_replacements;
+    int first_seq_number;     /* 1-based -s number of replacements[0] */
+    SegmentBuffer saved;
+    size_t record_count;
+    size_t replacement_count;
+    int passed_through;       /* Input after record_count was copied unparsed */
+    int read_failed;          /* next_record() stopped on a read error */
+    PlannedEdit *plan;        /* FASTA: replacements for the current record */
+    size_t plan_len;
+    size_t plan_capacity;
+    PlannedEdit **plan_order; /* The plan by position */
+    ByteBuffer hold;          /* FASTA: output held back for a replacement */
+} ReplaceRun;
+
+/* Read the next record; returns 1, or 0 at end of input or on an error
+ * (then read_failed is set). Records are read a batch at a time, but never
+ * past read_limit, so the input after it is still unread when
+ * passthrough_rest() copies it. */
+static inline int next_record(ReplaceRun *run, SeqRecord *rec) {
+    FastqBatch *batch = &run->batch;
+    if (run->batch_next == batch->count) {
+        size_t max = FASTQ_BATCH_RECORDS;
+        if (run->read_limit - run->records_read < max) {
+            max = run->read_limit - run->records_read;
+        }
+        if (max == 0) {
+            return 0;
+        }
+        int count = fastq_reader_next_batch(run->fastq, batch, max);
+        if (count <= 0) {
+            run->read_failed = (count < 0);
+            return 0;
+        }
+        run->records_read += batch->count;
+        run->batch_next = 0;
     }
     
-    /* Process records */
-    FastqRecord record;
-    int read_result;
-    size_t record_count = 0;
-    size_t replacement_count = 0;
+    fastq_batch_record(batch, run->batch_next++, &rec->fastq);
+    rec->id = rec->fastq.seq_id;
+    rec->id_len = rec->fastq.seq_id_len;
+    rec->seq = rec->fastq.sequence;
+    rec->seq_len = rec->fastq.sequence_len;
+    return 1;
+}
+
+static inline int write_record(ReplaceRun *run, const SeqRecord *rec) {
+    return write_fastq(run->out, &rec->fastq);
+}
+
+static inline int write_record_sampled(ReplaceRun *run, const SeqRecord *rec, SampledRead *sample) {
+    return write_fastq_sampled(run->out, &rec->fastq, sample);
+}
+
+/* Replace, log and count one segment of a record */
+static inline void replace_in_record(ReplaceRun *run, SeqRecord *rec, size_t position,
+                                     const char *replacement, size_t len) {
+    const char *original_segment = replace_segment(&run->saved, rec->seq, position,
+                                                   replacement, len);
+    report_replacement(run->config, run->log_fp, rec->id, position, original_segment,
+                       replacement);
+    run->replacement_count++;
+}
+
+/* Apply the edits for one read in place, in edits-file order, logging
+ * each one; edits that run past the end of the read are skipped */
+static void apply_edits(ReplaceRun *run, SeqRecord *rec) {
+    const Edit *by_index = NULL;
+    const Edit *by_id = NULL;
+    size_t num_by_index = edit_set_by_index(run->edits, run->record_count, &by_index);
+    size_t num_by_id = edit_set_by_id(run->edits, rec->id, rec->id_len, &by_id);
+    size_t i = 0;
+    size_t j = 0;
     
-    while ((read_result = fastq_reader_next(reader, &record)) > 0) {
-        record_count++;
-        int should_replace = 0;
-        size_t replace_pos = 0;
-        char *replacement_seq = NULL;
-        int replacement_idx = -1;
-        
-        if (config->mode == MODE_SINGLE) {
-            /* Single mode: only replace the target read */
-            if (record_count == config->target_read_index) {
-                should_replace = 1;
-                replace_pos = config->position;
-                replacement_seq = config->replacement_seqs[0];
-            }
-        } else if (config->mode == MODE_RANDOM || config->mode == MODE_RANDOM_FIXED) {
-            /* Random modes: check if this read is one of the selected ones */
-            for (int i = 0; i < num_to_replace; i++) {
-                if (record_count == random_read_indices[i]) {
-                    should_replace = 1;
-                    replacement_idx = i;
-                    replacement_seq = config->replacement_seqs[i];
-                    
-                    if (config->mode == MODE_RANDOM) {
-                        /* Generate random position if not already set */
-                        if (random_positions[i] == 0) {
-                            random_positions[i] = find_random_position(
-                                strlen(record.sequence), strlen(replacement_seq));
-                        }
-                        replace_pos = random_positions[i];
-                    } else {
-                        /* Fixed position */
-                        replace_pos = config->position;
-                    }
-                    break;
-                }
-            }
+    while (i < num_by_index || j < num_by_id) {
+        /* Merge the two groups by line number */
+        const Edit *edit;
+        if (j >= num_by_id || (i < num_by_index && by_index[i].line < by_id[j].line)) {
+            edit = &by_index[i++];
         } else {
-            /* Position mode: replace all reads at specified position */
-            should_replace = 1;
-            replace_pos = config->position;
-            /* Use sequences in rotation */
-            replacement_seq = config->replacement_seqs[replacement_count % num_to_replace];
+            edit = &by_id[j++];
         }
         
-        if (!should_replace || replacement_seq == NULL) {
-            /* Write record unchanged */
-            fprintf(out_fp, "@%s\n%s\n%s\n%s\n",
-                    record.seq_id, record.sequence, record.plus_line, record.quality);
-            fastq_record_free(&record);
+        if (edit->position + edit->sequence_len > rec->seq_len) {
             continue;
         }
         
-        size_t repl_len = strlen(replacement_seq);
+        const char *original_segment = replace_segment(&run->saved, rec->seq, edit->position,
+                                                       edit->sequence, edit->sequence_len);
         
-        if (strlen(record.sequence) >= repl_len + replace_pos) {
-            /* Save original sequence segment */
-            char *original_segment = safe_malloc(repl_len + 1);
-            memcpy(original_segment, record.sequence + replace_pos, repl_len);
-            original_segment[repl_len] = '\0';
-            
-            /* Perform replacement */
-            size_t actual_pos;
-            char *new_sequence = replace_at_position(record.sequence, 
-                                                     replacement_seq, 
-                                                     replace_pos, &actual_pos);
-            
-            if (new_sequence != NULL) {
-                /* Log replacement */
-                if (log_fp != NULL) {
-                    ReplacementRecord rep_record;
-                    rep_record.seq_id = record.seq_id;
-                    rep_record.position = actual_pos;
-                    rep_record.original_seq = original_segment;
-                    rep_record.new_seq = replacement_seq;
-                    log_replacement(log_fp, &rep_record);
-                }
-                
-                if (config->verbose) {
-                    printf("Replaced in %s at position %zu: %s -> %s",
-                           record.seq_id, actual_pos, original_segment, replacement_seq);
-                    if (replacement_idx >= 0) {
-                        printf(" (seq #%d)\n", replacement_idx + 1);
-                    } else {
-                        printf("\n");
-                    }
-                }
-                
-                /* Update sequence */
-                free(record.sequence);
-                record.sequence = new_sequence;
-                replacement_count++;
-            }
-            
-            free(original_segment);
+        if (run->log_fp != NULL) {
+            ReplacementRecord rep_record;
+            rep_record.seq_id = rec->id;
+            rep_record.position = edit->position;
+            rep_record.original_seq = (char *)original_segment;
+            rep_record.new_seq = (char *)edit->sequence;
+            log_replacement(run->log_fp, &rep_record);
         }
         
-        /* Write record */
-        fprintf(out_fp, "@%s\n%s\n%s\n%s\n",
-                record.seq_id, record.sequence, record.plus_line, record.quality);
+        if (run->config->verbose) {
+            printf("Replaced in %s at position %zu: %s -> %s (edit line %zu)\n",
+                   rec->id, edit->position, original_segment, edit->sequence, edit->line);
+        }
         
-        fastq_record_free(&record);
+        run->replacement_count++;
+    }
+}
+
+/* Copy the FASTQ input after the current record to the output unparsed,
+ * once no later read can change: uncompressed input to plain output goes
+ * through copy_file_range(), anything else is streamed straight from the
+ * decompressor to the output (and its compressor). Records written so far
+ * end in '\n' alone, so "\r\n" input is parsed and written to the end
+ * instead, keeping the line ends of the output the same throughout. */
+static int passthrough_rest(ReplaceRun *run) {
+    if (run->fastq->crlf) {
+        SeqRecord rec;
+        int status = SUCCESS;
+        run->read_limit = SIZE_MAX;
+        while (status == SUCCESS && next_record(run, &rec)) {
+            run->record_count++;
+            status = write_record(run, &rec);
+        }
+        return status;
     }
     
-    /* Cleanup */
-    free(random_read_indices);
-    free(random_positions);
+    const char *pending;
+    size_t pending_len = fastq_reader_take_buffered(run->fastq, &pending);
+    char last = '\n';
+    int status = SUCCESS;
     
-    /* Cleanup */
-    fastq_reader_close(reader);
-    if (is_output_pipe) {
-        pclose(out_fp);
-    } else {
-        fclose(out_fp);
+    if (pending_len > 0) {
+        status = output_stream_write(run->out, pending, pending_len);
+        last = pending[pending_len - 1];
     }
-    if (log_fp != NULL) {
-        fclose(log_fp);
+    
+    InputStream *in = run->fastq->input;
+    int fd = input_stream_fd(in);
+    if (status == SUCCESS && fd >= 0) {
+        struct stat st;
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        status = output_stream_append_fd(run->out, fd);
+        if (status == SUCCESS && start >= 0 && fstat(fd, &st) == 0 && st.st_size > start &&
+            pread(fd, &last, 1, st.st_size - 1) != 1) {
+            status = ERR_FILE_READ;
+        }
+    } else if (status == SUCCESS) {
+        char *buffer = safe_malloc(1 << 20);
+        ssize_t n;
+        while ((n = input_stream_read(in, buffer, 1 << 20)) > 0) {
+            last = buffer[n - 1];
+            status = output_stream_write(run->out, buffer, (size_t)n);
+            if (status != SUCCESS) {
+                break;
+            }
+        }
+        if (n < 0) {
+            status = ERR_FILE_READ;
+        }
+        free(buffer);
     }
     
-    printf("\nReplacement completed:\n");
-    printf("  Total sequences: %zu\n", record_count);
-    printf("  Replacements made: %zu\n", replacement_count);
-    printf("  Output file: %s\n", config->output_file);
-    printf("  Log file: %s\n", config->log_file);
+    /* Parsed records always end in a newline; keep that for the last one */
+    if (status == SUCCESS && last != '\n') {
+        status = output_stream_write(run->out, "\n", 1);
+    }
     
-    return SUCCESS;
+    if (status == ERR_FILE_READ) {
+        fprintf(stderr, "Error: Failed to read input file '%s': %s\n",
+                run->config->input_file, strerror(errno));
+    } else if (status != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+    }
+    run->passed_through = 1;
+    return status;
 }
 
-/* Process FASTA file */
-static int process_fasta(const ReplacerConfig *config) {
-    size_t random_seq_index = 0;
+/* Per-mode FASTQ loops. Each one reads, edits and writes every record
+ * with the mode decided once up front. */
+
+/* Single mode: only the target read is replaced */
+static int loop_single(ReplaceRun *run) {
+    const size_t target = run->config->target_read_index;
+    const size_t position = run->config->position;
+    const char *replacement = run->replacements[0];
+    const size_t len = run->repl_lens[0];
+    SeqRecord rec;
+    int status = SUCCESS;
     
-    /* Select random replacement sequence if multiple provided */
-    char *selected_replacement = config->replacement_seqs[0];
-    if (config->num_replacements > 1) {
-        int selected_idx = rand() % config->num_replacements;
-        selected_replacement = config->replacement_seqs[selected_idx];
-        if (config->verbose) {
-            printf("Selected replacement sequence #%d: %s\n", selected_idx + 1, selected_replacement);
+    run->read_limit = target;
+    while (status == SUCCESS && next_record(run, &rec)) {
+        if (++run->record_count != target) {
+            status = write_record(run, &rec);
+            continue;
         }
-    }
-    
-    /* For random modes: quickly count sequences using grep */
-    if (config->mode == MODE_RANDOM || config->mode == MODE_RANDOM_FIXED) {
-        char command[2048];
-        FILE *grep_fp;
         
-        if (strstr(config->input_file, ".gz") != NULL) {
-            snprintf(command, sizeof(command), "gzip -dc '%s' | grep -c '^>'", config->input_file);
-        } else {
-            snprintf(command, sizeof(command), "grep -c '^>' '%s'", config->input_file);
+        if (rec.seq_len >= position + len) {
+            replace_in_record(run, &rec, position, replacement, len);
         }
+        status = write_record(run, &rec);
         
-        grep_fp = popen(command, "r");
-        if (grep_fp != NULL) {
-            size_t total_seqs = 0;
-            if (fscanf(grep_fp, "%zu", &total_seqs) == 1 && total_seqs > 0) {
-                random_seq_index = (rand() % total_seqs) + 1;
-                if (config->verbose) {
-                    printf("Random mode: selected sequence #%zu out of %zu total sequences\n", 
-                           random_seq_index, total_seqs);
-                }
-            }
-            pclose(grep_fp);
+        /* Nothing after the target changes */
+        if (status == SUCCESS) {
+            status = passthrough_rest(run);
         }
+        break;
+    }
+    return status;
+}
+
+/* Parallel position mode. The reading thread lays records out in output
+ * format in batches and decides which replacement each read gets (the
+ * rotation depends on earlier reads, so that part stays serial). Worker
+ * threads copy the replacements in and render the log and verbose lines
+ * of their batch. Finished batches are written in input order, so the
+ * output, log and verbose output match a serial run. */
+
+#define POSITION_BATCH_SIZE (1024 * 1024)
+#define POSITION_JOBS_PER_THREAD 4
+
+/* One replacement inside a batch; offsets are into the batch records */
+typedef struct {
+    size_t id_offset;
+    size_t id_len;
+    size_t seq_offset;
+    int repl_idx;
+} BatchEdit;
+
+typedef struct {
+    ByteBuffer records;       /* Records in output format */
+    BatchEdit *edits;
+    size_t num_edits;
+    size_t edits_capacity;
+    ByteBuffer log;           /* Rendered log entries */
+    ByteBuffer verbose;       /* Rendered "Replaced in" lines */
+} PositionBatch;
+
+/* Read-only state shared by the workers */
+typedef struct {
+    char **replacements;
+    size_t *repl_lens;
+    char position_text[24];   /* config->position in decimal */
+    size_t position_text_len;
+    int log;
+    int verbose;
+} PositionEngine;
+
+/* Worker: apply and render the replacements of one batch */
+static int position_batch_job(void *job, void *ctx) {
+    PositionBatch *batch = job;
+    const PositionEngine *engine = ctx;
+    
+    for (size_t i = 0; i < batch->num_edits; i++) {
+        const BatchEdit *edit = &batch->edits[i];
+        const char *id = batch->records.data + edit->id_offset;
+        char *seq = batch->records.data + edit->seq_offset;
+        const char *replacement = engine->replacements[edit->repl_idx];
+        size_t len = engine->repl_lens[edit->repl_idx];
         
-        if (random_seq_index == 0) {
-            fprintf(stderr, "Error: Could not count sequences in input file\n");
-            return ERR_INVALID_FORMAT;
+        /* Same text as log_replacement() and report_replacement() */
+        if (engine->log) {
+            buffer_append(&batch->log, "Sequence ID: ", 13);
+            buffer_append(&batch->log, id, edit->id_len);
+            buffer_append(&batch->log, "\nPosition: ", 11);
+            buffer_append(&batch->log, engine->position_text, engine->position_text_len);
+            buffer_append(&batch->log, "\nOriginal: ", 11);
+            buffer_append(&batch->log, seq, len);
+            buffer_append(&batch->log, "\nReplaced: ", 11);
+            buffer_append(&batch->log, replacement, len);
+            buffer_append(&batch->log, "\n---\n", 5);
         }
+        if (engine->verbose) {
+            buffer_append(&batch->verbose, "Replaced in ", 12);
+            buffer_append(&batch->verbose, id, edit->id_len);
+            buffer_append(&batch->verbose, " at position ", 13);
+            buffer_append(&batch->verbose, engine->position_text, engine->position_text_len);
+            buffer_append(&batch->verbose, ": ", 2);
+            buffer_append(&batch->verbose, seq, len);
+            buffer_append(&batch->verbose, " -> ", 4);
+            buffer_append(&batch->verbose, replacement, len);
+            buffer_append(&batch->verbose, "\n", 1);
+        }
+        
+        memcpy(seq, replacement, len);
     }
+    return SUCCESS;
+}
+
+/* Write the oldest finished batch (or drop it after an earlier error)
+ * and return it to the pool */
+static int write_position_batch(ReplaceRun *run, OrderedPool *pool, int discard) {
+    int result;
+    PositionBatch *batch = ordered_pool_next(pool, &result);
+    int status = SUCCESS;
     
-    /* Open input file */
-    FILE *in_fp = NULL;
-    int is_input_pipe = 0;
-    
-    if (strstr(config->input_file, ".gz") != NULL) {
-        char command[2048];
-        snprintf(command, sizeof(command), "gzip -dc '%s'", config->input_file);
-        in_fp = popen(command, "r");
-        is_input_pipe = 1;
-    } else {
-        in_fp = fopen(config->input_file, "r");
+    if (discard) {
+        ordered_pool_release(pool);
+        return SUCCESS;
     }
-    
-    if (in_fp == NULL) {
-        return ERR_FILE_OPEN;
+    if (output_stream_write(run->out, batch->records.data, batch->records.len) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+        status = ERR_FILE_WRITE;
+    }
+    if (run->log_fp != NULL && batch->log.len > 0) {
+        fwrite(batch->log.data, 1, batch->log.len, run->log_fp);
+    }
+    if (batch->verbose.len > 0) {
+        fwrite(batch->verbose.data, 1, batch->verbose.len, stdout);
     }
     
-    /* Open output file */
-    FILE *out_fp = NULL;
-    int is_output_pipe = 0;
+    ordered_pool_release(pool);
+    return status;
+}
+
+static int loop_position_parallel(ReplaceRun *run) {
+    const ReplacerConfig *config = run->config;
+    const size_t position = config->position;
+    const int num_replacements = run->num_replacements;
+    int next = 0;
     
-    if (strstr(config->output_file, ".gz") != NULL) {
-        char command[2048];
-        snprintf(command, sizeof(command), "gzip -c > '%s'", config->output_file);
-        out_fp = popen(command, "w");
-        is_output_pipe = 1;
-    } else {
-        out_fp = fopen(config->output_file, "w");
-    }
+    PositionEngine engine;
+    engine.replacements = run->replacements;
+    engine.repl_lens = run->repl_lens;
+    engine.position_text_len = (size_t)snprintf(engine.position_text,
+                                                sizeof(engine.position_text), "%zu", position);
+    engine.log = (run->log_fp != NULL);
+    engine.verbose = config->verbose;
     
-    if (out_fp == NULL) {
-        if (is_input_pipe) pclose(in_fp);
-        else fclose(in_fp);
-        return ERR_FILE_OPEN;
+    int num_jobs = config->threads * POSITION_JOBS_PER_THREAD;
+    PositionBatch *batches = safe_malloc(sizeof(PositionBatch) * num_jobs);
+    void **job_ptrs = safe_malloc(sizeof(void *) * num_jobs);
+    memset(batches, 0, sizeof(PositionBatch) * num_jobs);
+    for (int i = 0; i < num_jobs; i++) {
+        job_ptrs[i] = &batches[i];
     }
+    OrderedPool *pool = ordered_pool_create(config->threads, job_ptrs, num_jobs,
+                                            position_batch_job, &engine);
     
-    /* Open log file */
-    FILE *log_fp = fopen(config->log_file, "w");
-    if (log_fp == NULL) {
-        fprintf(stderr, "Warning: Cannot open log file '%s'\n", config->log_file);
-    }
+    SeqRecord rec;
+    int in_flight = 0;
+    int more = 1;
+    int status = SUCCESS;
     
-    /* Process FASTA records */
-    char *line = NULL;
-    size_t line_size = 0;
-    ssize_t read;
-    char *current_id = NULL;
-    char *current_seq = NULL;
-    size_t seq_capacity = 1024;
-    size_t seq_length = 0;
-    size_t record_count = 0;
-    size_t replacement_count = 0;
-    size_t repl_len = strlen(selected_replacement);
-    size_t random_position = 0;
-    
-    current_seq = safe_malloc(seq_capacity);
-    current_seq[0] = '\0';
-    
-    while ((read = getline(&line, &line_size, in_fp)) != -1) {
-        trim_newline(line);
+    while (status == SUCCESS && more) {
+        if (in_flight == num_jobs) {
+            status = write_position_batch(run, pool, 0);
+            in_flight--;
+            continue;
+        }
         
-        if (line[0] == '>') {
-            /* Process previous sequence if exists */
-            if (current_id != NULL && seq_length > 0) {
-                record_count++;
-                int should_replace = 0;
-                size_t replace_pos = 0;
-                
-                if (config->mode == MODE_SINGLE) {
-                    if (record_count == config->target_read_index) {
-                        should_replace = 1;
-                        replace_pos = config->position;
-                    }
-                } else if (config->mode == MODE_RANDOM) {
-                    /* Random mode: only replace the pre-selected sequence at random position */
-                    if (record_count == random_seq_index) {
-                        should_replace = 1;
-                        if (random_position == 0) {
-                            random_position = find_random_position(seq_length, repl_len);
-                        }
-                        replace_pos = random_position;
-                    }
-                } else if (config->mode == MODE_RANDOM_FIXED) {
-                    /* Random-fixed mode: only replace the pre-selected sequence at fixed position */
-                    if (record_count == random_seq_index) {
-                        should_replace = 1;
-                        replace_pos = config->position;
-                    }
-                } else {
-                    should_replace = 1;
-                    replace_pos = config->position;
+        PositionBatch *batch = ordered_pool_acquire(pool);
+        batch->records.len = 0;
+        batch->num_edits = 0;
+        batch->log.len = 0;
+        batch->verbose.len = 0;
+        
+        while (batch->records.len < POSITION_BATCH_SIZE && (more = next_record(run, &rec))) {
+            run->record_count++;
+            
+            ByteBuffer *records = &batch->records;
+            buffer_append(records, "@", 1);
+            size_t id_offset = records->len;
+            buffer_append(records, rec.id, rec.id_len);
+            buffer_append(records, "\n", 1);
+            size_t seq_offset = records->len;
+            buffer_append(records, rec.seq, rec.seq_len);
+            buffer_append(records, "\n", 1);
+            buffer_append(records, rec.fastq.plus_line, rec.fastq.plus_line_len);
+            buffer_append(records, "\n", 1);
+            buffer_append(records, rec.fastq.quality, rec.fastq.quality_len);
+            buffer_append(records, "\n", 1);
+            
+            if (rec.seq_len >= position + run->repl_lens[next]) {
+                if (batch->num_edits == batch->edits_capacity) {
+                    batch->edits_capacity = batch->edits_capacity ? batch->edits_capacity * 2 : 1024;
+                    batch->edits = safe_realloc(batch->edits,
+                                                sizeof(BatchEdit) * batch->edits_capacity);
                 }
-                
-                if (should_replace && seq_length >= repl_len + replace_pos) {
-                    /* Save original segment */
-                    char *original_segment = safe_malloc(repl_len + 1);
-                    memcpy(original_segment, current_seq + replace_pos, repl_len);
-                    original_segment[repl_len] = '\0';
-                    
-                    /* Perform replacement */
-                    memcpy(current_seq + replace_pos, selected_replacement, repl_len);
-                    
-                    /* Log replacement */
-                    if (log_fp != NULL) {
-                        ReplacementRecord rep_record;
-                        rep_record.seq_id = current_id;
-                        rep_record.position = replace_pos;
-                        rep_record.original_seq = original_segment;
-                        rep_record.new_seq = selected_replacement;
-                        log_replacement(log_fp, &rep_record);
-                    }
-                    
-                    if (config->verbose) {
-                        printf("Replaced in %s at position %zu: %s -> %s\n",
-                               current_id, replace_pos, original_segment, 
-                               selected_replacement);
-                    }
-                    
-                    free(original_segment);
-                    replacement_count++;
+                BatchEdit *edit = &batch->edits[batch->num_edits++];
+                edit->id_offset = id_offset;
+                edit->id_len = rec.id_len;
+                edit->seq_offset = seq_offset + position;
+                edit->repl_idx = next;
+                run->replacement_count++;
+                if (++next == num_replacements) {
+                    next = 0;
                 }
-                
-                /* Write sequence */
-                fprintf(out_fp, ">%s\n%s\n", current_id, current_seq);
             }
-            
-            /* Start new sequence */
-            if (current_id != NULL) free(current_id);
-            current_id = safe_strdup(line + 1);  /* Skip '>' */
-            seq_length = 0;
-            current_seq[0] = '\0';
-        } else {
-            /* Append to current sequence */
-            size_t line_len = strlen(line);
-            if (seq_length + line_len >= seq_capacity) {
-                seq_capacity = (seq_length + line_len + 1) * 2;
-                current_seq = safe_realloc(current_seq, seq_capacity);
+        }
+        
+        ordered_pool_submit(pool);
+        in_flight++;
+    }
+    
+    /* Drain the batches still in flight */
+    ordered_pool_close(pool);
+    while (in_flight > 0) {
+        int result = write_position_batch(run, pool, status != SUCCESS);
+        if (status == SUCCESS) {
+            status = result;
+        }
+        in_flight--;
+    }
+    ordered_pool_destroy(pool);
+    
+    for (int i = 0; i < num_jobs; i++) {
+        free(batches[i].records.data);
+        free(batches[i].edits);
+        free(batches[i].log.data);
+        free(batches[i].verbose.data);
+    }
+    free(batches);
+    free(job_ptrs);
+    return status;
+}
+
+/* Position mode: a fixed-offset copy into every read, with the
+ * replacement sequences used in rotation */
+static int loop_position(ReplaceRun *run) {
+    if (run->config->threads > 1) {
+        return loop_position_parallel(run);
+    }
+    
+    const size_t position = run->config->position;
+    const int num_replacements = run->num_replacements;
+    int next = 0;
+    SeqRecord rec;
+    int status = SUCCESS;
+    
+    while (status == SUCCESS && next_record(run, &rec)) {
+        run->record_count++;
+        if (rec.seq_len >= position + run->repl_lens[next]) {
+            replace_in_record(run, &rec, position, run->replacements[next], run->repl_lens[next]);
+            if (++next == num_replacements) {
+                next = 0;
             }
-            strcpy(current_seq + seq_length, line);
-            seq_length += line_len;
         }
+        status = write_record(run, &rec);
+    }
+    return status;
+}
+
+/* Edits mode: edits for each read come from the edit set */
+static int loop_edits(ReplaceRun *run) {
+    /* Reads past the last one named by number are copied unparsed */
+    const size_t last = edit_set_last_index(run->edits);
+    SeqRecord rec;
+    int status = SUCCESS;
+    
+    if (last == 0) {
+        return passthrough_rest(run);
     }
     
-    /* Process last sequence */
-    if (current_id != NULL && seq_length > 0) {
-        record_count++;
-        int should_replace = 0;
-        size_t replace_pos = 0;
+    run->read_limit = last;
+    while (status == SUCCESS && next_record(run, &rec)) {
+        run->record_count++;
+        apply_edits(run, &rec);
+        status = write_record(run, &rec);
         
-        if (config->mode == MODE_SINGLE) {
-            if (record_count == config->target_read_index) {
-                should_replace = 1;
-                replace_pos = config->position;
-            }
-        } else if (config->mode == MODE_RANDOM) {
-            /* Random mode: only replace the pre-selected sequence at random position */
-            if (record_count == random_seq_index) {
-                should_replace = 1;
-                if (random_position == 0) {
-                    random_position = find_random_position(seq_length, repl_len);
-                }
-                replace_pos = random_position;
-            }
-        } else if (config->mode == MODE_RANDOM_FIXED) {
-            /* Random-fixed mode: only replace the pre-selected sequence at fixed position */
-            if (record_count == random_seq_index) {
-                should_replace = 1;
-                replace_pos = config->position;
-            }
+        if (status == SUCCESS && run->record_count == last) {
+            status = passthrough_rest(run);
+            break;
+        }
+    }
+    return status;
+}
+
+/* Random modes: one read per replacement sequence is picked by reservoir
+ * sampling and patched in the output once the input is exhausted */
+static int loop_random(ReplaceRun *run) {
+    const ReplacerConfig *config = run->config;
+    const int slots = run->num_replacements;
+    const int random_position = (config->mode == MODE_RANDOM);
+    SampledRead *samples = safe_malloc(sizeof(SampledRead) * slots);
+    memset(samples, 0, sizeof(SampledRead) * slots);
+    SeqRecord rec;
+    int status = SUCCESS;
+    
+    while (status == SUCCESS && next_record(run, &rec)) {
+        /* Slot i uses replacement sequence i */
+        int slot = reservoir_slot(++run->record_count, slots);
+        if (slot >= 0) {
+            sample_read(&samples[slot], run->record_count, run->first_seq_number + slot,
+                        run->replacements[slot], run->repl_lens[slot], random_position,
+                        config->position, rec.id, rec.seq, rec.seq_len);
+            status = write_record_sampled(run, &rec, &samples[slot]);
         } else {
-            should_replace = 1;
-            replace_pos = config->position;
+            status = write_record(run, &rec);
         }
-        
-        if (should_replace && seq_length >= repl_len + replace_pos) {
-            char *original_segment = safe_malloc(repl_len + 1);
-            memcpy(original_segment, current_seq + replace_pos, repl_len);
-            original_segment[repl_len] = '\0';
-            
-            memcpy(current_seq + replace_pos, selected_replacement, repl_len);
-            
-            if (log_fp != NULL) {
-                ReplacementRecord rep_record;
-                rep_record.seq_id = current_id;
-                rep_record.position = replace_pos;
-                rep_record.original_seq = original_segment;
-                rep_record.new_seq = selected_replacement;
-                log_replacement(log_fp, &rep_record);
-            }
-            
-            if (config->verbose) {
-                printf("Replaced in %s at position %zu: %s -> %s\n",
-                       current_id, replace_pos, original_segment, 
-                       selected_replacement);
+    }
+    
+    if (status == SUCCESS && run->record_count == 0) {
+        fprintf(stderr, "Error: No reads found in input file\n");
+        status = ERR_INVALID_FORMAT;
+    } else if (status == SUCCESS) {
+        int selected = (run->record_count < (size_t)slots) ? (int)run->record_count : slots;
+        qsort(samples, (size_t)selected, sizeof(SampledRead), compare_samples);
+        if (config->verbose) {
+            printf("Random mode: selected %d reads out of %zu total reads: ",
+                   selected, run->record_count);
+            for (int i = 0; i < selected; i++) {
+                printf("#%zu%s", samples[i].record_index, i < selected - 1 ? ", " : "\n");
             }
-            
-            free(original_segment);
-            replacement_count++;
         }
-        
-        fprintf(out_fp, ">%s\n%s\n", current_id, current_seq);
+        run->replacement_count = apply_samples(config, run->out, run->log_fp, samples, selected, 1);
     }
     
-    /* Cleanup */
-    if (line != NULL) free(line);
-    if (current_id != NULL) free(current_id);
-    if (current_seq != NULL) free(current_seq);
+    free_samples(samples, slots);
+    return status;
+}
+
+/* Streaming FASTA. A record's sequence goes from the reader to the output
+ * chunk by chunk with its line breaks, so memory does not grow with the
+ * record. The replacements for a record are planned from its header and
+ * applied as the bytes stream past: the output from the start of a
+ * replacement to its end is held back until the record is known to be
+ * long enough, and overlapping replacements are held together. */
+
+static PlannedEdit* plan_edit(ReplaceRun *run, size_t position, const char *sequence, size_t len) {
+    if (run->plan_len == run->plan_capacity) {
+        size_t old = run->plan_capacity;
+        run->plan_capacity = old ? old * 2 : 16;
+        run->plan = safe_realloc(run->plan, sizeof(PlannedEdit) * run->plan_capacity);
+        run->plan_order = safe_realloc(run->plan_order, sizeof(PlannedEdit *) * run->plan_capacity);
+        memset(run->plan + old, 0, sizeof(PlannedEdit) * (run->plan_capacity - old));
+    }
     
-    if (is_input_pipe) pclose(in_fp);
-    else fclose(in_fp);
+    PlannedEdit *edit = &run->plan[run->plan_len++];
+    edit->position = position;
+    edit->sequence = sequence;
+    edit->len = len;
+    edit->span = len;
+    edit->line = 0;
+    edit->sample = NULL;
+    edit->applied = 0;
+    return edit;
+}
+
+/* Plan the edits for one record in edits-file order */
+static void plan_record_edits(ReplaceRun *run, const char *id, size_t id_len) {
+    const Edit *by_index = NULL;
+    const Edit *by_id = NULL;
+    size_t num_by_index = edit_set_by_index(run->edits, run->record_count, &by_index);
+    size_t num_by_id = edit_set_by_id(run->edits, id, id_len, &by_id);
+    size_t i = 0;
+    size_t j = 0;
     
-    if (is_output_pipe) pclose(out_fp);
-    else fclose(out_fp);
+    while (i < num_by_index || j < num_by_id) {
+        const Edit *edit;
+        if (j >= num_by_id || (i < num_by_index && by_index[i].line < by_id[j].line)) {
+            edit = &by_index[i++];
+        } else {
+            edit = &by_id[j++];
+        }
+        plan_edit(run, edit->position, edit->sequence, edit->sequence_len)->line = edit->line;
+    }
+}
+
+static int compare_planned(const void *a, const void *b) {
+    const PlannedEdit *x = *(PlannedEdit * const *)a;
+    const PlannedEdit *y = *(PlannedEdit * const *)b;
+    if (x->position != y->position) {
+        return (x->position > y->position) - (x->position < y->position);
+    }
+    return (x > y) - (x < y);
+}
+
+/* Sort the plan by position into plan_order */
+static void order_plan(ReplaceRun *run) {
+    for (size_t i = 0; i < run->plan_len; i++) {
+        run->plan_order[i] = &run->plan[i];
+    }
+    qsort(run->plan_order, run->plan_len, sizeof(PlannedEdit *), compare_planned);
+}
+
+/* Line break bytes of held text; '\r' only occurs in text read through a .fai index */
+static inline int is_line_break(char c) {
+    return c == '\n' || c == '\r';
+}
+
+/* Offset in held text of the base-th base (line breaks are skipped) */
+static size_t held_offset(const ByteBuffer *hold, size_t base) {
+    for (size_t i = 0; i < hold->len; i++) {
+        if (!is_line_break(hold->data[i]) && base-- == 0) {
+            return i;
+        }
+    }
+    return hold->len;
+}
+
+/* Copy n bases of held text from offset at into saved (NUL-terminated),
+ * then overwrite them with replacement unless it is NULL; returns the
+ * offset just after the last base */
+static size_t held_swap(ByteBuffer *hold, size_t at, size_t n, char *saved, const char *replacement) {
+    size_t k = 0;
+    while (k < n) {
+        if (!is_line_break(hold->data[at])) {
+            saved[k] = hold->data[at];
+            if (replacement != NULL) {
+                hold->data[at] = replacement[k];
+            }
+            k++;
+        }
+        at++;
+    }
+    saved[n] = '\0';
+    return at;
+}
+
+static int write_fasta_bytes(ReplaceRun *run, const char *data, size_t len) {
+    if (output_stream_write(run->out, data, len) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    return SUCCESS;
+}
+
+/* Write the held text of a sampled record with the bases its replacement
+ * would cover as a patchable region; the position of a random-position
+ * sample is picked now that the record length is known */
+static int write_held_sample(ReplaceRun *run, PlannedEdit *edit, size_t start, size_t seq_len) {
+    SampledRead *sample = edit->sample;
+    ByteBuffer *hold = &run->hold;
+    size_t len = edit->len;
     
-    if (log_fp != NULL) fclose(log_fp);
+    sample->position = (edit->span != len) ? find_random_position(seq_len, len) : edit->position;
+    if (seq_len < sample->position + len) {
+        return write_fasta_bytes(run, hold->data, hold->len);
+    }
     
-    printf("\nReplacement completed:\n");
-    printf("  Total sequences: %zu\n", record_count);
-    printf("  Replacements made: %zu\n", replacement_count);
-    printf("  Output file: %s\n", config->output_file);
-    printf("  Log file: %s\n", config->log_file);
+    sample->original = safe_malloc(len + 1);
+    size_t begin = held_offset(hold, sample->position - start);
+    size_t end = held_swap(hold, begin, len, sample->original, NULL);
+    sample->region_text = safe_malloc(end - begin + 1);
+    memcpy(sample->region_text, hold->data + begin, end - begin);
+    sample->region_text[end - begin] = '\0';
     
+    if (output_stream_write(run->out, hold->data, begin) != SUCCESS ||
+        (sample->region = output_stream_write_patchable(run->out, hold->data + begin,
+                                                        end - begin)) == NULL ||
+        output_stream_write(run->out, hold->data + end, hold->len - end) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+        return ERR_FILE_WRITE;
+    }
     return SUCCESS;
 }
 
-int replace_sequences(const ReplacerConfig *config) {
-    if (config == NULL) {
-        return ERR_INVALID_PARAM;
+/* Apply the planned replacements starting in [start, end) that fit in a
+ * record of seq_len bases to the held text (which starts at base start),
+ * in plan order. A sampled read is not applied: it is returned instead. */
+static PlannedEdit* patch_hold(ReplaceRun *run, size_t start, size_t end, size_t seq_len) {
+    ByteBuffer *hold = &run->hold;
+    
+    for (size_t i = 0; i < run->plan_len; i++) {
+        PlannedEdit *edit = &run->plan[i];
+        if (edit->position < start || edit->position >= end) {
+            continue;
+        }
+        if (edit->sample != NULL) {
+            return edit;
+        }
+        if (edit->position + edit->len > seq_len) {
+            continue;
+        }
+        
+        if (edit->len + 1 > edit->original_capacity) {
+            edit->original_capacity = (edit->len + 1) * 2;
+            edit->original = safe_realloc(edit->original, edit->original_capacity);
+        }
+        held_swap(hold, held_offset(hold, edit->position - start), edit->len,
+                  edit->original, edit->sequence);
+        edit->applied = 1;
+    }
+    return NULL;
+}
+
+/* Apply the planned replacements in [start, end) to the held text and write it */
+static int release_hold(ReplaceRun *run, size_t start, size_t end, size_t seq_len) {
+    PlannedEdit *sampled = patch_hold(run, start, end, seq_len);
+    if (sampled != NULL) {
+        return write_held_sample(run, sampled, start, seq_len);
+    }
+    return write_fasta_bytes(run, run->hold.data, run->hold.len);
+}
+
+/* Bases [*start, *end) of the next group of overlapping planned
+ * replacements after plan_order[*next]; *start is SIZE_MAX if none is left */
+static void next_cluster(ReplaceRun *run, size_t *next, size_t *start, size_t *end) {
+    if (*next == run->plan_len) {
+        *start = SIZE_MAX;
+        *end = SIZE_MAX;
+        return;
     }
     
-    /* Initialize random seed */
-    if (config->mode == MODE_RANDOM) {
-        srand(config->seed);
+    const PlannedEdit *first = run->plan_order[(*next)++];
+    *start = first->position;
+    *end = first->position + first->span;
+    while (*next < run->plan_len && run->plan_order[*next]->position < *end) {
+        const PlannedEdit *edit = run->plan_order[(*next)++];
+        if (edit->position + edit->span > *end) {
+            *end = edit->position + edit->span;
+        }
     }
+}
+
+/* Write the current record, whose first chunk has been read, applying the
+ * planned replacements; stores its length in *seq_len */
+static int stream_fasta_record(ReplaceRun *run, FastaChunk *chunk, size_t *seq_len) {
+    FastaReader *reader = run->fasta;
+    ByteBuffer *hold = &run->hold;
     
-    /* Determine file type and process */
-    if (is_fastq_file(config->input_file)) {
-        return process_fastq(config);
+    struct iovec header[3] = {
+        { (void *)">", 1 },
+        { reader->header, reader->header_len },
+        { (void *)"\n", 1 }
+    };
+    if (output_stream_writev(run->out, header, 3) != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+        return ERR_FILE_WRITE;
+    }
+    
+    order_plan(run);
+    size_t next = 0;
+    size_t start;
+    size_t end;
+    next_cluster(run, &next, &start, &end);
+    int holding = 0;
+    size_t offset = 0;
+    int status = SUCCESS;
+    int more = 1;
+    
+    while (status == SUCCESS && more) {
+        if (!holding && start - offset > chunk->len) {
+            /* Common case: the whole line goes out as it is */
+            struct iovec line[2] = {
+                { chunk->data, chunk->len },
+                { (void *)"\n", chunk->line_end ? 1 : 0 }
+            };
+            if (output_stream_writev(run->out, line, 2) != SUCCESS) {
+                fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+                return ERR_FILE_WRITE;
+            }
+        } else {
+            size_t i = 0;
+            while (status == SUCCESS && i < chunk->len) {
+                size_t at = offset + i;
+                size_t n;
+                if (!holding && at < start) {
+                    n = (start - at < chunk->len - i) ? start - at : chunk->len - i;
+                    status = write_fasta_bytes(run, chunk->data + i, n);
+                    i += n;
+                    continue;
+                }
+                
+                if (!holding) {
+                    hold->len = 0;
+                    holding = 1;
+                }
+                n = (end - at < chunk->len - i) ? end - at : chunk->len - i;
+                buffer_append(hold, chunk->data + i, n);
+                i += n;
+                if (offset + i == end) {
+                    /* The group lies inside the record, so every replacement fits */
+                    status = release_hold(run, start, end, SIZE_MAX);
+                    holding = 0;
+                    next_cluster(run, &next, &start, &end);
+                }
+            }
+            if (status == SUCCESS && chunk->line_end) {
+                if (holding) {
+                    buffer_append(hold, "\n", 1);
+                } else {
+                    status = write_fasta_bytes(run, "\n", 1);
+                }
+            }
+        }
+        
+        offset += chunk->len;
+        more = fasta_reader_next_chunk(reader, chunk);
+        if (more < 0) {
+            return ERR_FILE_READ;
+        }
+    }
+    
+    /* Groups reaching past the end of the record: apply what fits */
+    while (status == SUCCESS && start != SIZE_MAX) {
+        if (!holding) {
+            hold->len = 0;
+        }
+        status = release_hold(run, start, end, offset);
+        holding = 0;
+        next_cluster(run, &next, &start, &end);
+    }
+    
+    *seq_len = offset;
+    return status;
+}
+
+/* Log and count the planned replacements of a record that were applied */
+static void report_planned(ReplaceRun *run, const char *id) {
+    const ReplacerConfig *config = run->config;
+    
+    for (size_t i = 0; i < run->plan_len; i++) {
+        const PlannedEdit *edit = &run->plan[i];
+        if (!edit->applied) {
+            continue;
+        }
+        if (edit->line == 0) {
+            report_replacement(config, run->log_fp, id, edit->position, edit->original,
+                               edit->sequence);
+        } else {
+            if (run->log_fp != NULL) {
+                ReplacementRecord rep_record;
+                rep_record.seq_id = (char *)id;
+                rep_record.position = edit->position;
+                rep_record.original_seq = edit->original;
+                rep_record.new_seq = (char *)edit->sequence;
+                log_replacement(run->log_fp, &rep_record);
+            }
+            if (config->verbose) {
+                printf("Replaced in %s at position %zu: %s -> %s (edit line %zu)\n",
+                       id, edit->position, edit->original, edit->sequence, edit->line);
+            }
+        }
+        run->replacement_count++;
+    }
+}
+
+/* Move to the next FASTA record with sequence and read its first chunk;
+ * returns 1, or 0 at end of input or on an error (then read_failed is set).
+ * Records without sequence are dropped. */
+static int next_fasta_record(ReplaceRun *run, FastaChunk *chunk) {
+    int result;
+    while ((result = fasta_reader_next_record(run->fasta)) > 0) {
+        result = fasta_reader_next_chunk(run->fasta, chunk);
+        if (result != 0) {
+            break;
+        }
+    }
+    if (result <= 0) {
+        run->read_failed = (result < 0);
+        return 0;
+    }
+    
+    run->record_count++;
+    run->plan_len = 0;
+    return 1;
+}
+
+/* Stream the current record with its planned edits and report the ones
+ * that fit */
+static int write_fasta_record(ReplaceRun *run, FastaChunk *chunk) {
+    size_t seq_len;
+    int status = stream_fasta_record(run, chunk, &seq_len);
+    if (status == SUCCESS) {
+        report_planned(run, run->fasta->header);
+    }
+    return status;
+}
+
+/* Per-mode streaming FASTA loops, built like the FASTQ ones. FASTA runs
+ * use a single replacement sequence. */
+
+/* Single mode: only the target record is replaced */
+static int loop_fasta_single(ReplaceRun *run) {
+    const size_t target = run->config->target_read_index;
+    FastaChunk chunk;
+    int status = SUCCESS;
+    
+    while (status == SUCCESS && next_fasta_record(run, &chunk)) {
+        if (run->record_count == target) {
+            plan_edit(run, run->config->position, run->replacements[0], run->repl_lens[0]);
+        }
+        status = write_fasta_record(run, &chunk);
+    }
+    return status;
+}
+
+/* Position mode: the same offset in every record. Records are streamed
+ * in chunks rather than gathered into batches, so -t only speeds up the
+ * gzip input and output here. */
+static int loop_fasta_position(ReplaceRun *run) {
+    const size_t position = run->config->position;
+    FastaChunk chunk;
+    int status = SUCCESS;
+    
+    if (run->config->threads > 1) {
+        fprintf(stderr, "Warning: position mode edits FASTA records on one thread; "
+                "-t only applies to .gz input and output\n");
+    }
+    
+    while (status == SUCCESS && next_fasta_record(run, &chunk)) {
+        plan_edit(run, position, run->replacements[0], run->repl_lens[0]);
+        status = write_fasta_record(run, &chunk);
+    }
+    return status;
+}
+
+/* Edits mode: edits for each record come from the edit set */
+static int loop_fasta_edits(ReplaceRun *run) {
+    FastaChunk chunk;
+    int status = SUCCESS;
+    
+    while (status == SUCCESS && next_fasta_record(run, &chunk)) {
+        plan_record_edits(run, run->fasta->header, run->fasta->header_len);
+        status = write_fasta_record(run, &chunk);
+    }
+    return status;
+}
+
+/* Random modes: one record is picked by reservoir sampling and patched in
+ * the output once the input is exhausted */
+static int loop_fasta_random(ReplaceRun *run) {
+    const ReplacerConfig *config = run->config;
+    const int random_position = (config->mode == MODE_RANDOM);
+    SampledRead *sample = safe_malloc(sizeof(SampledRead));
+    memset(sample, 0, sizeof(SampledRead));
+    FastaChunk chunk;
+    int status = SUCCESS;
+    
+    while (status == SUCCESS && next_fasta_record(run, &chunk)) {
+        if (reservoir_slot(run->record_count, 1) == 0) {
+            begin_sample(sample, run->record_count, run->first_seq_number,
+                         run->replacements[0], run->repl_lens[0], run->fasta->header);
+            PlannedEdit *edit = plan_edit(run, config->position, run->replacements[0],
+                                          run->repl_lens[0]);
+            edit->sample = sample;
+            if (random_position) {
+                /* The position depends on the length: hold the whole record */
+                edit->position = 0;
+                edit->span = SIZE_MAX;
+            }
+        }
+        status = write_fasta_record(run, &chunk);
+    }
+    
+    if (status == SUCCESS && !run->read_failed && run->record_count == 0) {
+        fprintf(stderr, "Error: No sequences found in input file\n");
+        status = ERR_INVALID_FORMAT;
+    } else if (status == SUCCESS && !run->read_failed) {
+        if (config->verbose) {
+            printf("Random mode: selected sequence #%zu out of %zu total sequences\n",
+                   sample->record_index, run->record_count);
+        }
+        run->replacement_count = apply_samples(config, run->out, run->log_fp, sample, 1, 0);
+    }
+    
+    free_samples(sample, 1);
+    return status;
+}
+
+/* Indexed FASTQ input (-x). The .fqi index takes the reader to the reads
+ * that change; everything between them goes to the output unparsed. Plain
+ * input is copied by byte range, BGZF input block by block, and blocks go
+ * to .gz output as they are, so only the chunk or block around a
+ * rewritten read is decompressed and written again. */
+
+#define INDEXED_CHUNK_SIZE (1024 * 1024)
+
+struct IndexedInput {
+    int fd;
+    FastqIndex *index;
+    OutputStream *out;
+    int raw_blocks;           /* BGZF input and .gz output: copy blocks as they are */
+    BgzfInflater inflater;
+    unsigned char *block;     /* BGZF: compressed block */
+    char *data;               /* Decompressed block, or a chunk of plain input */
+    size_t data_len;
+    size_t data_pos;          /* Bytes before this have been written or consumed */
+    off_t data_offset;        /* File offset of the block or chunk */
+    off_t next_offset;        /* File offset just after it */
+    off_t end_offset;         /* End of the data to copy (before a BGZF EOF block) */
+    size_t record;            /* 0-based number of the record at data_pos */
+    int mid_line;             /* data_pos is not at the start of a line */
+    ByteBuffer text;          /* Lines of the record being rewritten */
+};
+
+/* Load the block or chunk at offset; returns 1, 0 at end of input or -1 */
+static int indexed_load(IndexedInput *in, off_t offset) {
+    in->data_offset = offset;
+    in->data_pos = 0;
+    in->data_len = 0;
+    in->next_offset = offset;
+    if (offset >= in->end_offset) {
+        return 0;
+    }
+    
+    if (!in->index->is_bgzf) {
+        size_t want = (size_t)(in->end_offset - offset);
+        ssize_t n = pread(in->fd, in->data, want < INDEXED_CHUNK_SIZE ? want : INDEXED_CHUNK_SIZE,
+                          offset);
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;  /* File shrank since it was indexed */
+            }
+            return -1;
+        }
+        in->data_len = (size_t)n;
+        in->next_offset = offset + n;
+        return 1;
+    }
+    
+    ssize_t block_len = bgzf_read_block(in->fd, offset, in->block);
+    if (block_len <= 0 ||
+        !bgzf_inflate_block(&in->inflater, in->block, (size_t)block_len,
+                            (unsigned char *)in->data, BGZF_MAX_BLOCK_SIZE, &in->data_len)) {
+        if (block_len >= 0 || errno == 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    in->next_offset = offset + block_len;
+    return 1;
+}
+
+/* Send the input bytes in [from, to) to the output unchanged; the reader
+ * is then at to, with nothing loaded */
+static int indexed_copy(IndexedInput *in, off_t from, off_t to) {
+    int status = SUCCESS;
+    
+    if (to > from && (!in->index->is_bgzf || in->raw_blocks)) {
+        if (lseek(in->fd, from, SEEK_SET) < 0) {
+            return ERR_FILE_READ;
+        }
+        status = in->raw_blocks ? output_stream_copy_blocks(in->out, in->fd, (size_t)(to - from))
+                                : output_stream_copy_fd(in->out, in->fd, (size_t)(to - from));
+    } else {
+        /* BGZF input to plain output: decompress the blocks */
+        off_t offset = from;
+        while (status == SUCCESS && offset < to) {
+            if (indexed_load(in, offset) < 0) {
+                return ERR_FILE_READ;
+            }
+            status = output_stream_write(in->out, in->data, in->data_len);
+            offset = in->next_offset;
+        }
+    }
+    
+    in->data_offset = to;
+    in->next_offset = to;
+    in->data_len = 0;
+    in->data_pos = 0;
+    in->mid_line = 0;
+    return status;
+}
+
+/* Move past nlines lines (a multiple of 4 from the start of a record),
+ * writing them to the output, or appending them to capture; blank lines
+ * between records go along but do not count, as in the index. Stops early
+ * at the end of the input. */
+static int indexed_pass_lines(IndexedInput *in, size_t nlines, ByteBuffer *capture) {
+    while (nlines > 0) {
+        if (in->data_pos == in->data_len) {
+            int loaded = indexed_load(in, in->next_offset);
+            if (loaded < 0) {
+                return ERR_FILE_READ;
+            }
+            if (loaded == 0) {
+                break;
+            }
+            continue;
+        }
+        
+        const char *start = in->data + in->data_pos;
+        const char *end = in->data + in->data_len;
+        const char *p = start;
+        while (nlines > 0 && p < end) {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            if (nl == NULL) {
+                p = end;
+                break;
+            }
+            int blank = !in->mid_line && (nl == p || (nl == p + 1 && *p == '\r'));
+            if (!blank || nlines % 4 != 0) {
+                nlines--;
+            }
+            p = nl + 1;
+            in->mid_line = 0;
+        }
+        
+        size_t n = (size_t)(p - start);
+        if (n > 0) {
+            in->mid_line = (p[-1] != '\n');
+        }
+        if (capture != NULL) {
+            buffer_append(capture, start, n);
+        } else if (output_stream_write(in->out, start, n) != SUCCESS) {
+            return ERR_FILE_WRITE;
+        }
+        in->data_pos += n;
+    }
+    return SUCCESS;
+}
+
+/* Write everything up to the start of record (0-based, ascending across
+ * calls), jumping over whole blocks or ranges where the index allows */
+static int indexed_seek(IndexedInput *in, size_t record) {
+    uint64_t offset;
+    size_t checkpoint = fastq_index_locate(in->index, record, &offset);
+    int status = SUCCESS;
+    
+    if (checkpoint > in->record) {
+        if (!in->index->is_bgzf) {
+            status = indexed_copy(in, in->data_offset + (off_t)in->data_pos, (off_t)offset);
+            in->record = checkpoint;
+        } else if ((off_t)(offset >> 16) >= in->next_offset) {
+            /* The checkpoint is in a later block: finish this one, copy
+             * the blocks in between, then start inside the block */
+            off_t block = (off_t)(offset >> 16);
+            size_t within = (size_t)(offset & 0xffff);
+            status = output_stream_write(in->out, in->data + in->data_pos,
+                                         in->data_len - in->data_pos);
+            if (status == SUCCESS) {
+                status = indexed_copy(in, in->next_offset, block);
+            }
+            if (status == SUCCESS && within > 0) {
+                if (indexed_load(in, block) <= 0 || within > in->data_len) {
+                    return ERR_FILE_READ;
+                }
+                in->data_pos = within;
+                status = output_stream_write(in->out, in->data, within);
+            }
+            in->record = checkpoint;
+        }
+    }
+    
+    if (status == SUCCESS) {
+        status = indexed_pass_lines(in, (record - in->record) * 4, NULL);
+        in->record = record;
+    }
+    return status;
+}
+
+/* Read the record at the current position into rec */
+static int indexed_read(IndexedInput *in, SeqRecord *rec) {
+    ByteBuffer *text = &in->text;
+    text->len = 0;
+    
+    int status = indexed_pass_lines(in, 4, text);
+    if (status != SUCCESS) {
+        return status;
+    }
+    buffer_append(text, "\n", 1);  /* Terminates an unterminated last line */
+    
+    /* Blank lines before the record go to the output as they are */
+    char *p = text->data;
+    char *end = text->data + text->len - 1;
+    while (p < end && (p[0] == '\n' || (p[0] == '\r' && p[1] == '\n'))) {
+        p += (p[0] == '\r') ? 2 : 1;
+    }
+    if (p > text->data && output_stream_write(in->out, text->data,
+                                              (size_t)(p - text->data)) != SUCCESS) {
+        return ERR_FILE_WRITE;
+    }
+    end = text->data + text->len;
+    
+    char *line[4];
+    size_t line_len[4];
+    for (int i = 0; i < 4; i++) {
+        char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (nl == NULL || (i < 3 && nl == end - 1)) {
+            errno = EINVAL;
+            return ERR_INVALID_FORMAT;
+        }
+        line[i] = p;
+        line_len[i] = trim_newline_len(p, (size_t)(nl - p) + 1);
+        p = nl + 1;
+    }
+    
+    FastqRecord *record = &rec->fastq;
+    record->seq_id = line[0];
+    record->seq_id_len = line_len[0];
+    if (record->seq_id[0] == '@') {
+        record->seq_id++;
+        record->seq_id_len--;
+    }
+    record->sequence = line[1];
+    record->sequence_len = line_len[1];
+    record->plus_line = line[2];
+    record->plus_line_len = line_len[2];
+    record->quality = line[3];
+    record->quality_len = line_len[3];
+    
+    rec->id = record->seq_id;
+    rec->id_len = record->seq_id_len;
+    rec->seq = record->sequence;
+    rec->seq_len = record->sequence_len;
+    in->record++;
+    return SUCCESS;
+}
+
+/* Write the rest of the input unchanged */
+static int indexed_finish(IndexedInput *in) {
+    int status;
+    if (!in->index->is_bgzf) {
+        status = indexed_copy(in, in->data_offset + (off_t)in->data_pos, in->end_offset);
+    } else {
+        status = output_stream_write(in->out, in->data + in->data_pos, in->data_len - in->data_pos);
+        if (status == SUCCESS) {
+            status = indexed_copy(in, in->next_offset, in->end_offset);
+        }
+    }
+    
+    /* Rewritten records end in a newline; so does the copied last one */
+    if (status == SUCCESS && in->index->missing_newline && in->record < in->index->num_records) {
+        status = output_stream_write(in->out, "\n", 1);
+    }
+    in->record = in->index->num_records;
+    return status;
+}
+
+/* Load <input>.fqi, or build and save it if it is missing or out of date */
+static FastqIndex* open_fastq_index(const ReplacerConfig *config) {
+    char *path = fastq_index_path(config->input_file);
+    FastqIndex *index = fastq_index_load(path, config->input_file);
+    
+    if (index == NULL) {
+        if (config->verbose) {
+            printf("Building index %s\n", path);
+        }
+        index = fastq_index_build(config->input_file, FASTQ_INDEX_INTERVAL);
+        if (index != NULL && fastq_index_save(index, path) != SUCCESS) {
+            fprintf(stderr, "Warning: Cannot save index '%s': %s\n", path, strerror(errno));
+        }
+    }
+    if (index != NULL && config->verbose) {
+        printf("Index %s: %zu reads, a checkpoint every %zu\n",
+               path, index->num_records, index->interval);
+    }
+    
+    free(path);
+    return index;
+}
+
+/* Open the input and its index; the output is set once it is open */
+static IndexedInput* indexed_open(const ReplacerConfig *config) {
+    FastqIndex *index = open_fastq_index(config);
+    if (index == NULL) {
+        return NULL;
+    }
+    
+    int fd = open(config->input_file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open input file '%s': %s\n",
+                config->input_file, strerror(errno));
+        fastq_index_free(index);
+        return NULL;
+    }
+    
+    IndexedInput *in = safe_malloc(sizeof(IndexedInput));
+    memset(in, 0, sizeof(IndexedInput));
+    in->fd = fd;
+    in->index = index;
+    in->end_offset = (off_t)index->file_size;
+    
+    if (index->is_bgzf) {
+        in->block = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+        in->data = safe_malloc(BGZF_MAX_BLOCK_SIZE);
+        bgzf_inflater_init(&in->inflater);
+        
+        /* The output gets an EOF block of its own */
+        unsigned char tail[BGZF_EOF_SIZE];
+        if (in->end_offset >= BGZF_EOF_SIZE &&
+            pread(fd, tail, BGZF_EOF_SIZE, in->end_offset - BGZF_EOF_SIZE) == BGZF_EOF_SIZE &&
+            memcmp(tail, BGZF_EOF_BLOCK, BGZF_EOF_SIZE) == 0) {
+            in->end_offset -= BGZF_EOF_SIZE;
+        }
+    } else {
+        in->data = safe_malloc(INDEXED_CHUNK_SIZE);
+    }
+    return in;
+}
+
+static void indexed_set_output(IndexedInput *in, OutputStream *out) {
+    in->out = out;
+    in->raw_blocks = in->index->is_bgzf && output_stream_is_compressed(out);
+}
+
+static void indexed_close(IndexedInput *in) {
+    if (in == NULL) {
+        return;
+    }
+    close(in->fd);
+    fastq_index_free(in->index);
+    bgzf_inflater_free(&in->inflater);
+    free(in->block);
+    free(in->data);
+    free(in->text.data);
+    free(in);
+}
+
+/* Report a failure of the indexed reader */
+static int indexed_error(ReplaceRun *run, int status) {
+    if (status == ERR_FILE_READ) {
+        fprintf(stderr, "Error: Failed to read input file '%s': %s\n",
+                run->config->input_file, strerror(errno));
+    } else if (status == ERR_INVALID_FORMAT) {
+        fprintf(stderr, "Error: Incomplete FASTQ record #%zu in '%s'\n",
+                run->indexed->record + 1, run->config->input_file);
+    } else if (status != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+    }
+    return status;
+}
+
+/* Single mode through the index */
+static int loop_single_indexed(ReplaceRun *run) {
+    IndexedInput *in = run->indexed;
+    const size_t target = run->config->target_read_index;
+    const size_t position = run->config->position;
+    const size_t len = run->repl_lens[0];
+    SeqRecord rec;
+    int status = SUCCESS;
+    
+    if (target <= in->index->num_records) {
+        status = indexed_seek(in, target - 1);
+        if (status == SUCCESS) {
+            status = indexed_read(in, &rec);
+        }
+        if (status == SUCCESS) {
+            if (rec.seq_len >= position + len) {
+                replace_in_record(run, &rec, position, run->replacements[0], len);
+            }
+            if (write_record(run, &rec) != SUCCESS) {
+                return ERR_FILE_WRITE;
+            }
+        }
+    }
+    
+    if (status == SUCCESS) {
+        status = indexed_finish(in);
+    }
+    run->record_count = in->index->num_records;
+    return indexed_error(run, status);
+}
+
+/* Edits mode through the index (edits by read number only) */
+static int loop_edits_indexed(ReplaceRun *run) {
+    IndexedInput *in = run->indexed;
+    SeqRecord rec;
+    size_t next;
+    int status = SUCCESS;
+    
+    while (status == SUCCESS && (next = edit_set_next_index(run->edits)) != 0 &&
+           next <= in->index->num_records) {
+        status = indexed_seek(in, next - 1);
+        if (status == SUCCESS) {
+            status = indexed_read(in, &rec);
+        }
+        if (status == SUCCESS) {
+            run->record_count = next;
+            apply_edits(run, &rec);
+            if (write_record(run, &rec) != SUCCESS) {
+                return ERR_FILE_WRITE;
+            }
+        }
+    }
+    
+    if (status == SUCCESS) {
+        status = indexed_finish(in);
+    }
+    run->record_count = in->index->num_records;
+    return indexed_error(run, status);
+}
+
+/* A read picked by the indexed random modes */
+typedef struct {
+    size_t record_index;      /* 1-based */
+    int slot;                 /* Replacement sequence used */
+} IndexedPick;
+
+static int compare_picks(const void *a, const void *b) {
+    const IndexedPick *x = a;
+    const IndexedPick *y = b;
+    return (x->record_index > y->record_index) - (x->record_index < y->record_index);
+}
+
+/* Random modes through the index: the read count is known, so the reads
+ * are drawn up front instead of by reservoir sampling */
+static int loop_random_indexed(ReplaceRun *run) {
+    const ReplacerConfig *config = run->config;
+    IndexedInput *in = run->indexed;
+    const size_t total = in->index->num_records;
+    const int random_position = (config->mode == MODE_RANDOM);
+    
+    if (total == 0) {
+        fprintf(stderr, "Error: No reads found in input file\n");
+        return ERR_INVALID_FORMAT;
+    }
+    
+    /* Distinct reads; slot i uses replacement sequence i */
+    int selected = (total < (size_t)run->num_replacements) ? (int)total : run->num_replacements;
+    IndexedPick *picks = safe_malloc(sizeof(IndexedPick) * selected);
+    for (int i = 0; i < selected; i++) {
+        size_t r;
+        int taken;
+        do {
+            r = random_below(total) + 1;
+            taken = 0;
+            for (int j = 0; j < i && !taken; j++) {
+                taken = (picks[j].record_index == r);
+            }
+        } while (taken);
+        picks[i].record_index = r;
+        picks[i].slot = i;
+    }
+    qsort(picks, (size_t)selected, sizeof(IndexedPick), compare_picks);
+    
+    if (config->verbose) {
+        printf("Random mode: selected %d reads out of %zu total reads: ", selected, total);
+        for (int i = 0; i < selected; i++) {
+            printf("#%zu%s", picks[i].record_index, i < selected - 1 ? ", " : "\n");
+        }
+    }
+    
+    SeqRecord rec;
+    int status = SUCCESS;
+    for (int i = 0; i < selected && status == SUCCESS; i++) {
+        const int slot = picks[i].slot;
+        const char *replacement = run->replacements[slot];
+        const size_t len = run->repl_lens[slot];
+        
+        status = indexed_seek(in, picks[i].record_index - 1);
+        if (status == SUCCESS) {
+            status = indexed_read(in, &rec);
+        }
+        if (status != SUCCESS) {
+            break;
+        }
+        
+        size_t position = random_position ? find_random_position(rec.seq_len, len)
+                                          : config->position;
+        if (rec.seq_len >= position + len) {
+            const char *original = replace_segment(&run->saved, rec.seq, position,
+                                                   replacement, len);
+            if (run->log_fp != NULL) {
+                ReplacementRecord rep_record;
+                rep_record.seq_id = rec.id;
+                rep_record.position = position;
+                rep_record.original_seq = (char *)original;
+                rep_record.new_seq = (char *)replacement;
+                log_replacement(run->log_fp, &rep_record);
+            }
+            if (config->verbose) {
+                printf("Replaced in %s at position %zu: %s -> %s (seq #%d)\n",
+                       rec.id, position, original, replacement, run->first_seq_number + slot);
+            }
+            run->replacement_count++;
+        }
+        if (write_record(run, &rec) != SUCCESS) {
+            free(picks);
+            return ERR_FILE_WRITE;
+        }
+    }
+    free(picks);
+    
+    if (status == SUCCESS) {
+        status = indexed_finish(in);
+    }
+    run->record_count = total;
+    return indexed_error(run, status);
+}
+
+/* Indexed FASTA input (-x). The .fai index gives the file offset of every
+ * base, so only the bytes a replacement covers are read and patched; the
+ * rest of the file goes to the output as unchanged byte ranges
+ * (copy_file_range() for plain output), or with --in-place is not touched
+ * at all. The output keeps the input byte for byte, line ends included,
+ * and so keeps the records without sequence that the streaming loops
+ * drop. */
+
+struct FaiInput {
+    int fd;                   /* Read-write with --in-place */
+    FastaIndex *index;
+    char *index_path;
+    uint64_t file_size;
+    uint64_t copied;          /* Input before this offset is in the output */
+    ByteBuffer header;        /* Header of the record being patched */
+};
+
+/* Load <input>.fai, or build and save it if it is missing or out of date */
+static FastaIndex* open_fasta_index(const ReplacerConfig *config, const char *path) {
+    FastaIndex *index = fasta_index_load(path, config->input_file);
+    
+    if (index == NULL) {
+        if (config->verbose) {
+            printf("Building index %s\n", path);
+        }
+        index = fasta_index_build(config->input_file);
+        if (index != NULL && fasta_index_save(index, path) != SUCCESS) {
+            fprintf(stderr, "Warning: Cannot save index '%s': %s\n", path, strerror(errno));
+        }
+    }
+    if (index != NULL && config->verbose) {
+        printf("Index %s: %zu sequences\n", path, index->num_entries);
+    }
+    return index;
+}
+
+static FaiInput* fai_open(const ReplacerConfig *config) {
+    char *path = fasta_index_path(config->input_file);
+    FastaIndex *index = open_fasta_index(config, path);
+    if (index == NULL) {
+        free(path);
+        return NULL;
+    }
+    
+    struct stat st;
+    int fd = open(config->input_file, config->in_place ? O_RDWR : O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open input file '%s': %s\n",
+                config->input_file, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        fasta_index_free(index);
+        free(path);
+        return NULL;
+    }
+    
+    FaiInput *in = safe_malloc(sizeof(FaiInput));
+    memset(in, 0, sizeof(FaiInput));
+    in->fd = fd;
+    in->index = index;
+    in->index_path = path;
+    in->file_size = (uint64_t)st.st_size;
+    return in;
+}
+
+static void fai_close(FaiInput *in) {
+    if (in == NULL) {
+        return;
+    }
+    close(in->fd);
+    fasta_index_free(in->index);
+    free(in->index_path);
+    free(in->header.data);
+    free(in);
+}
+
+/* Read len bytes at offset into buf; a short read means the file no
+ * longer matches its index */
+static int fai_pread(FaiInput *in, char *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(in->fd, buf + done, len - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return ERR_FILE_READ;
+        }
+        done += (size_t)n;
+    }
+    return SUCCESS;
+}
+
+/* Read the header line of a record (the line before its first base) into
+ * in->header, from its '>' up to the line end, NUL-terminated */
+static int fai_read_header(FaiInput *in, const FastaIndexEntry *entry) {
+    ByteBuffer *header = &in->header;
+    char chunk[4096];
+    uint64_t end = (entry->offset > 0) ? entry->offset - 1 : 0;  /* Its '\n' */
+    uint64_t start = end;
+    int found = 0;
+    
+    /* Walk back to the newline before the header line */
+    while (!found && start > 0) {
+        size_t n = (start < sizeof(chunk)) ? (size_t)start : sizeof(chunk);
+        if (fai_pread(in, chunk, n, start - n) != SUCCESS) {
+            return ERR_FILE_READ;
+        }
+        size_t i = n;
+        while (i > 0 && chunk[i - 1] != '\n') {
+            i--;
+        }
+        found = (i > 0);
+        start -= n - i;
+    }
+    
+    header->len = 0;
+    if (header->capacity < end - start + 1) {
+        header->capacity = (size_t)(end - start + 1);
+        header->data = safe_realloc(header->data, header->capacity);
+    }
+    if (fai_pread(in, header->data, (size_t)(end - start) + 1, start) != SUCCESS) {
+        return ERR_FILE_READ;
+    }
+    
+    /* A stale index would not point just past a header line */
+    if (entry->offset == 0 || header->data[end - start] != '\n' || header->data[0] != '>') {
+        return ERR_INVALID_FORMAT;
+    }
+    header->len = (size_t)(end - start);
+    while (header->len > 0 && header->data[header->len - 1] == '\r') {
+        header->len--;
+    }
+    header->data[header->len] = '\0';
+    return SUCCESS;
+}
+
+/* Send the input up to offset to the output unchanged */
+static int fai_copy_to(ReplaceRun *run, uint64_t offset) {
+    FaiInput *in = run->fai;
+    int status = SUCCESS;
+    
+    if (run->out != NULL && offset > in->copied) {
+        if (lseek(in->fd, (off_t)in->copied, SEEK_SET) < 0) {
+            return ERR_FILE_READ;
+        }
+        status = output_stream_copy_fd(run->out, in->fd, (size_t)(offset - in->copied));
+    }
+    in->copied = offset;
+    return status;
+}
+
+/* Read the bytes holding bases [start, end) of a record, apply the
+ * planned replacements to them and write them to the output, or back to
+ * the input with --in-place */
+static int fai_patch_range(ReplaceRun *run, const FastaIndexEntry *entry, size_t start, size_t end) {
+    FaiInput *in = run->fai;
+    ByteBuffer *hold = &run->hold;
+    uint64_t from = fasta_index_offset(entry, start);
+    uint64_t to = fasta_index_offset(entry, end - 1) + 1;
+    if (to > in->file_size) {
+        return ERR_INVALID_FORMAT;
+    }
+    
+    int status = fai_copy_to(run, from);
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    size_t len = (size_t)(to - from);
+    if (hold->capacity < len) {
+        hold->capacity = len * 2;
+        hold->data = safe_realloc(hold->data, hold->capacity);
+    }
+    if (fai_pread(in, hold->data, len, from) != SUCCESS) {
+        return ERR_FILE_READ;
+    }
+    hold->len = len;
+    
+    /* A stale index would point at the wrong bytes */
+    size_t bases = 0;
+    for (size_t i = 0; i < len; i++) {
+        bases += !is_line_break(hold->data[i]) && hold->data[i] != '>';
+    }
+    if (bases != end - start) {
+        return ERR_INVALID_FORMAT;
+    }
+    
+    patch_hold(run, start, end, (size_t)entry->length);
+    if (run->out != NULL) {
+        status = output_stream_write(run->out, hold->data, len);
+    } else if (lseek(in->fd, (off_t)from, SEEK_SET) < 0) {
+        status = ERR_FILE_WRITE;
+    } else {
+        status = write_fd_all(in->fd, hold->data, len);
+    }
+    in->copied = to;
+    return status;
+}
+
+/* Apply the plan to one record, a group of overlapping replacements at a time */
+static int fai_patch_record(ReplaceRun *run, const FastaIndexEntry *entry) {
+    const size_t length = (size_t)entry->length;
+    size_t next = 0;
+    size_t start;
+    size_t end;
+    int status = SUCCESS;
+    
+    order_plan(run);
+    next_cluster(run, &next, &start, &end);
+    while (status == SUCCESS && start < length) {
+        status = fai_patch_range(run, entry, start, (end < length) ? end : length);
+        next_cluster(run, &next, &start, &end);
+    }
+    return status;
+}
+
+/* Report a failure of the indexed FASTA path */
+static int fai_error(ReplaceRun *run, int status) {
+    const char *input = run->config->input_file;
+    if (status == ERR_FILE_READ) {
+        fprintf(stderr, "Error: Failed to read input file '%s': %s\n", input, strerror(errno));
+    } else if (status == ERR_INVALID_FORMAT) {
+        fprintf(stderr, "Error: '%s' does not match its index '%s'; delete the index to "
+                "rebuild it\n", input, run->fai->index_path);
+    } else if (status != SUCCESS && run->out == NULL) {
+        fprintf(stderr, "Error: Failed to patch '%s': %s\n", input, strerror(errno));
+    } else if (status != SUCCESS) {
+        fprintf(stderr, "Error: Failed to write record: %s\n", strerror(errno));
+    }
+    return status;
+}
+
+/* Patch the planned edits of a record into the output and report them */
+static int fai_write_planned(ReplaceRun *run, const FastaIndexEntry *entry) {
+    int status = fai_read_header(run->fai, entry);
+    if (status == SUCCESS) {
+        status = fai_patch_record(run, entry);
+    }
+    if (status == SUCCESS) {
+        report_planned(run, run->fai->header.data + 1);
+    }
+    return status;
+}
+
+/* Copy the input after the last patched record and finish the run */
+static int fai_finish(ReplaceRun *run, int status) {
+    FaiInput *in = run->fai;
+    
+    if (status == SUCCESS) {
+        status = fai_copy_to(run, in->file_size);
+    }
+    if (status == SUCCESS && run->out == NULL) {
+        /* The layout is unchanged: keep the index from looking out of date */
+        utimensat(AT_FDCWD, in->index_path, NULL, 0);
+    }
+    return fai_error(run, status);
+}
+
+/* Records with sequence; the others are not counted, as when streaming */
+static size_t fai_count_records(const FastaIndex *index) {
+    size_t total = 0;
+    for (size_t i = 0; i < index->num_entries; i++) {
+        total += (index->entries[i].length > 0);
+    }
+    return total;
+}
+
+/* The n-th record with sequence (1-based), or NULL */
+static const FastaIndexEntry* fai_find_record(const FastaIndex *index, size_t n) {
+    for (size_t i = 0; i < index->num_entries; i++) {
+        if (index->entries[i].length > 0 && --n == 0) {
+            return &index->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Single mode through the .fai index */
+static int loop_fasta_single_indexed(ReplaceRun *run) {
+    const FastaIndex *index = run->fai->index;
+    const FastaIndexEntry *entry = fai_find_record(index, run->config->target_read_index);
+    int status = SUCCESS;
+    
+    run->plan_len = 0;
+    if (entry != NULL) {
+        plan_edit(run, run->config->position, run->replacements[0], run->repl_lens[0]);
+        status = fai_write_planned(run, entry);
+    }
+    run->record_count = fai_count_records(index);
+    return fai_finish(run, status);
+}
+
+/* Position mode through the .fai index: every record is patched */
+static int loop_fasta_position_indexed(ReplaceRun *run) {
+    const FastaIndex *index = run->fai->index;
+    const size_t position = run->config->position;
+    int status = SUCCESS;
+    
+    for (size_t i = 0; i < index->num_entries && status == SUCCESS; i++) {
+        const FastaIndexEntry *entry = &index->entries[i];
+        if (entry->length == 0) {
+            continue;
+        }
+        run->record_count++;
+        run->plan_len = 0;
+        plan_edit(run, position, run->replacements[0], run->repl_lens[0]);
+        status = fai_write_planned(run, entry);
+    }
+    return fai_finish(run, status);
+}
+
+/* Edits mode through the .fai index: records without edits are copied */
+static int loop_fasta_edits_indexed(ReplaceRun *run) {
+    const FastaIndex *index = run->fai->index;
+    int status = SUCCESS;
+    
+    for (size_t i = 0; i < index->num_entries && status == SUCCESS; i++) {
+        const FastaIndexEntry *entry = &index->entries[i];
+        if (entry->length == 0) {
+            continue;
+        }
+        run->record_count++;
+        run->plan_len = 0;
+        plan_record_edits(run, entry->name, strlen(entry->name));
+        if (run->plan_len > 0) {
+            status = fai_write_planned(run, entry);
+        }
+    }
+    return fai_finish(run, status);
+}
+
+/* Random modes through the .fai index. The record count and lengths are
+ * known up front, so the record is drawn directly (the same seed picks a
+ * different record than without -x) and its position is picked before
+ * reading any of it. */
+static int loop_fasta_random_indexed(ReplaceRun *run) {
+    const ReplacerConfig *config = run->config;
+    const FastaIndex *index = run->fai->index;
+    const size_t total = fai_count_records(index);
+    
+    if (total == 0) {
+        fprintf(stderr, "Error: No sequences found in input file\n");
+        return ERR_INVALID_FORMAT;
+    }
+    size_t pick = random_below(total) + 1;
+    if (config->verbose) {
+        printf("Random mode: selected sequence #%zu out of %zu total sequences\n",
+               pick, total);
+    }
+    
+    const FastaIndexEntry *entry = fai_find_record(index, pick);
+    size_t position = (config->mode == MODE_RANDOM)
+        ? find_random_position((size_t)entry->length, run->repl_lens[0])
+        : config->position;
+    run->plan_len = 0;
+    plan_edit(run, position, run->replacements[0], run->repl_lens[0]);
+    int status = fai_write_planned(run, entry);
+    run->record_count = total;
+    return fai_finish(run, status);
+}
+
+/* gzip input that is not BGZF, which has no blocks to seek to */
+static int is_plain_gzip(const char *filename) {
+    unsigned char header[BGZF_HEADER_SIZE];
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;  /* Reported when the input is opened */
+    }
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    return n >= 2 && header[0] == 0x1f && header[1] == 0x8b &&
+           bgzf_block_size(header, (size_t)n) == 0;
+}
+
+/* The .fqi index serves the modes that touch a few reads of a plain or
+ * BGZF FASTQ file; the .fai index serves every mode on uncompressed FASTA */
+static int can_use_index(const ReplacerConfig *config, const EditSet *edits, int is_fasta) {
+    if (is_fasta) {
+        size_t len = strlen(config->input_file);
+        return len < 3 || strcmp(config->input_file + len - 3, ".gz") != 0;
+    }
+    if (is_plain_gzip(config->input_file)) {
+        return 0;
+    }
+    switch (config->mode) {
+    case MODE_SINGLE:
+    case MODE_RANDOM:
+    case MODE_RANDOM_FIXED:
+        return 1;
+    case MODE_EDITS:
+        return edit_set_last_index(edits) != SIZE_MAX;
+    default:
+        return 0;
+    }
+}
+
+/* Replace sequences in one FASTQ or FASTA file */
+static int process_file(const ReplacerConfig *config, EditSet *edits, int is_fasta) {
+    ReplaceRun run;
+    memset(&run, 0, sizeof(run));
+    run.config = config;
+    run.edits = edits;
+    run.replacements = config->replacement_seqs;
+    run.num_replacements = config->num_replacements;
+    run.first_seq_number = 1;
+    run.read_limit = SIZE_MAX;
+    fastq_batch_init(&run.batch);
+    
+    if (is_fasta && config->num_replacements > 0) {
+        /* FASTA uses one replacement sequence, picked at random if several given */
+        if (config->num_replacements > 1) {
+            int selected_idx = rand() % config->num_replacements;
+            run.replacements = config->replacement_seqs + selected_idx;
+            run.first_seq_number = selected_idx + 1;
+            if (config->verbose) {
+                printf("Selected replacement sequence #%d: %s\n", selected_idx + 1,
+                       run.replacements[0]);
+            }
+        }
+        run.num_replacements = 1;
+    }
+    
+    int use_index = config->use_index && can_use_index(config, edits, is_fasta);
+    if (config->in_place && !(use_index && is_fasta)) {
+        fprintf(stderr, "Error: --in-place needs an uncompressed FASTA input\n");
+        return ERR_INVALID_PARAM;
+    }
+    if (config->use_index && !use_index) {
+        fprintf(stderr, "Warning: -x/--index only applies to uncompressed FASTA, and to "
+                "uncompressed or BGZF FASTQ input in single, random and read-number edits "
+                "modes; reading the whole input\n");
+    }
+    
+    /* Open input file (gzip is decompressed in-process, BGZF on the worker threads) */
+    if (use_index && is_fasta) {
+        run.fai = fai_open(config);
+        if (run.fai == NULL) {
+            return ERR_FILE_OPEN;
+        }
+    } else if (use_index) {
+        run.indexed = indexed_open(config);
+        if (run.indexed == NULL) {
+            return ERR_FILE_OPEN;
+        }
+        if (run.indexed->index->crlf) {
+            /* Rewritten reads end in '\n', the copied ones would keep "\r\n" */
+            fprintf(stderr, "Warning: -x/--index does not apply to input with CRLF line "
+                    "ends; reading the whole input\n");
+            indexed_close(run.indexed);
+            run.indexed = NULL;
+        }
+    }
+    if (run.fai == NULL && run.indexed == NULL && is_fasta) {
+        run.fasta = fasta_reader_open(config->input_file, config->threads);
+        if (run.fasta == NULL) {
+            return ERR_FILE_OPEN;
+        }
+    } else if (run.fai == NULL && run.indexed == NULL) {
+        run.fastq = fastq_reader_open_threaded(config->input_file, config->threads);
+        if (run.fastq == NULL) {
+            return ERR_FILE_OPEN;
+        }
+    }
+    
+    /* Open output file (.gz output is BGZF-compressed on the worker threads);
+     * --in-place writes to the input instead */
+    if (!config->in_place) {
+        run.out = output_stream_open(config->output_file, config->threads);
+    }
+    if (run.out == NULL && !config->in_place) {
+        if (run.fai != NULL) {
+            fai_close(run.fai);
+        } else if (run.indexed != NULL) {
+            indexed_close(run.indexed);
+        } else if (is_fasta) {
+            fasta_reader_close(run.fasta);
+        } else {
+            fastq_reader_close(run.fastq);
+        }
+        return ERR_FILE_OPEN;
+    }
+    if (run.indexed != NULL) {
+        indexed_set_output(run.indexed, run.out);
+    }
+    
+    /* Open log file */
+    run.log_fp = fopen(config->log_file, "w");
+    if (run.log_fp == NULL) {
+        fprintf(stderr, "Warning: Cannot open log file '%s'\n", config->log_file);
+    }
+    
+    /* Replacement lengths are fixed for the run */
+    run.repl_lens = safe_malloc(sizeof(size_t) * (run.num_replacements + 1));
+    for (int i = 0; i < run.num_replacements; i++) {
+        run.repl_lens[i] = strlen(run.replacements[i]);
+    }
+    
+    int status;
+    if (is_fasta) {
+        switch (config->mode) {
+        case MODE_SINGLE:
+            status = run.fai ? loop_fasta_single_indexed(&run) : loop_fasta_single(&run);
+            break;
+        case MODE_POSITION:
+            status = run.fai ? loop_fasta_position_indexed(&run) : loop_fasta_position(&run);
+            break;
+        case MODE_EDITS:
+            status = run.fai ? loop_fasta_edits_indexed(&run) : loop_fasta_edits(&run);
+            break;
+        default:
+            status = run.fai ? loop_fasta_random_indexed(&run) : loop_fasta_random(&run);
+            break;
+        }
+    } else {
+        switch (config->mode) {
+        case MODE_SINGLE:
+            status = run.indexed ? loop_single_indexed(&run) : loop_single(&run);
+            break;
+        case MODE_POSITION:
+            status = loop_position(&run);
+            break;
+        case MODE_EDITS:
+            status = run.indexed ? loop_edits_indexed(&run) : loop_edits(&run);
+            break;
+        default:
+            status = run.indexed ? loop_random_indexed(&run) : loop_random(&run);
+            break;
+        }
+    }
+    if (run.read_failed) {
+        /* The reader has reported the error; the records before it were written */
+        status = ERR_FILE_READ;
+    }
+    
+    /* Cleanup */
+    free(run.repl_lens);
+    free(run.saved.data);
+    for (size_t i = 0; i < run.plan_capacity; i++) {
+        free(run.plan[i].original);
+    }
+    free(run.plan);
+    free(run.plan_order);
+    free(run.hold.data);
+    fastq_batch_free(&run.batch);
+    if (run.fai != NULL) {
+        fai_close(run.fai);
+    } else if (run.indexed != NULL) {
+        indexed_close(run.indexed);
+    } else if (is_fasta) {
+        fasta_reader_close(run.fasta);
+    } else {
+        fastq_reader_close(run.fastq);
+    }
+    if (run.out != NULL && output_stream_close(run.out) != SUCCESS && status == SUCCESS) {
+        fprintf(stderr, "Error: Failed to write output file '%s': %s\n",
+                config->output_file, strerror(errno));
+        status = ERR_FILE_WRITE;
+    }
+    if (run.log_fp != NULL) {
+        fclose(run.log_fp);
+    }
+    
+    if (status != SUCCESS) {
+        return status;
+    }
+    
+    printf("\nReplacement completed:\n");
+    if (run.passed_through) {
+        printf("  Total sequences: not counted (input copied unchanged after read #%zu)\n",
+               run.record_count);
+    } else {
+        printf("  Total sequences: %zu\n", run.record_count);
+    }
+    printf("  Replacements made: %zu\n", run.replacement_count);
+    if (edits != NULL) {
+        printf("  Edits in file: %zu\n", edit_set_size(edits));
+    }
+    if (config->in_place) {
+        printf("  Output file: %s (patched in place)\n", config->input_file);
+    } else {
+        printf("  Output file: %s\n", config->output_file);
+    }
+    printf("  Log file: %s\n", config->log_file);
+    if (config->verbose) {
+        AllocStats alloc;
+        alloc_stats_get(&alloc);
+        printf("  Arena blocks: %zu (%.1f MB, %.3f s to allocate)\n", alloc.arena_blocks,
+               (double)alloc.arena_bytes / (1024.0 * 1024.0), alloc.arena_seconds);
+        printf("  Page faults: %ld minor, %ld major\n", alloc.minor_faults, alloc.major_faults);
+    }
+    
+    return SUCCESS;
+}
+
+int replace_sequences(const ReplacerConfig *config) {
+    if (config == NULL) {
+        return ERR_INVALID_PARAM;
+    }
+    
+    /* Initialize random seed */
+    if (config->mode == MODE_RANDOM) {
+        srand(config->seed);
+    }
+    
+    /* Load the edits file; its edits are looked up per record */
+    EditSet *edits = NULL;
+    if (config->mode == MODE_EDITS) {
+        edits = edit_set_load(config->edits_file);
+        if (edits == NULL) {
+            return ERR_INVALID_FORMAT;
+        }
+        if (config->verbose) {
+            printf("Loaded %zu edits from %s\n", edit_set_size(edits), config->edits_file);
+        }
+    }
+    
+    /* Determine file type and process */
+    int result;
+    if (is_fastq_file(config->input_file)) {
+        result = process_file(config, edits, 0);
     } else if (is_fasta_file(config->input_file)) {
-        return process_fasta(config);
+        result = process_file(config, edits, 1);
     } else {
         fprintf(stderr, "Error: Unknown file format. Use .fq, .fastq, .fa, or .fasta extensions\n");
-        return ERR_INVALID_FORMAT;
+        result = ERR_INVALID_FORMAT;
     }
+    
+    edit_set_free(edits);
+    return result;
 }
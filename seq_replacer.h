@@ -9,7 +9,8 @@ typedef enum {
     MODE_RANDOM,         /* Random replacement: one random read at random position */
     MODE_RANDOM_FIXED,   /* Random read at fixed position (fastest) */
     MODE_POSITION,       /* Position-specific replacement in all sequences */
-    MODE_SINGLE          /* Replace only one specific sequence in the entire file */
+    MODE_SINGLE,         /* Replace only one specific sequence in the entire file */
+    MODE_EDITS           /* Apply (read, position, sequence) edits from a file */
 } ReplacementMode;
 
 /* Replacement configuration */
@@ -23,8 +24,12 @@ typedef struct {
     size_t position;      /* For position/single mode: 0-based position in sequence */
     size_t target_read_index; /* For single mode: which read to replace (1-based) */
     size_t total_reads;       /* For random mode: total number of reads (set during processing) */
+    char *edits_file;         /* For edits mode: file of edits (see edit_set.h) */
     int verbose;
     unsigned int seed;    /* Random seed */
+    int threads;          /* Worker threads for position mode, .gz output and BGZF input */
+    int use_index;        /* Seek to the reads through the input's .fqi or .fai index */
+    int in_place;         /* FASTA: patch the input file instead of writing output_file */
 } ReplacerConfig;
 
 /* Replacement record for logging */
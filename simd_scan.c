@@ -0,0 +1,275 @@
+#include "simd_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef int (*ScanLinesFn)(const char *data, size_t len, size_t *ends, int max_lines);
+typedef size_t (*FindInvalidFn)(const char *data, size_t len);
+
+/* IUPAC nucleotide codes, indexed by byte */
+static const unsigned char iupac_bases[256] = {
+    ['A'] = 1, ['C'] = 1, ['G'] = 1, ['T'] = 1, ['U'] = 1, ['R'] = 1, ['Y'] = 1, ['S'] = 1,
+    ['W'] = 1, ['K'] = 1, ['M'] = 1, ['B'] = 1, ['D'] = 1, ['H'] = 1, ['V'] = 1, ['N'] = 1,
+    ['a'] = 1, ['c'] = 1, ['g'] = 1, ['t'] = 1, ['u'] = 1, ['r'] = 1, ['y'] = 1, ['s'] = 1,
+    ['w'] = 1, ['k'] = 1, ['m'] = 1, ['b'] = 1, ['d'] = 1, ['h'] = 1, ['v'] = 1, ['n'] = 1
+};
+
+static size_t find_invalid_base_from(const char *data, size_t pos, size_t len) {
+    while (pos < len && iupac_bases[(unsigned char)data[pos]]) {
+        pos++;
+    }
+    return pos;
+}
+
+static size_t find_invalid_quality_from(const char *data, size_t pos, size_t len) {
+    while (pos < len && data[pos] >= '!' && data[pos] <= '~') {
+        pos++;
+    }
+    return pos;
+}
+
+static size_t find_invalid_base_scalar(const char *data, size_t len) {
+    return find_invalid_base_from(data, 0, len);
+}
+
+static size_t find_invalid_quality_scalar(const char *data, size_t len) {
+    return find_invalid_quality_from(data, 0, len);
+}
+
+/* Finish a scan byte by byte from offset pos */
+static int scan_tail(const char *data, size_t pos, size_t len,
+                     size_t *ends, int found, int max_lines) {
+    for (; pos < len && found < max_lines; pos++) {
+        if (data[pos] == '\n') {
+            ends[found++] = pos;
+        }
+    }
+    return found;
+}
+
+static int scan_lines_scalar(const char *data, size_t len, size_t *ends, int max_lines) {
+    return scan_tail(data, 0, len, ends, 0, max_lines);
+}
+
+#ifdef SIMD_SCAN_X86
+__attribute__((target("sse2")))
+static int scan_lines_sse2(const char *data, size_t len, size_t *ends, int max_lines) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    int found = 0;
+    size_t pos = 0;
+    
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + pos));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        
+        while (mask != 0) {
+            ends[found++] = pos + (size_t)__builtin_ctz(mask);
+            if (found == max_lines) {
+                return found;
+            }
+            mask &= mask - 1;
+        }
+    }
+    
+    return scan_tail(data, pos, len, ends, found, max_lines);
+}
+
+/* SSE2 has no byte shuffle for a table lookup, so blocks of plain ACGTN
+ * (nearly all real data) are accepted by comparison and any other block
+ * is checked byte by byte */
+__attribute__((target("sse2")))
+static size_t find_invalid_base_sse2(const char *data, size_t len) {
+    const __m128i fold = _mm_set1_epi8((char)0xdf);  /* Lower case to upper */
+    const __m128i a = _mm_set1_epi8('A');
+    const __m128i c = _mm_set1_epi8('C');
+    const __m128i g = _mm_set1_epi8('G');
+    const __m128i t = _mm_set1_epi8('T');
+    const __m128i n = _mm_set1_epi8('N');
+    size_t pos = 0;
+    
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i chunk = _mm_and_si128(_mm_loadu_si128((const __m128i *)(data + pos)), fold);
+        __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, a), _mm_cmpeq_epi8(chunk, c)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(chunk, g), _mm_cmpeq_epi8(chunk, t)));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(chunk, n));
+        if (_mm_movemask_epi8(ok) != 0xffff) {
+            size_t bad = find_invalid_base_from(data, pos, pos + 16);
+            if (bad < pos + 16) {
+                return bad;
+            }
+        }
+    }
+    
+    return find_invalid_base_from(data, pos, len);
+}
+
+/* Bytes are compared as signed, so bytes >= 0x80 fall below '!' */
+__attribute__((target("sse2")))
+static size_t find_invalid_quality_sse2(const char *data, size_t len) {
+    const __m128i low = _mm_set1_epi8('!');
+    const __m128i high = _mm_set1_epi8('~');
+    size_t pos = 0;
+    
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + pos));
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi8(chunk, low), _mm_cmpgt_epi8(chunk, high));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(bad);
+        if (mask != 0) {
+            return pos + (size_t)__builtin_ctz(mask);
+        }
+    }
+    
+    return find_invalid_quality_from(data, pos, len);
+}
+
+__attribute__((target("avx2")))
+static int scan_lines_avx2(const char *data, size_t len, size_t *ends, int max_lines) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    int found = 0;
+    size_t pos = 0;
+    
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + pos));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+        
+        while (mask != 0) {
+            ends[found++] = pos + (size_t)__builtin_ctz(mask);
+            if (found == max_lines) {
+                return found;
+            }
+            mask &= mask - 1;
+        }
+    }
+    
+    return scan_tail(data, pos, len, ends, found, max_lines);
+}
+
+/* Set membership by nibble lookup: after folding to upper case, a byte is
+ * valid if the row of its high nibble (bit 0 for 0x4_, bit 1 for 0x5_) is
+ * set in the table entry of its low nibble */
+__attribute__((target("avx2")))
+static size_t find_invalid_base_avx2(const char *data, size_t len) {
+    const __m256i fold = _mm256_set1_epi8((char)0xdf);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i by_low = _mm256_setr_epi8(
+        0, 1, 3, 3, 3, 2, 2, 3, 1, 2, 0, 1, 0, 1, 1, 0,
+        0, 1, 3, 3, 3, 2, 2, 3, 1, 2, 0, 1, 0, 1, 1, 0);
+    const __m256i by_high = _mm256_setr_epi8(
+        0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t pos = 0;
+    
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i chunk = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(data + pos)), fold);
+        __m256i low = _mm256_shuffle_epi8(by_low, _mm256_and_si256(chunk, nibble));
+        __m256i high = _mm256_shuffle_epi8(by_high,
+                                           _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble));
+        __m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), zero);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(bad);
+        if (mask != 0) {
+            return pos + (size_t)__builtin_ctz(mask);
+        }
+    }
+    
+    return find_invalid_base_from(data, pos, len);
+}
+
+__attribute__((target("avx2")))
+static size_t find_invalid_quality_avx2(const char *data, size_t len) {
+    const __m256i low = _mm256_set1_epi8('!');
+    const __m256i high = _mm256_set1_epi8('~');
+    size_t pos = 0;
+    
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + pos));
+        __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi8(low, chunk), _mm256_cmpgt_epi8(chunk, high));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(bad);
+        if (mask != 0) {
+            return pos + (size_t)__builtin_ctz(mask);
+        }
+    }
+    
+    return find_invalid_quality_from(data, pos, len);
+}
+#endif
+
+static SimdBackend current_backend = SIMD_SCALAR;
+static ScanLinesFn scan_lines_impl = scan_lines_scalar;
+static FindInvalidFn find_invalid_base_impl = find_invalid_base_scalar;
+static FindInvalidFn find_invalid_quality_impl = find_invalid_quality_scalar;
+
+/* Pick the widest supported implementation before main() runs */
+__attribute__((constructor))
+static void simd_scan_select(void) {
+#ifdef SIMD_SCAN_X86
+    __builtin_cpu_init();
+    if (!simd_scan_set_backend(SIMD_AVX2)) {
+        simd_scan_set_backend(SIMD_SSE2);
+    }
+#endif
+}
+
+int simd_scan_lines(const char *data, size_t len, size_t *ends, int max_lines) {
+    if (data == NULL || ends == NULL || max_lines <= 0) {
+        return 0;
+    }
+    return scan_lines_impl(data, len, ends, max_lines);
+}
+
+size_t simd_find_invalid_base(const char *data, size_t len) {
+    return find_invalid_base_impl(data, len);
+}
+
+size_t simd_find_invalid_quality(const char *data, size_t len) {
+    return find_invalid_quality_impl(data, len);
+}
+
+int simd_scan_set_backend(SimdBackend backend) {
+    switch (backend) {
+    case SIMD_SCALAR:
+        scan_lines_impl = scan_lines_scalar;
+        find_invalid_base_impl = find_invalid_base_scalar;
+        find_invalid_quality_impl = find_invalid_quality_scalar;
+        break;
+#ifdef SIMD_SCAN_X86
+    case SIMD_SSE2:
+        if (!__builtin_cpu_supports("sse2")) {
+            return 0;
+        }
+        scan_lines_impl = scan_lines_sse2;
+        find_invalid_base_impl = find_invalid_base_sse2;
+        find_invalid_quality_impl = find_invalid_quality_sse2;
+        break;
+    case SIMD_AVX2:
+        if (!__builtin_cpu_supports("avx2")) {
+            return 0;
+        }
+        scan_lines_impl = scan_lines_avx2;
+        find_invalid_base_impl = find_invalid_base_avx2;
+        find_invalid_quality_impl = find_invalid_quality_avx2;
+        break;
+#endif
+    default:
+        return 0;
+    }
+    current_backend = backend;
+    return 1;
+}
+
+SimdBackend simd_scan_get_backend(void) {
+    return current_backend;
+}
+
+const char* simd_scan_backend_name(SimdBackend backend) {
+    switch (backend) {
+    case SIMD_SSE2:
+        return "sse2";
+    case SIMD_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
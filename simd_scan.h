@@ -0,0 +1,36 @@
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+#include <stdlib.h>
+
+/* Scanner implementations, fastest last */
+typedef enum {
+    SIMD_SCALAR,  /* Portable byte loop */
+    SIMD_SSE2,    /* 16 bytes per step (x86 baseline) */
+    SIMD_AVX2     /* 32 bytes per step (chosen at runtime when available) */
+} SimdBackend;
+
+/* All functions use the backend selected at startup. */
+
+/* Find up to max_lines '\n' bytes in data[0..len) in a single pass.
+ * Offsets of the newlines are stored in ends[]; returns how many were found. */
+int simd_scan_lines(const char *data, size_t len, size_t *ends, int max_lines);
+
+/* Offset of the first byte of data[0..len) that is not an IUPAC nucleotide
+ * code (ACGTURYSWKMBDHVN, either case), or len if every byte is one */
+size_t simd_find_invalid_base(const char *data, size_t len);
+
+/* Offset of the first byte of data[0..len) outside the Phred+33 quality
+ * range '!'..'~', or len if there is none */
+size_t simd_find_invalid_quality(const char *data, size_t len);
+
+/* Select a backend explicitly; returns 0 if the CPU does not support it */
+int simd_scan_set_backend(SimdBackend backend);
+
+/* Currently selected backend */
+SimdBackend simd_scan_get_backend(void);
+
+/* Human readable backend name */
+const char* simd_scan_backend_name(SimdBackend backend);
+
+#endif /* SIMD_SCAN_H */
@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+#include "spsc_queue.h"
+#include "utils.h"
+#include <string.h>
+#include <pthread.h>
+
+#define CACHE_LINE_SIZE 64
+#define SPIN_LIMIT 128
+
+struct SpscQueue {
+    void **items;
+    size_t capacity;
+    
+    /* Producer and consumer indices live on separate cache lines */
+    char pad0[CACHE_LINE_SIZE];
+    size_t head;   /* Items pushed, written by the producer */
+    char pad1[CACHE_LINE_SIZE];
+    size_t tail;   /* Items popped, written by the consumer */
+    char pad2[CACHE_LINE_SIZE];
+    
+    /* Sleeping once spinning has not helped */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int pop_waiting;   /* The consumer is asleep on not_empty */
+    int push_waiting;  /* The producer is asleep on not_full */
+};
+
+/* Wake the other thread if it is asleep. The fence orders the index just
+ * stored before the flag load, pairing with the one in queue_sleep(), so
+ * either the sleeper sees the new index or the flag is seen here. */
+static void queue_wake(SpscQueue *queue, int *waiting, pthread_cond_t *cond) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+static int queue_full(SpscQueue *queue) {
+    return queue->head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) >= queue->capacity;
+}
+
+static int queue_empty(SpscQueue *queue) {
+    return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->tail;
+}
+
+/* Sleep until blocked() turns false; the lock is held from setting the
+ * flag until the wait, so a wakeup cannot slip in between */
+static void queue_sleep(SpscQueue *queue, int *waiting, pthread_cond_t *cond,
+                        int (*blocked)(SpscQueue *)) {
+    pthread_mutex_lock(&queue->lock);
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (blocked(queue)) {
+        pthread_cond_wait(cond, &queue->lock);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+SpscQueue* spsc_queue_create(size_t capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    
+    SpscQueue *queue = safe_malloc(sizeof(SpscQueue));
+    memset(queue, 0, sizeof(SpscQueue));
+    queue->items = safe_malloc(sizeof(void *) * capacity);
+    queue->capacity = capacity;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    
+    return queue;
+}
+
+int spsc_queue_try_push(SpscQueue *queue, void *item) {
+    size_t head = queue->head;
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= queue->capacity) {
+        return 0;
+    }
+    
+    queue->items[head % queue->capacity] = item;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    queue_wake(queue, &queue->pop_waiting, &queue->not_empty);
+    return 1;
+}
+
+void spsc_queue_push(SpscQueue *queue, void *item) {
+    unsigned spins = 0;
+    while (!spsc_queue_try_push(queue, item)) {
+        if (spins++ >= SPIN_LIMIT) {
+            queue_sleep(queue, &queue->push_waiting, &queue->not_full, queue_full);
+        }
+    }
+}
+
+void* spsc_queue_try_pop(SpscQueue *queue) {
+    size_t tail = queue->tail;
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail == head) {
+        return NULL;
+    }
+    
+    void *item = queue->items[tail % queue->capacity];
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    queue_wake(queue, &queue->push_waiting, &queue->not_full);
+    return item;
+}
+
+void* spsc_queue_pop(SpscQueue *queue) {
+    unsigned spins = 0;
+    void *item;
+    while ((item = spsc_queue_try_pop(queue)) == NULL) {
+        if (spins++ >= SPIN_LIMIT) {
+            queue_sleep(queue, &queue->pop_waiting, &queue->not_empty, queue_empty);
+        }
+    }
+    return item;
+}
+
+void spsc_queue_destroy(SpscQueue *queue) {
+    if (queue == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+    free(queue);
+}
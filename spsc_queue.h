@@ -0,0 +1,34 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdlib.h>
+
+/* Bounded lock-free queue of pointers between exactly one producer thread
+ * and one consumer thread.
+ *
+ * The producer only writes the head index and the consumer only writes the
+ * tail index, so no lock is needed while items flow. A blocked push or pop
+ * spins briefly and then sleeps on a condition variable until the other
+ * side catches up.
+ */
+typedef struct SpscQueue SpscQueue;
+
+/* Create a queue holding up to capacity items */
+SpscQueue* spsc_queue_create(size_t capacity);
+
+/* Add a non-NULL item; returns 0 if the queue is full */
+int spsc_queue_try_push(SpscQueue *queue, void *item);
+
+/* Add an item, waiting while the queue is full */
+void spsc_queue_push(SpscQueue *queue, void *item);
+
+/* Remove the oldest item; returns NULL if the queue is empty */
+void* spsc_queue_try_pop(SpscQueue *queue);
+
+/* Remove the oldest item, waiting while the queue is empty */
+void* spsc_queue_pop(SpscQueue *queue);
+
+/* Free the queue (items are not freed) */
+void spsc_queue_destroy(SpscQueue *queue);
+
+#endif /* SPSC_QUEUE_H */
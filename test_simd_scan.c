@@ -0,0 +1,172 @@
+#include "simd_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Checks every SIMD backend the CPU supports against plain byte loops,
+ * on random buffers at random alignments. Run by "make test". */
+
+#define MAX_LEN 4096
+#define ALIGN_SLACK 64
+#define ITERATIONS 20000
+
+static const char IUPAC[] = "ACGTURYSWKMBDHVNacgturyswkmbdhvn";
+
+static unsigned long failures;
+
+static int ref_scan_lines(const char *data, size_t len, size_t *ends, int max_lines) {
+    int found = 0;
+    for (size_t i = 0; i < len && found < max_lines; i++) {
+        if (data[i] == '\n') {
+            ends[found++] = i;
+        }
+    }
+    return found;
+}
+
+static size_t ref_find_invalid_base(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\0' || strchr(IUPAC, data[i]) == NULL) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t ref_find_invalid_quality(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)data[i];
+        if (c < '!' || c > '~') {
+            return i;
+        }
+    }
+    return len;
+}
+
+static void fail(SimdBackend backend, const char *what, size_t offset, size_t len,
+                 size_t expected, size_t got) {
+    if (failures++ < 20) {
+        fprintf(stderr, "FAIL %s %s: offset %zu, length %zu: expected %zu, got %zu\n",
+                simd_scan_backend_name(backend), what, offset, len, expected, got);
+    }
+}
+
+static void check_lines(SimdBackend backend, const char *data, size_t offset, size_t len,
+                        int max_lines) {
+    size_t expected[MAX_LEN];
+    size_t got[MAX_LEN];
+    int n_expected = ref_scan_lines(data, len, expected, max_lines);
+    int n_got = simd_scan_lines(data, len, got, max_lines);
+    
+    if (n_got != n_expected) {
+        fail(backend, "simd_scan_lines count", offset, len, (size_t)n_expected, (size_t)n_got);
+        return;
+    }
+    for (int i = 0; i < n_got; i++) {
+        if (got[i] != expected[i]) {
+            fail(backend, "simd_scan_lines offset", offset, len, expected[i], got[i]);
+            return;
+        }
+    }
+}
+
+static void check_base(SimdBackend backend, const char *data, size_t offset, size_t len) {
+    size_t expected = ref_find_invalid_base(data, len);
+    size_t got = simd_find_invalid_base(data, len);
+    if (got != expected) {
+        fail(backend, "simd_find_invalid_base", offset, len, expected, got);
+    }
+}
+
+static void check_quality(SimdBackend backend, const char *data, size_t offset, size_t len) {
+    size_t expected = ref_find_invalid_quality(data, len);
+    size_t got = simd_find_invalid_quality(data, len);
+    if (got != expected) {
+        fail(backend, "simd_find_invalid_quality", offset, len, expected, got);
+    }
+}
+
+/* Random bytes with a newline on average every 1 << shift bytes
+ * (none for shift 0) */
+static void fill_lines(char *data, size_t len, int shift) {
+    for (size_t i = 0; i < len; i++) {
+        char c = (char)(rand() % 256);
+        if (c == '\n') {
+            c = 'A';
+        }
+        if (shift > 0 && rand() % (1 << shift) == 0) {
+            c = '\n';
+        }
+        data[i] = c;
+    }
+}
+
+/* Valid bases or quality characters, with up to two random bytes planted */
+static void fill_valid(char *data, size_t len, int quality) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = quality ? (char)('!' + rand() % 94) : IUPAC[rand() % (sizeof(IUPAC) - 1)];
+    }
+    int plant = rand() % 3;
+    for (int i = 0; i < plant && len > 0; i++) {
+        data[rand() % len] = (char)(rand() % 256);
+    }
+}
+
+static void test_backend(SimdBackend backend, char *buffer) {
+    static const int shifts[] = { 0, 1, 4, 8, 12 };
+    
+    for (int iter = 0; iter < ITERATIONS; iter++) {
+        size_t offset = (size_t)(rand() % ALIGN_SLACK);
+        size_t len = (size_t)(rand() % (iter % 8 == 0 ? MAX_LEN : 200));
+        char *data = buffer + offset;
+        
+        fill_lines(data, len, shifts[rand() % 5]);
+        int max_lines = (rand() % 4 == 0) ? MAX_LEN : 1 + rand() % 8;
+        check_lines(backend, data, offset, len, max_lines);
+        
+        fill_valid(data, len, 0);
+        check_base(backend, data, offset, len);
+        
+        fill_valid(data, len, 1);
+        check_quality(backend, data, offset, len);
+    }
+    
+    /* Every byte value at positions around the vector widths */
+    for (int c = 0; c < 256; c++) {
+        for (size_t pos = 0; pos < 100; pos += 7) {
+            char *data = buffer + pos % 3;
+            memset(data, 'a', 100);
+            data[pos] = (char)c;
+            check_base(backend, data, pos % 3, 100);
+            memset(data, 'I', 100);
+            data[pos] = (char)c;
+            check_quality(backend, data, pos % 3, 100);
+            check_lines(backend, data, pos % 3, 100, 4);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned int seed = (argc > 1) ? (unsigned int)strtoul(argv[1], NULL, 10) : 1;
+    char *buffer = malloc(MAX_LEN + ALIGN_SLACK);
+    if (buffer == NULL) {
+        return 1;
+    }
+    
+    SimdBackend backends[] = { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!simd_scan_set_backend(backends[i])) {
+            printf("%-6s skipped (not supported by this CPU)\n",
+                   simd_scan_backend_name(backends[i]));
+            continue;
+        }
+        srand(seed);
+        unsigned long before = failures;
+        test_backend(backends[i], buffer);
+        printf("%-6s %s\n", simd_scan_backend_name(backends[i]),
+               failures == before ? "ok" : "FAILED");
+    }
+    
+    free(buffer);
+    return failures == 0 ? 0 : 1;
+}
@@ -1,8 +1,14 @@
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #include "utils.h"
 #include <string.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 void* safe_malloc(size_t size) {
     void *ptr = malloc(size);
@@ -35,11 +41,19 @@ void trim_newline(char *str) {
     if (str == NULL) {
         return;
     }
-    size_t len = strlen(str);
+    trim_newline_len(str, strlen(str));
+}
+
+/* Same as trim_newline for a string of known length; returns the new length */
+size_t trim_newline_len(char *str, size_t len) {
+    if (str == NULL) {
+        return 0;
+    }
     while (len > 0 && (str[len - 1] == '\n' || str[len - 1] == '\r')) {
-        str[len - 1] = '\0';
         len--;
     }
+    str[len] = '\0';
+    return len;
 }
 
 void error_exit(const char *format, ...) {
@@ -73,3 +87,210 @@ long get_file_size(const char *filename) {
     }
     return buffer.st_size;
 }
+
+int write_fd_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERR_FILE_WRITE;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return SUCCESS;
+}
+
+int copy_fd_range(int in_fd, int out_fd, size_t len) {
+#ifdef __linux__
+    /* Let the kernel copy (or reflink) the data without a round trip */
+    while (len > 0) {
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, len, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+                break;  /* Not supported here, fall back to read/write */
+            }
+            return ERR_FILE_WRITE;
+        }
+        if (n == 0) {
+            errno = EIO;  /* Source ended early */
+            return ERR_FILE_READ;
+        }
+        len -= (size_t)n;
+    }
+#endif
+    
+    char buffer[64 * 1024];
+    while (len > 0) {
+        ssize_t n = read(in_fd, buffer, (len < sizeof(buffer)) ? len : sizeof(buffer));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERR_FILE_READ;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return ERR_FILE_READ;
+        }
+        
+        if (write_fd_all(out_fd, buffer, (size_t)n) != SUCCESS) {
+            return ERR_FILE_WRITE;
+        }
+        len -= (size_t)n;
+    }
+    
+    return SUCCESS;
+}
+
+/* Arena blocks: this header, then the allocations */
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;              /* Bytes after the header */
+    size_t used;
+    int mapped;               /* From mmap() rather than malloc() */
+};
+
+#define ARENA_HEADER ((sizeof(ArenaBlock) + 15) & ~(size_t)15)
+
+/* Totals for alloc_stats_get(), updated by every thread */
+static size_t arena_blocks_total;
+static size_t arena_bytes_total;
+static size_t arena_nanoseconds_total;
+
+/* Map len bytes aligned to ARENA_HUGE_BLOCK, so the kernel can back them
+ * with huge pages; returns NULL on failure */
+static void* map_huge(size_t len) {
+    size_t span = len + ARENA_HUGE_BLOCK;
+    char *p = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    
+    /* Trim the unaligned head and the tail */
+    size_t head = (ARENA_HUGE_BLOCK - (size_t)((uintptr_t)p % ARENA_HUGE_BLOCK)) % ARENA_HUGE_BLOCK;
+    if (head > 0) {
+        munmap(p, head);
+    }
+    if (span - head > len) {
+        munmap(p + head + len, span - head - len);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(p + head, len, MADV_HUGEPAGE);
+#endif
+    return p + head;
+}
+
+/* New block of total bytes, header included */
+static ArenaBlock* arena_new_block(size_t total) {
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    ArenaBlock *block = NULL;
+    int mapped = 0;
+    if (total >= ARENA_HUGE_BLOCK) {
+        total = (total + ARENA_HUGE_BLOCK - 1) & ~(size_t)(ARENA_HUGE_BLOCK - 1);
+        block = map_huge(total);
+        mapped = (block != NULL);
+    }
+    if (block == NULL) {
+        block = safe_malloc(total);
+    }
+    block->next = NULL;
+    block->size = total - ARENA_HEADER;
+    block->used = 0;
+    block->mapped = mapped;
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    size_t ns = (size_t)((end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec));
+    __atomic_add_fetch(&arena_blocks_total, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&arena_bytes_total, total, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&arena_nanoseconds_total, ns, __ATOMIC_RELAXED);
+    return block;
+}
+
+void arena_init(Arena *arena, size_t block_size) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->block_size = block_size;
+}
+
+void* arena_alloc(Arena *arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    ArenaBlock *block = arena->current;
+    
+    if (block == NULL || block->used + size > block->size) {
+        /* Move on to a kept block with room, or add one after the current one */
+        ArenaBlock *next = (block != NULL) ? block->next : arena->first;
+        while (next != NULL && next->size < size) {
+            next = next->next;
+        }
+        if (next == NULL) {
+            size_t need = ARENA_HEADER + size;
+            next = arena_new_block(need > arena->block_size ? need : arena->block_size);
+            if (block == NULL) {
+                arena->first = next;
+            } else {
+                next->next = block->next;
+                block->next = next;
+            }
+        }
+        block = next;
+        arena->current = block;
+    }
+    
+    void *ptr = (char *)block + ARENA_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char* arena_strndup(Arena *arena, const char *str, size_t len) {
+    char *dup = arena_alloc(arena, len + 1);
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+void arena_reset(Arena *arena) {
+    for (ArenaBlock *block = arena->first; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->first;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        if (block->mapped) {
+            munmap(block, ARENA_HEADER + block->size);
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+void alloc_stats_get(AllocStats *stats) {
+    stats->arena_blocks = __atomic_load_n(&arena_blocks_total, __ATOMIC_RELAXED);
+    stats->arena_bytes = __atomic_load_n(&arena_bytes_total, __ATOMIC_RELAXED);
+    stats->arena_seconds = (double)__atomic_load_n(&arena_nanoseconds_total, __ATOMIC_RELAXED) / 1e9;
+    
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stats->minor_faults = usage.ru_minflt;
+        stats->major_faults = usage.ru_majflt;
+    } else {
+        stats->minor_faults = 0;
+        stats->major_faults = 0;
+    }
+}
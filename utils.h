@@ -21,6 +21,7 @@ void* safe_realloc(void *ptr, size_t size);
 /* String processing functions */
 char* safe_strdup(const char *str);
 void trim_newline(char *str);
+size_t trim_newline_len(char *str, size_t len);
 
 /* Error handling functions */
 void error_exit(const char *format, ...);
@@ -30,4 +31,56 @@ void warning_msg(const char *format, ...);
 int file_exists(const char *filename);
 long get_file_size(const char *filename);
 
+/* Write all len bytes to fd, retrying short writes; returns SUCCESS or
+ * ERR_FILE_WRITE with errno set */
+int write_fd_all(int fd, const void *data, size_t len);
+
+/* Copy len bytes from in_fd to out_fd at their current offsets, using
+ * copy_file_range() where available; returns SUCCESS or an error code
+ * with errno set */
+int copy_fd_range(int in_fd, int out_fd, size_t len);
+
+/* Arena (bump) allocator for data that is released all at once, such as
+ * the records of a batch. Allocations are carved from large blocks;
+ * arena_reset() makes the whole arena free again but keeps its blocks,
+ * so a reused arena stops allocating once it has grown to its working
+ * size. Blocks of ARENA_HUGE_BLOCK bytes or more are mapped directly and
+ * backed by transparent huge pages where the kernel allows it. An arena
+ * is not thread-safe. */
+#define ARENA_HUGE_BLOCK (2 * 1024 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *first;
+    ArenaBlock *current;      /* Block allocations come from */
+    size_t block_size;
+} Arena;
+
+/* Start an empty arena that allocates block_size bytes at a time */
+void arena_init(Arena *arena, size_t block_size);
+
+/* Allocate size bytes (16-byte aligned); exits like safe_malloc() on failure */
+void* arena_alloc(Arena *arena, size_t size);
+
+/* Copy len bytes of str into the arena, NUL-terminated */
+char* arena_strndup(Arena *arena, const char *str, size_t len);
+
+/* Release every allocation, keeping the blocks */
+void arena_reset(Arena *arena);
+
+/* Release the blocks */
+void arena_free(Arena *arena);
+
+/* Allocation counters for the verbose summaries */
+typedef struct {
+    size_t arena_blocks;      /* Arena blocks obtained so far */
+    size_t arena_bytes;
+    double arena_seconds;     /* Time spent obtaining them */
+    long minor_faults;        /* Page faults of the process so far */
+    long major_faults;
+} AllocStats;
+
+void alloc_stats_get(AllocStats *stats);
+
 #endif /* UTILS_H */